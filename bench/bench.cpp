@@ -0,0 +1,358 @@
+// Benchmark driver: builds a synthetic repository of a configurable shape in
+// a scratch directory, drives it through the vcs API and prints per-operation
+// latency percentiles, throughput and peak RSS as JSON.
+//
+//   minigit-bench [--files N] [--mean-size BYTES] [--max-size BYTES] [--dirs N]
+//                 [--commits N] [--churn N] [--branch-every N] [--branch-commits N]
+//                 [--reads N] [--hash ALGO] [--seed N] [--dir PATH] [--keep] [--out FILE]
+//
+// Files get log-normally distributed sizes around --mean-size. Every commit
+// edits --churn files near their start; every --branch-every commits a side
+// branch is made, gets --branch-commits commits that append to files, and is
+// merged back, so merges are non-trivial but clean. Finally log, diff and
+// checkout are run --reads times against random points of the history.
+
+#include "../src/io.hpp"
+#include "../src/utils.hpp"
+#include "../src/vcs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Options {
+    std::size_t files = 1000;
+    std::size_t meanSize = 4096;
+    std::size_t maxSize = 1 << 20;
+    std::size_t dirs = 0; // 0 = about sqrt(files)
+    std::size_t commits = 50;
+    std::size_t churn = 10;
+    std::size_t branchEvery = 10;
+    std::size_t branchCommits = 3;
+    std::size_t reads = 20;
+    std::string hash = "blake3";
+    std::uint64_t seed = 1;
+    std::string dir;
+    bool keep = false;
+    std::string out;
+};
+
+// Latencies of one operation, plus the work it covered for throughput
+struct Samples {
+    std::vector<double> ms;
+    std::uint64_t items = 0;
+    std::uint64_t bytes = 0;
+};
+
+// Swallows the commands' normal output so terminal speed is not measured
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int ch) override { return traits_type::not_eof(ch); }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+class Bench {
+public:
+    explicit Bench(const Options& options) : options_(options), rng_(options.seed) {}
+
+    void run() {
+        generate();
+        std::vector<std::string> all;
+        for (const auto& file : files_) all.push_back(file);
+        stageAndCommit(all, "initial import");
+
+        std::size_t sinceBranch = 0;
+        for (std::size_t i = 0; i < options_.commits; ++i) {
+            stageAndCommit(editFiles(options_.churn, false), "commit " + std::to_string(i));
+            if (options_.branchEvery && ++sinceBranch == options_.branchEvery) {
+                sinceBranch = 0;
+                sideBranch();
+            }
+        }
+
+        for (std::size_t i = 0; i < options_.reads; ++i) {
+            time("log", [] { vcs::log(); });
+            const std::string& a = pick(history_);
+            const std::string& b = pick(history_);
+            time("diff", [&] { vcs::diff(a, b); });
+        }
+        for (std::size_t i = 0; i < options_.reads; ++i) {
+            const std::string& target = pick(history_);
+            time("checkout", [&] { vcs::checkout(target); });
+        }
+        time("checkout", [] { vcs::checkout("main"); });
+    }
+
+    void report(std::ostream& out, double wallSeconds) const {
+        out << std::fixed << std::setprecision(3);
+        out << "{\n  \"config\": {"
+            << "\"files\": " << options_.files << ", \"mean_size\": " << options_.meanSize
+            << ", \"max_size\": " << options_.maxSize << ", \"dirs\": " << dirs_
+            << ", \"commits\": " << options_.commits << ", \"churn\": " << options_.churn
+            << ", \"branch_every\": " << options_.branchEvery << ", \"branch_commits\": " << options_.branchCommits
+            << ", \"reads\": " << options_.reads << ", \"hash\": \"" << options_.hash << "\""
+            << ", \"seed\": " << options_.seed << "},\n";
+        out << "  \"repo\": {\"bytes\": " << totalBytes_ << ", \"commits\": " << history_.size()
+            << ", \"merges\": " << merges_ << "},\n";
+        out << "  \"ops\": {";
+        bool first = true;
+        for (const auto& [name, samples] : samples_) {
+            std::vector<double> sorted = samples.ms;
+            std::sort(sorted.begin(), sorted.end());
+            double total = 0;
+            for (double ms : sorted) total += ms;
+            const double seconds = total / 1000.0;
+
+            out << (first ? "\n" : ",\n") << "    \"" << name << "\": {"
+                << "\"count\": " << sorted.size() << ", \"total_ms\": " << total
+                << ", \"mean_ms\": " << (sorted.empty() ? 0.0 : total / sorted.size())
+                << ", \"p50_ms\": " << percentile(sorted, 0.50) << ", \"p90_ms\": " << percentile(sorted, 0.90)
+                << ", \"p99_ms\": " << percentile(sorted, 0.99) << ", \"max_ms\": " << (sorted.empty() ? 0.0 : sorted.back())
+                << ", \"ops_per_sec\": " << (seconds > 0 ? sorted.size() / seconds : 0.0);
+            if (samples.items) out << ", \"files_per_sec\": " << (seconds > 0 ? samples.items / seconds : 0.0);
+            if (samples.bytes) out << ", \"mb_per_sec\": " << (seconds > 0 ? samples.bytes / seconds / 1e6 : 0.0);
+            out << "}";
+            first = false;
+        }
+        out << "\n  },\n";
+        out << "  \"errors\": " << errors_ << ",\n";
+        out << "  \"wall_seconds\": " << wallSeconds << ",\n";
+        out << "  \"peak_rss_kb\": " << peakRssKb() << "\n}\n";
+    }
+
+private:
+    template <typename Fn>
+    Samples& time(const std::string& name, Fn&& fn) {
+        const std::size_t errorsBefore = utils::errorCount();
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        errors_ += utils::errorCount() - errorsBefore;
+        Samples& samples = samples_[name];
+        samples.ms.push_back(std::chrono::duration<double, std::milli>(elapsed).count());
+        return samples;
+    }
+
+    static double percentile(const std::vector<double>& sorted, double p) {
+        if (sorted.empty()) return 0;
+        std::size_t rank = static_cast<std::size_t>(std::ceil(p * sorted.size()));
+        return sorted[std::min(sorted.size(), std::max<std::size_t>(rank, 1)) - 1];
+    }
+
+    static long peakRssKb() {
+#if defined(__unix__) || defined(__APPLE__)
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+        return usage.ru_maxrss;
+#endif
+#else
+        return 0;
+#endif
+    }
+
+    const std::string& pick(const std::vector<std::string>& from) {
+        return from[std::uniform_int_distribution<std::size_t>(0, from.size() - 1)(rng_)];
+    }
+
+    std::string randomLine() {
+        static const char* const words[] = {"alpha", "beta", "gamma", "delta", "commit", "tree", "blob",
+                                            "merge", "index", "branch", "hash", "object", "pack", "ref"};
+        std::uniform_int_distribution<int> word(0, 13), count(3, 12);
+        std::string line;
+        for (int i = count(rng_); i > 0; --i) {
+            line += words[word(rng_)];
+            line += i > 1 ? ' ' : '\n';
+        }
+        return line;
+    }
+
+    std::string randomText(std::size_t size) {
+        std::string text;
+        while (text.size() < size) text += randomLine();
+        return text;
+    }
+
+    void generate() {
+        dirs_ = options_.dirs ? options_.dirs
+                              : std::max<std::size_t>(1, static_cast<std::size_t>(std::sqrt(double(options_.files))));
+        // Log-normal with the requested mean: mu = ln(mean) - sigma^2 / 2
+        const double sigma = 1.0;
+        std::lognormal_distribution<double> size(std::log(double(options_.meanSize)) - sigma * sigma / 2, sigma);
+        for (std::size_t i = 0; i < options_.files; ++i) {
+            std::size_t d = i % dirs_;
+            fs::path path = fs::path("d" + std::to_string(d % 16)) / ("s" + std::to_string(d)) / ("f" + std::to_string(i) + ".txt");
+            fs::create_directories(path.parent_path());
+            std::size_t bytes = std::min<std::size_t>(options_.maxSize, std::max<std::size_t>(1, std::size_t(size(rng_))));
+            std::ofstream(path, std::ios::binary) << randomText(bytes);
+            totalBytes_ += bytes;
+            files_.push_back(path.generic_string());
+        }
+    }
+
+    // Rewrites a line near the start of each file (main) or appends one
+    // (side branches), so the two sides of a merge never touch the same lines
+    std::vector<std::string> editFiles(std::size_t count, bool append) {
+        std::vector<std::string> edited;
+        for (std::size_t i = 0; i < count && !files_.empty(); ++i) {
+            const std::string& path = pick(files_);
+            std::ifstream in(path, std::ios::binary);
+            std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            in.close();
+            if (append) {
+                content += randomLine();
+            } else {
+                std::size_t end = content.find('\n');
+                content.replace(0, end == std::string::npos ? content.size() : end + 1, randomLine());
+            }
+            std::ofstream(path, std::ios::binary | std::ios::trunc) << content;
+            edited.push_back(path);
+        }
+        std::sort(edited.begin(), edited.end());
+        edited.erase(std::unique(edited.begin(), edited.end()), edited.end());
+        return edited;
+    }
+
+    void stageAndCommit(const std::vector<std::string>& paths, const std::string& message) {
+        std::uint64_t bytes = 0;
+        for (const auto& path : paths) {
+            std::error_code ec;
+            bytes += fs::file_size(path, ec);
+        }
+        Samples& add = time("add", [&] { vcs::add(paths); });
+        add.items += paths.size();
+        add.bytes += bytes;
+        time("commit", [&] { vcs::commit(message); });
+        history_.push_back(utils::trim(IOManager::resolveHEAD()));
+    }
+
+    void sideBranch() {
+        const std::string name = "topic" + std::to_string(++branches_);
+        vcs::branch(name);
+        time("checkout", [&] { vcs::checkout(name); });
+        for (std::size_t i = 0; i < options_.branchCommits; ++i) {
+            stageAndCommit(editFiles(options_.churn, true), name + " commit " + std::to_string(i));
+        }
+        time("checkout", [] { vcs::checkout("main"); });
+        stageAndCommit(editFiles(options_.churn, false), "main before merging " + name);
+        time("merge", [&] { vcs::merge(name); });
+        history_.push_back(utils::trim(IOManager::resolveHEAD()));
+        ++merges_;
+    }
+
+    const Options& options_;
+    std::mt19937_64 rng_;
+    std::size_t dirs_ = 0;
+    std::uint64_t totalBytes_ = 0;
+    std::size_t branches_ = 0;
+    std::size_t merges_ = 0;
+    std::size_t errors_ = 0;
+    std::vector<std::string> files_;
+    std::vector<std::string> history_;
+    std::map<std::string, Samples> samples_;
+};
+
+bool parseArgs(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string { return i + 1 < argc ? argv[++i] : ""; };
+        auto number = [&](auto& field) {
+            std::string text = value();
+            if (text.empty()) return false;
+            field = static_cast<std::remove_reference_t<decltype(field)>>(std::stoull(text));
+            return true;
+        };
+        bool ok = true;
+        if (arg == "--files") ok = number(options.files);
+        else if (arg == "--mean-size") ok = number(options.meanSize);
+        else if (arg == "--max-size") ok = number(options.maxSize);
+        else if (arg == "--dirs") ok = number(options.dirs);
+        else if (arg == "--commits") ok = number(options.commits);
+        else if (arg == "--churn") ok = number(options.churn);
+        else if (arg == "--branch-every") ok = number(options.branchEvery);
+        else if (arg == "--branch-commits") ok = number(options.branchCommits);
+        else if (arg == "--reads") ok = number(options.reads);
+        else if (arg == "--seed") ok = number(options.seed);
+        else if (arg == "--hash") ok = !(options.hash = value()).empty();
+        else if (arg == "--dir") ok = !(options.dir = value()).empty();
+        else if (arg == "--out") ok = !(options.out = value()).empty();
+        else if (arg == "--keep") options.keep = true;
+        else ok = false;
+        if (!ok) {
+            std::cerr << "Bad or unknown option: " << arg << "\n";
+            return false;
+        }
+    }
+    return options.files > 0 && options.meanSize > 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    try {
+        if (!parseArgs(argc, argv, options)) {
+            std::cerr << "Usage: minigit-bench [--files N] [--mean-size BYTES] [--max-size BYTES] [--dirs N]\n"
+                         "                     [--commits N] [--churn N] [--branch-every N] [--branch-commits N]\n"
+                         "                     [--reads N] [--hash sha1|sha256|blake3] [--seed N]\n"
+                         "                     [--dir PATH] [--keep] [--out FILE]\n";
+            return 2;
+        }
+    } catch (const std::exception&) {
+        std::cerr << "Numeric options need a non-negative integer.\n";
+        return 2;
+    }
+
+    const fs::path origin = fs::current_path();
+    fs::path workdir = options.dir.empty()
+        ? fs::temp_directory_path() / ("minigit-bench-" + std::to_string(options.seed) + "-" +
+                                       std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()))
+        : fs::path(options.dir);
+    if (fs::exists(workdir) && !fs::is_empty(workdir)) {
+        std::cerr << "Benchmark directory is not empty: " << workdir << "\n";
+        return 2;
+    }
+    fs::create_directories(workdir);
+    fs::current_path(workdir);
+
+    Bench bench(options);
+    NullBuffer null;
+    std::streambuf* terminal = std::cout.rdbuf(&null);
+    auto start = std::chrono::steady_clock::now();
+    vcs::init(options.hash);
+    bench.run();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout.rdbuf(terminal);
+
+    fs::current_path(origin);
+    if (!options.keep) fs::remove_all(workdir);
+
+    if (options.out.empty()) {
+        bench.report(std::cout, wall);
+    } else {
+        std::ofstream out(options.out);
+        bench.report(out, wall);
+    }
+    return 0;
+}
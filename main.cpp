@@ -1,6 +1,5 @@
 #include "src/cli.hpp" 
 
-int main(){
-    CLI::run();
-    return 0;
+int main(int argc, char* argv[]){
+    return CLI::run(argc, argv);
 }
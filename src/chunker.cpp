@@ -0,0 +1,98 @@
+#include "chunker.hpp"
+
+#include <array>
+#include <cctype>
+
+namespace chunker {
+
+namespace {
+
+// Leading NUL keeps text files from ever looking like a manifest.
+const std::string MANIFEST_MAGIC = std::string("\0MGCHUNKS 1\n", 12);
+
+// Normalized chunking: a stricter mask (more bits) before the average size
+// and a looser one after it pulls chunk sizes towards AVG_CHUNK. The gear
+// hash shifts left, so its high bits cover the most bytes and are the ones tested.
+constexpr std::uint64_t MASK_STRICT = ~std::uint64_t(0) << (64 - 18);
+constexpr std::uint64_t MASK_LOOSE = ~std::uint64_t(0) << (64 - 14);
+
+// Random 64-bit value per byte, generated with splitmix64 from a fixed seed
+// so chunk boundaries are the same in every build.
+constexpr std::array<std::uint64_t, 256> makeGear() {
+    std::array<std::uint64_t, 256> table{};
+    std::uint64_t state = 0x6d696e6967697421ULL;
+    for (auto& entry : table) {
+        state += 0x9e3779b97f4a7c15ULL;
+        std::uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        entry = z ^ (z >> 31);
+    }
+    return table;
+}
+
+constexpr std::array<std::uint64_t, 256> GEAR = makeGear();
+
+}
+
+std::size_t cutPoint(const unsigned char* data, std::size_t length) {
+    if (length <= MIN_CHUNK) return length;
+    const std::size_t normal = length < AVG_CHUNK ? length : AVG_CHUNK;
+    const std::size_t limit = length < MAX_CHUNK ? length : MAX_CHUNK;
+
+    // Bytes before MIN_CHUNK can never end a chunk, so they are not hashed.
+    // Each step is one shift-add (a single lea) plus two dependent loads, so
+    // the loop is bound by loads rather than by the hash chain: scanning four
+    // spans side by side to overlap the chains measured slower than this.
+    std::uint64_t hash = 0;
+    std::size_t i = MIN_CHUNK;
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + GEAR[data[i]];
+        if (!(hash & MASK_STRICT)) return i + 1;
+    }
+    for (; i < limit; ++i) {
+        hash = (hash << 1) + GEAR[data[i]];
+        if (!(hash & MASK_LOOSE)) return i + 1;
+    }
+    return limit;
+}
+
+bool hasManifestHeader(const std::string& content) {
+    return content.compare(0, MANIFEST_MAGIC.size(), MANIFEST_MAGIC) == 0;
+}
+
+std::string serializeManifest(const std::vector<ChunkRef>& chunks) {
+    std::string out = MANIFEST_MAGIC;
+    for (const auto& chunk : chunks) {
+        out += chunk.hash + " " + std::to_string(chunk.size) + "\n";
+    }
+    return out;
+}
+
+bool parseManifest(const std::string& content, std::vector<ChunkRef>& chunks) {
+    chunks.clear();
+    if (!hasManifestHeader(content) || content.back() != '\n') return false;
+    std::size_t pos = MANIFEST_MAGIC.size();
+    while (pos < content.size()) {
+        const std::size_t end = content.find('\n', pos);
+        const std::size_t space = content.find(' ', pos);
+        if (space == std::string::npos || space > end || space == pos || space + 1 == end) return false;
+
+        ChunkRef chunk;
+        chunk.hash = content.substr(pos, space - pos);
+        for (char c : chunk.hash) {
+            if (!std::isxdigit(static_cast<unsigned char>(c))) return false;
+        }
+        for (std::size_t i = space + 1; i < end; ++i) {
+            const char c = content[i];
+            if (c < '0' || c > '9' || chunk.size > MAX_CHUNK) return false;
+            chunk.size = chunk.size * 10 + std::uint64_t(c - '0');
+        }
+        if (chunk.size == 0 || chunk.size > MAX_CHUNK) return false;
+        chunks.push_back(std::move(chunk));
+        pos = end + 1;
+    }
+    return !chunks.empty();
+}
+
+}
@@ -0,0 +1,43 @@
+#ifndef CHUNKER_HPP
+#define CHUNKER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Content-defined chunking (FastCDC) for large blobs. Cut points depend only
+// on the bytes around them, so an edit moves at most the chunks it touches
+// and every other chunk keeps its hash and is stored once.
+//
+// A chunked blob is stored under the hash of its full content, but the object
+// itself is a manifest listing the chunks, which are ordinary blobs. An
+// ordinary blob is named by the hash of its own bytes and a manifest is not,
+// which tells a file that merely starts like a manifest from a real one.
+namespace chunker {
+
+constexpr std::size_t MIN_CHUNK = 16 * 1024;
+constexpr std::size_t AVG_CHUNK = 64 * 1024;
+constexpr std::size_t MAX_CHUNK = 256 * 1024;
+
+// Length of the chunk starting at data: at most MAX_CHUNK, and all of
+// [data, data+length) when length <= MIN_CHUNK. Pass at least MAX_CHUNK bytes
+// unless data runs to the end of the file, or the cut may move.
+std::size_t cutPoint(const unsigned char* data, std::size_t length);
+
+struct ChunkRef {
+    std::string hash;
+    std::uint64_t size = 0;
+};
+
+// True if content starts with the manifest header; only a full parse (and
+// the object's name) can tell whether it is one
+bool hasManifestHeader(const std::string& content);
+std::string serializeManifest(const std::vector<ChunkRef>& chunks);
+// Parses a manifest strictly, without throwing: false unless every line is a
+// hex chunk hash and a size of 1 to MAX_CHUNK bytes
+bool parseManifest(const std::string& content, std::vector<ChunkRef>& chunks);
+
+}
+
+#endif
@@ -1,17 +1,121 @@
 #include "cli.hpp"
 #include "vcs.hpp"
+#include "io.hpp"
+#include "gc.hpp"
+#include "server.hpp"
+#include "fsmonitor.hpp"
+#include "utils.hpp"
+#include "trace.hpp"
+#include "hash.hpp"
 #include <iostream>
 #include <iomanip>
+#include <fstream>
 #include <sstream>
 #include <algorithm>
 
-void CLI::run() {
+namespace {
+// Set by --stats: print a trace summary after every command
+bool showStats = false;
+
+// The algorithms init accepts; legacy std::hash ids are only read, not created
+bool creatableHash(const std::string& name) {
+    hashing::Algorithm algorithm;
+    return hashing::parseAlgorithm(name, algorithm) && algorithm != hashing::Algorithm::Legacy;
+}
+}
+
+int CLI::run(int argc, char* argv[]) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    // Global options come before the command.
+    std::string traceFile;
+    size_t consumed = 0;
+    for (; consumed < args.size(); ++consumed) {
+        if (args[consumed] == "--stats") {
+            showStats = true;
+        } else if (args[consumed] == "--trace") {
+            if (consumed + 1 == args.size()) {
+                std::cerr << "Usage: minigit [--trace <file>] [--stats] <command> [args...]\n";
+                return EXIT_USAGE;
+            }
+            traceFile = args[++consumed];
+        } else {
+            break;
+        }
+    }
+    args.erase(args.begin(), args.begin() + consumed);
+    if (showStats || !traceFile.empty()) trace::enable();
+
+    int status = dispatch(args);
+    if (!traceFile.empty() && !trace::writeChromeTrace(traceFile)) {
+        utils::displayError("Cannot write trace file " + traceFile);
+        status = std::max(status, EXIT_FAILED);
+    }
+    return status;
+}
+
+int CLI::dispatch(const std::vector<std::string>& args) {
+    if (args.empty()) {
+        interactive();
+        return EXIT_OK;
+    }
+
+    if (args[0] == "daemon") {
+        if (args.size() == 1) return server::serve(executeCommand, isReadOnly);
+        if (args.size() != 2 || args[1] != "stop") {
+            std::cerr << "Usage: minigit daemon [stop]\n";
+            return EXIT_USAGE;
+        }
+        int status = EXIT_OK;
+        if (server::forward(args, status)) return status;
+        utils::displayError("No MiniGit daemon is running for this repository.");
+        return EXIT_FAILED;
+    }
+    if (args[0] == "fsmonitor") {
+        if (args.size() == 1) return fsmonitor::runHelper();
+        if (args.size() != 2 || args[1] != "--stop") {
+            std::cerr << "Usage: minigit fsmonitor [--stop]\n";
+            return EXIT_USAGE;
+        }
+        if (fsmonitor::stopHelper()) return utils::errorCount() == 0 ? EXIT_OK : EXIT_FAILED;
+        utils::displayError("No filesystem monitor is running for this repository.");
+        return EXIT_FAILED;
+    }
+    if (args[0] != "--batch") {
+        // A running daemon has everything loaded already; otherwise run here.
+        // Traced commands always run here, where the trace is being recorded.
+        int status = EXIT_OK;
+        if (args[0] != "init" && !trace::enabled() && server::forward(args, status)) return status;
+        return executeCommand(args);
+    }
+
+    bool keepGoing = false;
+    std::string source = "-";
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (args[i] == "--keep-going") keepGoing = true;
+        else if (source == "-") source = args[i];
+        else {
+            std::cerr << "Usage: minigit --batch [--keep-going] [file|-]\n";
+            return EXIT_USAGE;
+        }
+    }
+    if (source == "-") return batch(std::cin, keepGoing);
+
+    std::ifstream file(source);
+    if (!file) {
+        utils::displayError("Cannot open batch file " + source);
+        return EXIT_FAILED;
+    }
+    return batch(file, keepGoing);
+}
+
+void CLI::interactive() {
     std::string input;
     std::cout << " ----- Welcome to MiniGit! Type 'help' for commands. -----\n\n";
 
     while (true) {
         std::cout << "minigit> ";
-        std::getline(std::cin, input);
+        if (!std::getline(std::cin, input)) break;
         if (input.empty()) continue;
 
         std::vector<std::string> tokens = tokenize(input);
@@ -29,6 +133,46 @@ void CLI::run() {
     }
 }
 
+int CLI::batch(std::istream& in, bool keepGoing) {
+    // Commands run back to back in this process, so the index only has to be
+    // read once and written once; caches and the commit graph stay warm.
+    IOManager::holdIndex(true);
+    fsmonitor::Watcher watcher;
+    if (fsmonitor::enabled()) watcher.start();
+
+    int worst = EXIT_OK;
+    std::string line;
+    for (size_t lineNo = 1; std::getline(in, line); ++lineNo) {
+        std::string trimmed = utils::trim(line);
+        if (trimmed.empty() || trimmed[0] == '#') continue;
+
+        std::vector<std::string> tokens = tokenize(trimmed);
+        if (tokens.empty()) continue;
+        if (tokens[0] == "exit") break;
+
+        int status = executeCommand(tokens);
+        if (status == EXIT_OK) continue;
+        worst = std::max(worst, status);
+        std::cerr << "minigit: line " << lineNo << " failed: " << trimmed << "\n";
+        if (!keepGoing) break;
+    }
+
+    if (!IOManager::holdIndex(false)) {
+        utils::displayError("Failed to write the index.");
+        worst = std::max(worst, EXIT_FAILED);
+    }
+    return worst;
+}
+
+bool CLI::isReadOnly(const std::vector<std::string>& tokens) {
+    // status may refresh the index's stat data, but concurrent refreshes all
+    // write the same result, so it can still run alongside other reads.
+    const std::string& cmd = tokens[0];
+    if (cmd == "branch") return tokens.size() == 1 || tokens[1] == "--list";
+    if (cmd == "sparse-checkout") return tokens.size() == 2 && tokens[1] == "list";
+    return cmd == "help" || cmd == "log" || cmd == "status" || cmd == "diff";
+}
+
 std::vector<std::string> CLI::tokenize(const std::string& input) {
     std::vector<std::string> tokens;
     std::istringstream iss(input);
@@ -41,10 +185,33 @@ std::vector<std::string> CLI::tokenize(const std::string& input) {
     return tokens;
 }
 
-void CLI::executeCommand(const std::vector<std::string>& tokens) {
+int CLI::executeCommand(const std::vector<std::string>& tokens) {
+    if (!trace::enabled()) return runCommand(tokens);
+
+    const trace::Snapshot before = trace::snapshot();
+    int status;
+    {
+        trace::Scope scope(trace::intern("command: " + tokens[0]));
+        status = runCommand(tokens);
+    }
+    if (showStats) {
+        std::string title;
+        for (const auto& token : tokens) title += (title.empty() ? "" : " ") + token;
+        trace::printStats(std::cerr, before, title);
+    }
+    return status;
+}
+
+int CLI::runCommand(const std::vector<std::string>& tokens) {
     using namespace vcs;
 
     const std::string& cmd = tokens[0];
+    const size_t errorsBefore = utils::errorCount();
+    int exitStatus = EXIT_OK;
+    auto usage = [&exitStatus](const char* text) {
+        std::cout << text;
+        exitStatus = EXIT_USAGE;
+    };
 
     try {
         if (cmd == "help") showHelp();
@@ -52,11 +219,22 @@ void CLI::executeCommand(const std::vector<std::string>& tokens) {
             system("clear");
         } 
         else if (cmd == "init") {
-            init();
+            if (tokens.size() == 1) init();
+            else if (tokens.size() == 2 && tokens[1].rfind("--hash=", 0) == 0 && creatableHash(tokens[1].substr(7))) {
+                init(tokens[1].substr(7));
+            }
+            else usage("Usage: init [--hash=sha1|sha256|blake3]\n");
         } 
         else if (cmd == "add") {
-            if (tokens.size() != 2) std::cout << "Usage: add <filename>\n";
-            else  add(tokens[1]);
+            if (tokens.size() < 2) usage("Usage: add <file|dir|glob>...\n");
+            else add(std::vector<std::string>(tokens.begin() + 1, tokens.end()));
+
+        } 
+        else if (cmd == "rm") {
+            const bool cached = tokens.size() > 1 && tokens[1] == "--cached";
+            const size_t first = cached ? 2 : 1;
+            if (tokens.size() <= first) usage("Usage: rm [--cached] <path>...\n");
+            else vcs::remove(std::vector<std::string>(tokens.begin() + first, tokens.end()), cached);
 
         } 
         else if (cmd == "commit") {
@@ -67,50 +245,124 @@ void CLI::executeCommand(const std::vector<std::string>& tokens) {
                     msg += tokens[i];
                 }
                 commit(msg);
-            } 
-            else std::cout << "Usage: commit -m \"message\"\n";
+            }
+            // A cherry-pick stopped on conflicts supplies the message.
+            else if (tokens.size() == 1 && IOManager::fileExists(IOManager::CHERRY_PICK_HEAD_FILE)) commit("");
+            else usage("Usage: commit -m \"message\"\n");
 
         } 
         else if (cmd == "log") {
             log();
         } 
+        else if (cmd == "status") {
+            status();
+        } 
         else if (cmd == "branch") {
-            if (tokens.size() != 2) std::cout << "Usage: branch <name>\n";
+            if (tokens.size() == 1) listBranches();
+            else if (tokens[1] == "--list" && tokens.size() <= 3) listBranches(tokens.size() == 3 ? tokens[2] : "");
+            else if (tokens.size() != 2) usage("Usage: branch <name> | branch [--list [prefix]]\n");
             else branch(tokens[1]);
         } 
         else if (cmd == "checkout") {
-            if (tokens.size() != 2) std::cout << "Usage: checkout <branch|hash>\n"; 
-            else checkout(tokens[1]);
+            if (tokens.size() != 2) usage("Usage: checkout <branch|hash>\n"); 
+            else if (!checkout(tokens[1])) exitStatus = EXIT_FAILED;
         } 
+        else if (cmd == "sparse-checkout") {
+            const std::string sub = tokens.size() > 1 ? tokens[1] : "";
+            if (sub == "list" && tokens.size() == 2) listSparseCheckout();
+            else if (sub == "disable" && tokens.size() == 2) {
+                if (!sparseCheckout({})) exitStatus = EXIT_FAILED;
+            }
+            else if (sub == "set" && tokens.size() > 2) {
+                if (!sparseCheckout(std::vector<std::string>(tokens.begin() + 2, tokens.end()))) exitStatus = EXIT_FAILED;
+            }
+            else usage("Usage: sparse-checkout set <dir>... | sparse-checkout list | sparse-checkout disable\n");
+        }
         else if (cmd == "merge") {
-            if (tokens.size() != 2) std::cout << "Usage: merge <branch>\n";
-            else  merge(tokens[1]);
+            if (tokens.size() != 2) usage("Usage: merge <branch>\n");
+            else if (!merge(tokens[1])) exitStatus = EXIT_FAILED;
 
         } 
+        else if (cmd == "cherry-pick") {
+            if (tokens.size() != 2) usage("Usage: cherry-pick <commit>\n");
+            else if (!cherryPick(tokens[1])) exitStatus = EXIT_FAILED;
+        }
+        else if (cmd == "rebase") {
+            if (tokens.size() != 2 && tokens.size() != 3) usage("Usage: rebase <upstream> [<branch>]\n");
+            else if (!rebase(tokens[1], tokens.size() == 3 ? tokens[2] : "")) exitStatus = EXIT_FAILED;
+        }
         else if (cmd == "diff") {
-            if (tokens.size() != 3) std::cout << "Usage: diff <commit1> <commit2>\n";
-            else diff(tokens[1], tokens[2]);
+            textdiff::Algorithm algorithm = textdiff::Algorithm::Histogram;
+            std::vector<std::string> commits;
+            bool valid = true;
+            for (size_t i = 1; i < tokens.size(); ++i) {
+                if (tokens[i].rfind("--", 0) == 0) valid = valid && textdiff::parseAlgorithm(tokens[i].substr(2), algorithm);
+                else commits.push_back(tokens[i]);
+            }
+            if (!valid || commits.size() != 2) usage("Usage: diff [--histogram|--patience|--myers] <commit1> <commit2>\n");
+            else diff(commits[0], commits[1], algorithm);
 
         } 
-        else std::cout << " Unknown or malformed command. Type 'help'.\n";
+        else if (cmd == "pack") {
+            pack();
+        } 
+        else if (cmd == "pack-refs") {
+            if (tokens.size() != 1) usage("Usage: pack-refs\n");
+            else packRefs();
+        }
+        else if (cmd == "gc") {
+            std::int64_t grace = gc::DEFAULT_GRACE_SECONDS;
+            bool packAfter = true, valid = true;
+            for (size_t i = 1; i < tokens.size(); ++i) {
+                if (tokens[i].rfind("--prune=", 0) == 0) valid = valid && gc::parseGrace(tokens[i].substr(8), grace);
+                else if (tokens[i] == "--no-pack") packAfter = false;
+                else valid = false;
+            }
+            if (!valid) usage("Usage: gc [--prune=now|<n>[s|m|h|d]] [--no-pack]\n");
+            else vcs::gc(grace, packAfter);
+        }
+        else usage(" Unknown or malformed command. Type 'help'.\n");
 
     } catch (const std::exception& ex) {
         std::cerr << " Error: " << ex.what() << std::endl;
+        exitStatus = EXIT_FAILED;
     }
+
+    if (exitStatus == EXIT_OK && utils::errorCount() != errorsBefore) exitStatus = EXIT_FAILED;
+    return exitStatus;
 }
 
 void CLI::showHelp() {
     std::cout << R"(Available commands:
-  init                   Initialize a new MiniGit repo
-  add <file>             Stage a file
-  commit -m "<msg>"      Commit staged files with message
+  init [--hash=<algo>]   Initialize a new MiniGit repo (sha1, sha256, blake3)
+  add <path>...          Stage files, directories ('.') or globs ('src/**/*.cpp'),
+                         including the deletion of tracked files that are gone
+  rm [--cached] <path>...
+                         Stop tracking files (--cached: keep them on disk)
+  commit -m "<msg>"      Commit the index with message (after a conflicted
+                         cherry-pick, -m may be left out to keep its message)
   log                    Show commit history
+  status                 Show staged, modified, deleted and untracked files
   branch <name>          Create a new branch
+  branch [--list [<prefix>]]
+                         List branches (those starting with <prefix>)
   checkout <name|hash>   Switch to branch or commit
+  sparse-checkout set <dir>... | list | disable
+                         Check out only these directories (and the root's files)
   merge <branch>         Merge another branch
-  diff <c1> <c2>         Show diff between two commits
+  cherry-pick <commit>   Apply the changes of one commit on top of HEAD
+  rebase <upstream> [<branch>]
+                         Replay a branch (default: current) onto upstream
+  diff [--<algo>] <c1> <c2>
+                         Show diff between two commits (histogram, patience, myers)
+  pack                   Pack loose objects into a delta-compressed packfile
+  pack-refs              Move loose branch refs into .minigit/packed-refs
+  gc [--prune=<age>] [--no-pack]
+                         Delete unreachable objects older than <age> (default 14d, or now), then repack
   cls/clear              Clear the screen
   help                   Show this message
+  (from a shell: minigit [--trace <file>] [--stats] <command> | --batch [file] | daemon [stop]
+                | fsmonitor [--stop])
   exit                   Quit MiniGit
 )" << std::endl;
 }
@@ -1,19 +1,50 @@
 #pragma once
 
+#include <istream>
 #include <string>
 #include <vector>
 
 class CLI {
 public:
-    // Entry point: starts the interactive CLI loop
-    static void run();
+    // Exit statuses of argv and batch mode
+    static constexpr int EXIT_OK = 0;
+    static constexpr int EXIT_FAILED = 1; // the command reported an error (or merge conflicts)
+    static constexpr int EXIT_USAGE = 2;  // unknown command or malformed arguments
+
+    // Entry point. Without arguments starts the interactive CLI loop;
+    // "minigit <command> [args...]" runs a single command (on the daemon
+    // if one is running), "minigit --batch [--keep-going] [file]" runs one
+    // command per line of file (or stdin), and "minigit daemon [stop]" starts
+    // or stops the daemon. Returns the process exit status.
+    //
+    // Global options before the command: --trace <file> writes a Chrome
+    // trace of the run, --stats prints counters and timings after each command.
+    static int run(int argc, char* argv[]);
 
 private:
+    // Runs the arguments left after the global options
+    static int dispatch(const std::vector<std::string>& args);
+
+    // The interactive "minigit>" prompt, until "exit" or end of input
+    static void interactive();
+
+    // Runs each line of in as a command in this process, keeping the index
+    // and object caches loaded in between. Blank lines and '#' comments are
+    // skipped. Stops at the first failing command unless keepGoing is set;
+    // returns the highest exit status seen.
+    static int batch(std::istream& in, bool keepGoing);
+
+    // Commands the daemon may run concurrently with each other
+    static bool isReadOnly(const std::vector<std::string>& tokens);
+
     // Splits a user command string into command and arguments
     static std::vector<std::string> tokenize(const std::string& input);
 
+    // Runs a parsed command, timed and followed by --stats output when
+    // tracing is on, and returns its exit status
+    static int executeCommand(const std::vector<std::string>& tokens);
     // Handles a parsed command (calls appropriate VCS function)
-    static void executeCommand(const std::vector<std::string>& tokens);
+    static int runCommand(const std::vector<std::string>& tokens);
 
     // Shows a help message listing available commands
     static void showHelp();
@@ -0,0 +1,92 @@
+#include "commit.hpp"
+#include "io.hpp"
+#include "dsa.hpp"
+#include "trace.hpp"
+
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+Commit Commit::parse(std::string_view data) {
+    TRACE_SCOPE("commit::parse");
+    trace::count(trace::Counter::CommitsParsed);
+    Commit commit;
+    std::size_t pos = 0;
+    while (pos < data.size()) {
+        std::size_t end = data.find('\n', pos);
+        if (end == std::string_view::npos) end = data.size();
+        std::string_view line = data.substr(pos, end - pos);
+        pos = end + 1;
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+
+        std::size_t colon = line.find(": ");
+        if (colon == std::string_view::npos) continue;
+        std::string_view key = line.substr(0, colon);
+        std::string_view value = line.substr(colon + 2);
+
+        if (key == "parent") {
+            commit.parents.push_back(value);
+        } else if (key == "tree") {
+            commit.tree = value;
+        } else if (key == "timestamp") {
+            commit.timestamp = value;
+        } else if (key == "message") {
+            commit.message = value;
+        } else if (key == "file") {
+            std::size_t space = value.find(' ');
+            if (space != std::string_view::npos) {
+                commit.files.emplace_back(value.substr(0, space), value.substr(space + 1));
+            }
+        }
+    }
+    return commit;
+}
+
+std::optional<Commit> Commit::load(const std::string& hash) {
+    if (hash.empty()) return std::nullopt;
+    auto data = IOManager::readCommitBuffer(hash);
+    if (!data) return std::nullopt;
+    Commit commit = parse(*data);
+    commit.buffer = std::move(data);
+    return commit;
+}
+
+std::string Commit::serialize() const {
+    std::string out;
+    out.reserve(64 + message.size() + 80 * (parents.size() + files.size() + 1));
+    out.append("timestamp: ").append(timestamp).append("\n");
+    out.append("message: ").append(message).append("\n");
+    for (auto parent : parents) out.append("parent: ").append(parent).append("\n");
+    if (!tree.empty()) out.append("tree: ").append(tree).append("\n");
+    for (const auto& [path, hash] : files) out.append("file: ").append(path).append(" ").append(hash).append("\n");
+    return out;
+}
+
+std::string Commit::create(const std::string& tree, const std::vector<std::string>& parents,
+                           const std::string& message) {
+    auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    std::string timestamp = std::ctime(&now);
+    timestamp.pop_back();
+
+    Commit object;
+    object.timestamp = timestamp;
+    object.message = message;
+    object.tree = tree;
+    object.parents.assign(parents.begin(), parents.end());
+    const std::string data = object.serialize();
+
+    std::string hash = dsa::computeSHA1(data);
+    if (!IOManager::writeCommit(hash, data)) return "";
+    dsa::addCommit(hash, parents, now);
+    return hash;
+}
+
+std::int64_t Commit::time() const {
+    std::tm tm{};
+    std::istringstream iss{std::string(timestamp)};
+    iss >> std::get_time(&tm, "%a %b %d %H:%M:%S %Y");
+    if (iss.fail()) return 0;
+    tm.tm_isdst = -1;
+    return static_cast<std::int64_t>(std::mktime(&tm));
+}
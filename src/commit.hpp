@@ -0,0 +1,43 @@
+#ifndef COMMIT_HPP
+#define COMMIT_HPP
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// A commit object parsed in place. Every field is a view into the commit's
+// text; nothing is copied except the small parents/files lists. Commits made
+// by load() keep their buffer alive themselves, while views from parse()
+// are only valid as long as the text passed in.
+//
+// On-disk format, one "key: value" per line:
+//   timestamp: <ctime>   message: <text>   parent: <hash> (zero or more)
+//   tree: <hash>         file: <path> <hash> (older commits, instead of tree)
+struct Commit {
+    std::shared_ptr<const std::string> buffer;
+    std::string_view timestamp;
+    std::string_view message;
+    std::string_view tree; // empty for older commits that list their files inline
+    std::vector<std::string_view> parents; // first parent first; merges have two
+    std::vector<std::pair<std::string_view, std::string_view>> files; // inline (path, blob)
+
+    // Single pass over the text; unknown lines are ignored
+    static Commit parse(std::string_view data);
+    // Reads and parses a commit by hash (through the object cache), or nullopt if missing
+    static std::optional<Commit> load(const std::string& hash);
+
+    // The commit in its on-disk text form
+    std::string serialize() const;
+    // Writes a new commit stamped with the current time, records it in the
+    // commit graph and returns its hash ("" if it could not be stored)
+    static std::string create(const std::string& tree, const std::vector<std::string>& parents,
+                              const std::string& message);
+    // The timestamp as seconds since the epoch, or 0 if it cannot be parsed
+    std::int64_t time() const;
+};
+
+#endif
@@ -6,53 +6,312 @@
 #include <unordered_set>
 #include <queue>
 #include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <atomic>
+#include <mutex>
+#include "io.hpp"
+#include "commit.hpp"
+#include "utils.hpp"
+#include "trace.hpp"
 
 namespace dsa{
-static std::unordered_map<std::string, std::vector<std::string>> commitGraph; // Commit's hash -> list of Parent's hash( Directed Acyclic graph)
 
-std::string computeSHA1(const std::string& content) {
-    std::hash<std::string> hasher;
-    size_t hashValue = hasher(content);
+// Commit graph, persisted in .minigit/commit-graph so that history walks and
+// LCA lookups survive restarts and never have to open files under commits/.
+//
+// Layout: a 16 byte header ("MGCG", version, record count, reserved) followed
+// by fixed-size records appended in commit order. Parents are stored as record
+// indices; a merge keeps at most its first two parents.
+namespace {
+
+constexpr char GRAPH_MAGIC[4] = {'M', 'G', 'C', 'G'};
+constexpr std::uint32_t GRAPH_VERSION = 1;
+constexpr std::uint32_t NO_PARENT = 0xFFFFFFFFu;
+constexpr std::size_t GRAPH_HASH_WIDTH = 64;
+
+struct GraphHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t count;
+    std::uint32_t reserved;
+};
+
+struct GraphRecord {
+    char hash[GRAPH_HASH_WIDTH]; // hex hash, NUL padded
+    std::uint32_t parents[2];
+    std::uint32_t generation;    // 1 for root commits
+    std::uint32_t reserved;
+    std::int64_t timestamp;      // seconds since epoch
+};
+
+static_assert(sizeof(GraphHeader) == 16, "unexpected commit-graph header size");
+static_assert(sizeof(GraphRecord) == 88, "unexpected commit-graph record size");
 
-    std::stringstream ss;
-    ss << std::hex << std::setw(16) << std::setfill('0') << hashValue; //converts to hexadecimal with a length of 16 and adds 0 padding if necessary
-    return ss.str();
+struct CommitGraph {
+    MappedFile map;
+    std::uint32_t mappedCount = 0;
+    std::vector<GraphRecord> appended; // records added after the file was mapped
+    std::unordered_map<std::string, std::uint32_t> lookup;
+    bool loaded = false;
+};
+
+CommitGraph graph;
+// Lookups may load, refresh or import into the graph, so every public DAG
+// function holds this while it works (the daemon serves reads concurrently).
+std::mutex graphMutex;
+
+const GraphRecord& record(std::uint32_t index) {
+    if (index < graph.mappedCount) {
+        return reinterpret_cast<const GraphRecord*>(graph.map.data() + sizeof(GraphHeader))[index];
+    }
+    return graph.appended[index - graph.mappedCount];
 }
 
-void addCommit(const std::string& commitHash, const std::vector<std::string>& parentHashes) {
-    commitGraph[commitHash] = parentHashes;
+std::string recordHash(const GraphRecord& rec) {
+    std::size_t len = 0;
+    while (len < GRAPH_HASH_WIDTH && rec.hash[len] != '\0') ++len;
+    return std::string(rec.hash, len);
 }
 
-std::vector<std::string> getParents(const std::string& commitHash) {
-    auto it = commitGraph.find(commitHash);
-    return (it != commitGraph.end()) ? it->second : std::vector<std::string>{};
+std::uint32_t nodeCount() {
+    return graph.mappedCount + static_cast<std::uint32_t>(graph.appended.size());
 }
 
-std::string findLCA(const std::string& commitA, const std::string& commitB) {
-    std::unordered_set<std::string> visitedA, visitedB;
-    std::queue<std::string> queueA, queueB;
+void loadGraph() {
+    TRACE_SCOPE("dsa::loadGraph");
+    graph = CommitGraph{};
+    graph.loaded = true;
+    graph.map = MappedFile(IOManager::COMMIT_GRAPH_FILE);
+    if (graph.map.size() < sizeof(GraphHeader)) return;
 
-    if (commitA.empty() || commitB.empty()) return "";
+    GraphHeader header;
+    std::memcpy(&header, graph.map.data(), sizeof(header));
+    if (std::memcmp(header.magic, GRAPH_MAGIC, 4) != 0 || header.version != GRAPH_VERSION) {
+        utils::displayError("Ignoring unrecognised commit-graph file.");
+        graph.map = MappedFile();
+        return;
+    }
+
+    // A torn append leaves the count lagging the data; trust the smaller of the two.
+    std::size_t stored = (graph.map.size() - sizeof(GraphHeader)) / sizeof(GraphRecord);
+    graph.mappedCount = static_cast<std::uint32_t>(std::min<std::size_t>(header.count, stored));
+    graph.lookup.reserve(graph.mappedCount);
+    for (std::uint32_t i = 0; i < graph.mappedCount; ++i) {
+        graph.lookup.emplace(recordHash(record(i)), i);
+    }
+}
+
+// Picks up records appended by another process since the graph was mapped.
+void refreshGraph() {
+    std::error_code ec;
+    auto size = fs::file_size(IOManager::COMMIT_GRAPH_FILE, ec);
+    std::size_t known = sizeof(GraphHeader) + std::size_t(nodeCount()) * sizeof(GraphRecord);
+    if (!ec && size > known) loadGraph();
+}
+
+void persistRecord(const GraphRecord& rec, std::uint32_t newCount) {
+    if (!IOManager::fileExists(IOManager::MINIGIT_DIR)) return;
+
+    std::fstream file(IOManager::COMMIT_GRAPH_FILE, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file) {
+        file.open(IOManager::COMMIT_GRAPH_FILE, std::ios::out | std::ios::binary);
+        if (!file) {
+            utils::displayError("Error writing to: " + IOManager::COMMIT_GRAPH_FILE);
+            return;
+        }
+    }
+
+    GraphHeader header{};
+    std::memcpy(header.magic, GRAPH_MAGIC, 4);
+    header.version = GRAPH_VERSION;
+    header.count = newCount;
+
+    // Record first, then the count, so a crash never exposes a partial record.
+    file.seekp(sizeof(GraphHeader) + std::streamoff(newCount - 1) * sizeof(GraphRecord));
+    file.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+std::uint32_t appendNode(const std::string& hash, const std::vector<std::uint32_t>& parents, std::int64_t timestamp) {
+    GraphRecord rec{};
+    std::memcpy(rec.hash, hash.data(), std::min(hash.size(), GRAPH_HASH_WIDTH));
+    rec.parents[0] = parents.size() > 0 ? parents[0] : NO_PARENT;
+    rec.parents[1] = parents.size() > 1 ? parents[1] : NO_PARENT;
+    rec.generation = 1;
+    for (std::uint32_t p : parents) {
+        rec.generation = std::max(rec.generation, record(p).generation + 1);
+    }
+    rec.timestamp = timestamp;
+
+    std::uint32_t index = nodeCount();
+    graph.appended.push_back(rec);
+    graph.lookup.emplace(hash, index);
+    persistRecord(rec, index + 1);
+    return index;
+}
+
+// Commits made before the graph existed are imported from their commit files
+// the first time they are looked up, and then persisted like any other node.
+std::uint32_t importFromCommits(const std::string& hash) {
+    std::vector<std::string> stack{hash};
+    while (!stack.empty()) {
+        const std::string current = stack.back();
+        if (graph.lookup.count(current)) { stack.pop_back(); continue; }
+
+        if (!IOManager::hasCommit(current)) return NO_PARENT;
+        auto commit = Commit::load(current);
+        if (!commit) return NO_PARENT;
+
+        std::vector<std::uint32_t> parents;
+        bool pending = false;
+        for (auto p : commit->parents) {
+            std::string parent = utils::trim(std::string(p));
+            auto it = graph.lookup.find(parent);
+            if (it != graph.lookup.end()) parents.push_back(it->second);
+            else { stack.push_back(parent); pending = true; }
+        }
+        if (pending) continue; // resolve parents first so generations are known
+
+        appendNode(current, parents, commit->time());
+        stack.pop_back();
+    }
+    return graph.lookup.at(hash);
+}
+
+std::uint32_t findNode(const std::string& hash, bool import = true) {
+    if (hash.empty()) return NO_PARENT;
+    if (!graph.loaded) loadGraph();
 
-    queueA.push(commitA);
-    queueB.push(commitB);
+    auto it = graph.lookup.find(hash);
+    if (it != graph.lookup.end()) return it->second;
 
-    while (!queueA.empty() || !queueB.empty()) {
-        if (!queueA.empty()) {
-            std::string current = queueA.front(); queueA.pop();
-            if (visitedB.count(current)) return current;
-            visitedA.insert(current);
-            for (const auto& parent : getParents(current)) {
-                if (!visitedA.count(parent)) queueA.push(parent);
+    refreshGraph();
+    it = graph.lookup.find(hash);
+    if (it != graph.lookup.end()) return it->second;
+
+    return import ? importFromCommits(hash) : NO_PARENT;
+}
+
+}
+
+static std::atomic<bool> algorithmLoaded{false};
+static std::mutex algorithmMutex;
+static hashing::Algorithm activeAlgorithm = hashing::Algorithm::Legacy;
+
+hashing::Algorithm hashAlgorithm() {
+    if (!algorithmLoaded.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(algorithmMutex);
+        if (!algorithmLoaded.load(std::memory_order_relaxed)) {
+            std::string name = IOManager::readConfig("hash");
+            if (!name.empty() && !hashing::parseAlgorithm(name, activeAlgorithm)) {
+                utils::displayError("Unknown hash algorithm '" + name + "' in config, using legacy.");
+                activeAlgorithm = hashing::Algorithm::Legacy;
             }
+            algorithmLoaded.store(true, std::memory_order_release);
         }
+    }
+    return activeAlgorithm;
+}
+
+void setHashAlgorithm(hashing::Algorithm algorithm) {
+    std::lock_guard<std::mutex> lock(algorithmMutex);
+    activeAlgorithm = algorithm;
+    algorithmLoaded.store(true, std::memory_order_release);
+}
+
+std::string computeSHA1(const std::string& content) {
+    TRACE_SCOPE("dsa::computeSHA1");
+    trace::count(trace::Counter::ObjectsHashed);
+    trace::count(trace::Counter::BytesHashed, content.size());
+    return hashing::digest(hashAlgorithm(), content.data(), content.size());
+}
+
+void addCommit(const std::string& commitHash, const std::vector<std::string>& parentHashes, std::int64_t timestamp) {
+    std::lock_guard<std::mutex> lock(graphMutex);
+    if (findNode(commitHash, false) != NO_PARENT) return;
 
-        if (!queueB.empty()) {
-            std::string current = queueB.front(); queueB.pop();
-            if (visitedA.count(current)) return current;
-            visitedB.insert(current);
-            for (const auto& parent : getParents(current)) {
-                if (!visitedB.count(parent)) queueB.push(parent);
+    std::vector<std::uint32_t> parents;
+    for (const auto& p : parentHashes) {
+        std::uint32_t index = findNode(p);
+        if (index != NO_PARENT) parents.push_back(index);
+    }
+    appendNode(commitHash, parents, timestamp);
+}
+
+std::vector<std::string> getParents(const std::string& commitHash) {
+    std::lock_guard<std::mutex> lock(graphMutex);
+    std::vector<std::string> parents;
+    std::uint32_t index = findNode(commitHash);
+    if (index == NO_PARENT) return parents;
+
+    const GraphRecord& rec = record(index);
+    for (std::uint32_t p : rec.parents) {
+        if (p != NO_PARENT) parents.push_back(recordHash(record(p)));
+    }
+    return parents;
+}
+
+bool isAncestor(const std::string& ancestor, const std::string& descendant) {
+    TRACE_SCOPE("dsa::isAncestor");
+    std::lock_guard<std::mutex> lock(graphMutex);
+    std::uint32_t target = findNode(ancestor);
+    std::uint32_t start = findNode(descendant);
+    if (target == NO_PARENT || start == NO_PARENT) return false;
+
+    // Nothing below the ancestor's generation can lead back up to it.
+    const std::uint32_t floor = record(target).generation;
+    std::unordered_set<std::uint32_t> visited{start};
+    std::vector<std::uint32_t> stack{start};
+    while (!stack.empty()) {
+        std::uint32_t current = stack.back(); stack.pop_back();
+        if (current == target) return true;
+        for (std::uint32_t p : record(current).parents) {
+            if (p != NO_PARENT && record(p).generation >= floor && visited.insert(p).second) {
+                stack.push_back(p);
+            }
+        }
+    }
+    return false;
+}
+
+std::string findLCA(const std::string& commitA, const std::string& commitB) {
+    TRACE_SCOPE("dsa::findLCA");
+    std::lock_guard<std::mutex> lock(graphMutex);
+    if (commitA.empty() || commitB.empty()) return "";
+
+    std::uint32_t a = findNode(commitA);
+    std::uint32_t b = findNode(commitB);
+    if (a == NO_PARENT || b == NO_PARENT) return "";
+    if (a == b) return commitA;
+
+    // Paint ancestors of each side, visiting highest generation first. A node is
+    // only popped once all of its descendants have been, so the first node
+    // reached from both sides is a best common ancestor.
+    constexpr std::uint8_t FROM_A = 1, FROM_B = 2;
+    std::unordered_map<std::uint32_t, std::uint8_t> flags{{a, FROM_A}, {b, FROM_B}};
+    std::unordered_map<std::uint32_t, std::uint8_t> expanded;
+    std::priority_queue<std::pair<std::uint32_t, std::uint32_t>> queue;
+    queue.emplace(record(a).generation, a);
+    queue.emplace(record(b).generation, b);
+
+    while (!queue.empty()) {
+        std::uint32_t current = queue.top().second; queue.pop();
+        std::uint8_t f = flags[current];
+        if (f == (FROM_A | FROM_B)) return recordHash(record(current));
+        if (expanded[current] == f) continue;
+        expanded[current] = f;
+
+        for (std::uint32_t p : record(current).parents) {
+            if (p == NO_PARENT) continue;
+            std::uint8_t& pf = flags[p];
+            if ((pf | f) != pf) {
+                pf |= f;
+                queue.emplace(record(p).generation, p);
             }
         }
     }
@@ -62,10 +321,15 @@ std::string findLCA(const std::string& commitA, const std::string& commitB) {
 
 //For debugging 
 void printCommitGraph() {
+    std::lock_guard<std::mutex> lock(graphMutex);
     std::cout << "\nCommit DAG:\n";
-    for (const auto& [child, parents] : commitGraph) {
-        std::cout<< child << " : ";
-        for (const auto& p : parents) std::cout << p << " ";
+    if (!graph.loaded) loadGraph();
+    for (std::uint32_t i = 0; i < nodeCount(); ++i) {
+        const GraphRecord& rec = record(i);
+        std::cout << recordHash(rec) << " (gen " << rec.generation << ") : ";
+        for (std::uint32_t p : rec.parents) {
+            if (p != NO_PARENT) std::cout << recordHash(record(p)) << " ";
+        }
         std::cout << "\n";
     }
     std::cout << std::endl;
@@ -5,16 +5,26 @@
 #include <unordered_map>
 #include <vector>
 #include <set>
+#include <cstdint>
+#include "hash.hpp"
 
 namespace dsa {
 
-// SHA-1 Hashing
+// Content Hashing
+// Hashes with the repository's configured algorithm (see hash.hpp)
 std::string computeSHA1(const std::string& content);
+// Algorithm from .minigit/config; repositories without one use Legacy
+hashing::Algorithm hashAlgorithm();
+void setHashAlgorithm(hashing::Algorithm algorithm);
 
-// DAG Management
-void addCommit(const std::string& commitHash, const std::vector<std::string>& parentHashes);
+// DAG Management (backed by .minigit/commit-graph)
+void addCommit(const std::string& commitHash, const std::vector<std::string>& parentHashes,
+               std::int64_t timestamp = 0);
 std::vector<std::string> getParents(const std::string& commitHash);
 
+// True if `ancestor` is reachable from `descendant` (a commit is its own ancestor)
+bool isAncestor(const std::string& ancestor, const std::string& descendant);
+
 // Longest Common Ancestor(LCA) Detection
 std::string findLCA(const std::string& commitA, const std::string& commitB);
 
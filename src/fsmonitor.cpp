@@ -0,0 +1,490 @@
+#include "fsmonitor.hpp"
+#include "io.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#define MINIGIT_HAVE_INOTIFY 1
+#endif
+
+namespace fsmonitor {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+const std::string JOURNAL_FILE = IOManager::MINIGIT_DIR + "/fsmonitor";
+const std::string LOCK_FILE = IOManager::MINIGIT_DIR + "/fsmonitor.lock";
+const std::string STATE_FILE = IOManager::MINIGIT_DIR + "/fsmonitor-state";
+const std::string STOP_FILE = IOManager::MINIGIT_DIR + "/fsmonitor-stop";
+const std::string COOKIE_PREFIX = "fsmonitor-cookie-";
+const std::string JOURNAL_MAGIC = "minigit-fsmonitor ";
+
+// Past this size the watcher starts a new instance: readers then rescan once
+constexpr std::size_t MAX_JOURNAL_BYTES = 4u << 20;
+// How long a query waits for the watcher to report its cookie
+constexpr auto SYNC_TIMEOUT = std::chrono::seconds(2);
+
+struct Line {
+    std::uint64_t seq;
+    char kind; // 'P', 'O' or 'C'
+    std::string arg;
+};
+
+struct Journal {
+    std::string instance;
+    std::vector<Line> lines;
+};
+
+// Parses the complete lines of a journal (the watcher may be mid-append)
+bool parseJournal(const std::string& content, Journal& journal) {
+    std::size_t end = content.find('\n');
+    if (end == std::string::npos || content.compare(0, JOURNAL_MAGIC.size(), JOURNAL_MAGIC) != 0) return false;
+    journal.instance = content.substr(JOURNAL_MAGIC.size(), end - JOURNAL_MAGIC.size());
+    for (std::size_t start = end + 1; (end = content.find('\n', start)) != std::string::npos; start = end + 1) {
+        std::size_t space = content.find(' ', start);
+        if (space == std::string::npos || space + 1 >= end) continue;
+        Line line;
+        line.seq = std::strtoull(content.c_str() + start, nullptr, 10);
+        line.kind = content[space + 1];
+        if (space + 3 < end) line.arg = content.substr(space + 3, end - space - 3);
+        journal.lines.push_back(std::move(line));
+    }
+    return true;
+}
+
+std::string makeToken(const std::string& instance, std::uint64_t seq) {
+    return instance + ":" + std::to_string(seq);
+}
+
+bool splitToken(const std::string& token, std::string& instance, std::uint64_t& seq) {
+    std::size_t colon = token.rfind(':');
+    if (colon == std::string::npos) return false;
+    instance = token.substr(0, colon);
+    seq = std::strtoull(token.c_str() + colon + 1, nullptr, 10);
+    return true;
+}
+
+#ifdef MINIGIT_HAVE_INOTIFY
+
+constexpr std::uint32_t TREE_EVENTS = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                                      IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                                      IN_ONLYDIR | IN_EXCL_UNLINK;
+
+std::int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// True if a watcher holds the lock (in this process or another)
+bool watcherAlive() {
+    int fd = ::open(LOCK_FILE.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    const bool free = ::flock(fd, LOCK_SH | LOCK_NB) == 0;
+    ::close(fd);
+    return !free;
+}
+
+#endif
+
+}
+
+bool enabled() {
+    static const bool on = utils::trim(IOManager::readConfig("fsmonitor")) == "true";
+    return on;
+}
+
+#ifdef MINIGIT_HAVE_INOTIFY
+
+struct Watcher::State {
+    int lockFd = -1;
+    int inotifyFd = -1;
+    int journalFd = -1;
+    int controlWd = -1;   // .minigit itself, for cookies and the stop file
+    bool obeyStopFile = false;
+    std::string instance;
+    std::uint64_t seq = 0;
+    std::size_t journalBytes = 0;
+    std::unordered_map<int, std::string> dirs; // watch -> directory ("" for the root)
+
+    ~State() {
+        for (int fd : {journalFd, inotifyFd, lockFd}) {
+            if (fd >= 0) ::close(fd);
+        }
+    }
+
+    // Watches dir and every directory below it; false if the kernel refused
+    // a watch (usually fs.inotify.max_user_watches)
+    bool addWatches(const std::string& dir) {
+        int wd = ::inotify_add_watch(inotifyFd, dir.empty() ? "." : dir.c_str(), TREE_EVENTS);
+        if (wd < 0) return errno == ENOENT || errno == ENOTDIR; // gone again: its events say so
+        dirs[wd] = dir;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(dir.empty() ? "." : dir, ec)) {
+            const std::string path = IOManager::normalizePath(entry.path().string());
+            if (path == IOManager::MINIGIT_DIR) continue;
+            if (entry.is_directory(ec) && !entry.is_symlink(ec) && !addWatches(path)) return false;
+        }
+        return true;
+    }
+
+    void removeWatchesUnder(const std::string& dir) {
+        const std::string prefix = dir + "/";
+        for (auto it = dirs.begin(); it != dirs.end();) {
+            if (it->second == dir || it->second.compare(0, prefix.size(), prefix) == 0) {
+                ::inotify_rm_watch(inotifyFd, it->first);
+                it = dirs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Starts a journal for a new instance
+    bool openJournal() {
+        if (journalFd >= 0) ::close(journalFd);
+        instance = std::to_string(::getpid()) + "-" + std::to_string(nowNs());
+        seq = 0;
+        const std::string header = JOURNAL_MAGIC + instance + "\n";
+        journalFd = -1;
+        if (!IOManager::writeFileAtomic(JOURNAL_FILE, header)) return false;
+        journalFd = ::open(JOURNAL_FILE.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        journalBytes = header.size();
+        return journalFd >= 0;
+    }
+
+    void addLine(std::string& out, char kind, const std::string& arg) {
+        out += std::to_string(++seq);
+        out += ' ';
+        out += kind;
+        if (!arg.empty()) out += " " + arg;
+        out += '\n';
+    }
+
+    // Turns a batch of events into journal lines. Returns false if the
+    // watcher cannot go on (its view of the tree is incomplete).
+    bool handle(const char* buffer, std::size_t length, std::string& out, bool& stopRequested) {
+        std::set<std::string> seen; // one line per path and batch
+        bool ok = true;
+        for (std::size_t offset = 0; offset < length;) {
+            const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+            const std::string name = event->len > 0 ? std::string(event->name) : "";
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                addLine(out, 'O', "");
+                continue;
+            }
+            if (event->wd == controlWd) {
+                if (name.compare(0, COOKIE_PREFIX.size(), COOKIE_PREFIX) == 0) addLine(out, 'C', name);
+                else if (obeyStopFile && IOManager::MINIGIT_DIR + "/" + name == STOP_FILE) stopRequested = true;
+                continue;
+            }
+            auto dir = dirs.find(event->wd);
+            if (dir == dirs.end()) continue;
+            if (event->mask & IN_IGNORED) {
+                dirs.erase(dir);
+                continue;
+            }
+            if (name.empty()) {
+                // The root itself was moved or deleted: nothing below can be trusted.
+                if (dir->second.empty() && (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))) {
+                    addLine(out, 'O', "");
+                    ok = false;
+                }
+                continue;
+            }
+            const std::string path = dir->second.empty() ? name : dir->second + "/" + name;
+            if (path == IOManager::MINIGIT_DIR) continue;
+            if (path.find('\n') != std::string::npos) {
+                addLine(out, 'O', ""); // cannot be journaled as a line
+                continue;
+            }
+
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & IN_MOVED_FROM) removeWatchesUnder(path);
+                // Files created in a new directory before its watch existed
+                // raised no events; the directory's line covers them.
+                if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && !addWatches(path)) {
+                    addLine(out, 'O', "");
+                    ok = false;
+                }
+            }
+            if (seen.insert(path).second) addLine(out, 'P', path);
+        }
+        return ok;
+    }
+
+    bool write(const std::string& out) {
+        if (out.empty()) return true;
+        const char* p = out.data();
+        std::size_t left = out.size();
+        while (left > 0) {
+            const ssize_t n = ::write(journalFd, p, left);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            left -= static_cast<std::size_t>(n);
+        }
+        journalBytes += out.size();
+        return journalBytes < MAX_JOURNAL_BYTES || openJournal();
+    }
+};
+
+Watcher::Watcher() = default;
+
+Watcher::~Watcher() {
+    stop();
+}
+
+bool Watcher::start(bool obeyStopFile) {
+    if (running()) return true;
+    auto state = std::make_unique<State>();
+    state->obeyStopFile = obeyStopFile;
+    state->lockFd = ::open(LOCK_FILE.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (state->lockFd < 0 || ::flock(state->lockFd, LOCK_EX | LOCK_NB) != 0) return false;
+
+    state->inotifyFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (state->inotifyFd < 0) {
+        utils::displayError(std::string("Cannot start the filesystem monitor: ") + std::strerror(errno));
+        return false;
+    }
+    state->controlWd = ::inotify_add_watch(state->inotifyFd, IOManager::MINIGIT_DIR.c_str(), IN_CREATE | IN_ONLYDIR);
+    if (state->controlWd < 0 || !state->addWatches("")) {
+        utils::displayError("Cannot watch the working tree (fs.inotify.max_user_watches may be too low).");
+        return false;
+    }
+    if (!state->openJournal()) return false;
+
+    state_ = std::move(state);
+    stop_ = false;
+    failed_ = false;
+    thread_ = std::thread([this] {
+        State& state = *state_;
+        std::vector<char> buffer(64 * 1024);
+        while (!stop_) {
+            pollfd pending{state.inotifyFd, POLLIN, 0};
+            if (::poll(&pending, 1, 200) <= 0) continue; // timeout or signal: recheck the flag
+            const ssize_t n = ::read(state.inotifyFd, buffer.data(), buffer.size());
+            if (n <= 0) continue;
+            std::string out;
+            bool stopRequested = false;
+            const bool ok = state.handle(buffer.data(), static_cast<std::size_t>(n), out, stopRequested);
+            if (!state.write(out) || !ok) {
+                failed_ = true;
+                break;
+            }
+            if (stopRequested) break;
+        }
+        // Releasing the lock tells readers that nobody is journaling any more.
+        ::close(state.lockFd);
+        state.lockFd = -1;
+        stop_ = true;
+    });
+    return true;
+}
+
+void Watcher::stop() {
+    stop_ = true;
+    if (thread_.joinable()) thread_.join();
+    state_.reset();
+}
+
+namespace {
+std::atomic<bool> helperSignalled{false};
+
+void onSignal(int) {
+    helperSignalled = true;
+}
+}
+
+int runHelper() {
+    if (!IOManager::fileExists(IOManager::MINIGIT_DIR)) {
+        utils::displayError("Not a MiniGit repository (run init first).");
+        return 1;
+    }
+    std::error_code ec;
+    fs::remove(STOP_FILE, ec);
+    Watcher watcher;
+    if (!watcher.start(true)) {
+        if (watcherAlive()) utils::displayError("A filesystem monitor is already running for this repository.");
+        return 1;
+    }
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+    std::cout << "Watching the working tree (stop with 'minigit fsmonitor --stop')" << std::endl;
+
+    while (!helperSignalled && !watcher.stopping()) {
+        ::usleep(100 * 1000);
+    }
+    const bool failed = watcher.failed();
+    watcher.stop();
+    fs::remove(STOP_FILE, ec);
+    std::cout << "Filesystem monitor stopped." << std::endl;
+    return failed ? 1 : 0;
+}
+
+bool stopHelper() {
+    if (!watcherAlive()) return false;
+    IOManager::writeFile(STOP_FILE, "");
+    const auto deadline = std::chrono::steady_clock::now() + SYNC_TIMEOUT;
+    while (watcherAlive() && std::chrono::steady_clock::now() < deadline) ::usleep(10 * 1000);
+    std::error_code ec;
+    fs::remove(STOP_FILE, ec);
+    if (watcherAlive()) {
+        utils::displayError("The filesystem monitor belongs to the daemon; stop the daemon instead.");
+    }
+    return true;
+}
+
+#else
+
+struct Watcher::State {};
+
+Watcher::Watcher() = default;
+
+Watcher::~Watcher() = default;
+
+bool Watcher::start(bool) {
+    return false;
+}
+
+void Watcher::stop() {}
+
+int runHelper() {
+    utils::displayError("The filesystem monitor needs inotify, which this platform does not have.");
+    return 1;
+}
+
+bool stopHelper() {
+    return false;
+}
+
+#endif
+
+bool Changes::touches(const std::string& path) const {
+    if (std::binary_search(paths.begin(), paths.end(), path)) return true;
+    for (std::size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        if (std::binary_search(paths.begin(), paths.end(), path.substr(0, slash))) return true;
+    }
+    return false;
+}
+
+std::vector<std::string> Changes::existingFiles() const {
+    std::vector<std::string> files;
+    for (const auto& path : paths) {
+        // listFiles returns a file itself, everything under a directory, and
+        // nothing for a path that is gone.
+        auto found = IOManager::listFiles(path);
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    return files;
+}
+
+Changes query() {
+    TRACE_SCOPE("fsmonitor::query");
+    Changes changes;
+#ifdef MINIGIT_HAVE_INOTIFY
+    if (!watcherAlive()) return changes;
+
+    // Once the watcher reports the cookie, every event before it is in the
+    // journal too: inotify delivers events in order.
+    static std::atomic<unsigned> counter{0};
+    const std::string cookie = COOKIE_PREFIX + std::to_string(::getpid()) + "-" + std::to_string(counter++);
+    const std::string cookiePath = IOManager::MINIGIT_DIR + "/" + cookie;
+    if (!IOManager::writeFile(cookiePath, "")) return changes;
+
+    Journal journal;
+    std::size_t cookieLine = 0;
+    bool synced = false;
+    const auto deadline = std::chrono::steady_clock::now() + SYNC_TIMEOUT;
+    while (!synced && std::chrono::steady_clock::now() < deadline) {
+        journal = Journal();
+        if (IOManager::fileExists(JOURNAL_FILE) && parseJournal(IOManager::readFile(JOURNAL_FILE), journal)) {
+            for (cookieLine = journal.lines.size(); cookieLine-- > 0;) {
+                if (journal.lines[cookieLine].kind == 'C' && journal.lines[cookieLine].arg == cookie) {
+                    synced = true;
+                    break;
+                }
+            }
+        }
+        if (!synced) ::usleep(1000);
+    }
+    std::error_code ec;
+    fs::remove(cookiePath, ec);
+    if (!synced) return changes;
+    changes.token = makeToken(journal.instance, journal.lines[cookieLine].seq);
+
+    // The saved state: its token, then the paths it left pending
+    std::string saved = IOManager::fileExists(STATE_FILE) ? IOManager::readFile(STATE_FILE) : "";
+    std::size_t end = saved.find('\n');
+    std::string instance;
+    std::uint64_t since = 0;
+    if (end == std::string::npos || !splitToken(saved.substr(0, end), instance, since) ||
+        instance != journal.instance) {
+        return changes; // saved under another watcher, which may have missed changes
+    }
+    for (std::size_t start = end + 1; (end = saved.find('\n', start)) != std::string::npos; start = end + 1) {
+        if (end > start) changes.paths.push_back(saved.substr(start, end - start));
+    }
+    for (std::size_t i = 0; i < cookieLine; ++i) {
+        const Line& line = journal.lines[i];
+        if (line.seq <= since) continue;
+        if (line.kind == 'O') {
+            changes.paths.clear();
+            return changes;
+        }
+        if (line.kind == 'P') changes.paths.push_back(line.arg);
+    }
+    std::sort(changes.paths.begin(), changes.paths.end());
+    changes.paths.erase(std::unique(changes.paths.begin(), changes.paths.end()), changes.paths.end());
+    changes.complete = true;
+#endif
+    return changes;
+}
+
+bool saveState(const std::string& token, const std::vector<std::string>& pending) {
+    if (token.empty()) return true;
+    std::string content = token + "\n";
+    for (const auto& path : pending) content += path + "\n";
+    return IOManager::writeFileAtomic(STATE_FILE, content);
+}
+
+bool markPending(const std::vector<std::string>& paths) {
+    if (paths.empty() || !IOManager::fileExists(STATE_FILE)) return true;
+    std::string content = IOManager::readFile(STATE_FILE);
+    for (const auto& path : paths) {
+        if (path.find('\n') != std::string::npos) {
+            // Not recordable: drop the state, so the next status scans everything.
+            std::error_code ec;
+            fs::remove(STATE_FILE, ec);
+            return !ec;
+        }
+        content += path + "\n";
+    }
+    return IOManager::writeFileAtomic(STATE_FILE, content);
+}
+
+}
@@ -0,0 +1,99 @@
+#ifndef FSMONITOR_HPP
+#define FSMONITOR_HPP
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Filesystem monitor: a watcher (a thread of the daemon or of a batch run, or
+// the "minigit fsmonitor" helper process) follows the working tree with
+// inotify and appends every path that changes to a journal in .minigit.
+// Commands that need the state of the working tree then only look at the
+// paths journaled since the state they last saw, instead of walking and
+// stat-ing everything.
+//
+// Journal (.minigit/fsmonitor): a "minigit-fsmonitor <instance>" header line,
+// then one line per event, numbered in the order the kernel reported them:
+//   <seq> P <path>    path changed (a directory stands for everything in it)
+//   <seq> O           events were lost (queue overflow): anything may have changed
+//   <seq> C <name>    the watcher saw cookie file <name> being created
+// A token "<instance>:<seq>" names a point in it. Only one watcher runs per
+// repository, holding a lock on .minigit/fsmonitor.lock; a new watcher (or a
+// journal that grew too large) starts a new instance, which makes every
+// earlier token stale.
+namespace fsmonitor {
+
+// True if "fsmonitor = true" is set in config: the daemon and batch mode
+// then run a watcher of their own unless one is already running
+bool enabled();
+
+// A watcher running on a background thread of this process
+class Watcher {
+public:
+    Watcher();
+    ~Watcher();
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+
+    // Starts watching the working tree; false if another watcher already
+    // runs for the repository or inotify is unavailable. A watcher that obeys
+    // the stop file ends when "minigit fsmonitor --stop" creates it.
+    bool start(bool obeyStopFile = false);
+    void stop();
+    bool running() const { return thread_.joinable(); }
+    // True once the watcher ended by itself: asked to, or failed
+    bool stopping() const { return stop_; }
+    // True if it ended because it could no longer follow the tree
+    bool failed() const { return failed_; }
+
+private:
+    struct State;
+    std::unique_ptr<State> state_;
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> failed_{false};
+    std::thread thread_;
+};
+
+// Runs a watcher in the foreground until SIGINT or SIGTERM (the helper
+// process); returns the process exit status
+int runHelper();
+// Asks the helper process of this repository to stop; false if none runs
+bool stopHelper();
+
+// What changed in the working tree since the last saved state
+struct Changes {
+    // When set, only paths (sorted) can differ from what the state recorded;
+    // a directory stands for everything under it. Otherwise nothing is known
+    // and callers must scan the whole tree.
+    bool complete = false;
+    std::vector<std::string> paths;
+    // Where the journal stood when the query synced with the watcher ("" if
+    // no watcher runs): the token of a state saved after this query's scan
+    std::string token;
+
+    // True if path, or a directory containing it, is among paths
+    bool touches(const std::string& path) const;
+    // The files that exist under the changed paths, sorted
+    std::vector<std::string> existingFiles() const;
+};
+
+// Syncs with the watcher (so every change made before the call is in the
+// journal) and reports the changes since the saved state, including the paths
+// it left pending. Without a live watcher, complete is false.
+Changes query();
+
+// Saves the state of a full reconciliation done after query returned token:
+// pending lists every path that still differed from the index then (modified,
+// deleted or untracked), so it is looked at again next time.
+bool saveState(const std::string& token, const std::vector<std::string>& pending);
+
+// Adds paths to the pending set of the saved state. Commands that change the
+// index without touching the working tree (rm --cached) call it, since the
+// watcher never sees those changes.
+bool markPending(const std::vector<std::string>& paths);
+
+}
+
+#endif
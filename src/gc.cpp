@@ -0,0 +1,265 @@
+#include "gc.hpp"
+#include "commit.hpp"
+#include "io.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
+#include "tree.hpp"
+#include "utils.hpp"
+
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace gc {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+enum class Kind { Commit, Tree, Blob };
+
+struct Node {
+    std::string hash;
+    Kind kind;
+};
+
+// The set of marked hashes, sharded so workers marking different objects
+// rarely wait on one another
+class MarkSet {
+public:
+    bool insert(const std::string& hash) {
+        Shard& shard = shards_[std::hash<std::string>{}(hash) % SHARDS];
+        std::lock_guard<std::mutex> lock(shard.guard);
+        return shard.hashes.insert(hash).second;
+    }
+
+    void moveInto(std::unordered_set<std::string>& out) {
+        for (Shard& shard : shards_) {
+            out.merge(shard.hashes);
+        }
+    }
+
+private:
+    static constexpr std::size_t SHARDS = 64;
+    struct Shard {
+        std::mutex guard;
+        std::unordered_set<std::string> hashes;
+    };
+    std::array<Shard, SHARDS> shards_;
+};
+
+bool isTempName(const std::string& name) {
+    return name.find(".tmp-") != std::string::npos;
+}
+
+bool objectExists(const std::string& hash) {
+    return IOManager::fileExists(IOManager::OBJECTS_DIR + "/" + hash.substr(0, 2) + "/" + hash.substr(2)) ||
+           packfile::contains(hash);
+}
+
+// Reads one marked object and queues the objects it points to that nobody
+// has marked yet
+void expand(const Node& node, MarkSet& marked, std::vector<Node>& next, std::atomic<bool>& failed) {
+    auto visit = [&](std::string hash, Kind kind) {
+        if (!hash.empty() && marked.insert(hash)) next.push_back({std::move(hash), kind});
+    };
+
+    switch (node.kind) {
+    case Kind::Commit: {
+        std::optional<Commit> commit = Commit::load(node.hash);
+        if (!commit) {
+            failed = true;
+            return;
+        }
+        for (std::string_view parent : commit->parents) visit(std::string(parent), Kind::Commit);
+        visit(std::string(commit->tree), Kind::Tree);
+        for (const auto& [path, hash] : commit->files) visit(std::string(hash), Kind::Blob);
+        break;
+    }
+    case Kind::Tree: {
+        std::string content = IOManager::readBlob(node.hash);
+        if (content.empty() && !objectExists(node.hash)) {
+            failed = true;
+            return;
+        }
+        for (auto& entry : tree::parse(content)) {
+            visit(std::move(entry.hash), entry.isTree ? Kind::Tree : Kind::Blob);
+        }
+        break;
+    }
+    case Kind::Blob: {
+        std::vector<std::string> chunks;
+        if (!IOManager::readChunkList(node.hash, chunks)) {
+            utils::displayError("Missing object " + node.hash);
+            failed = true;
+            return;
+        }
+        for (auto& chunk : chunks) visit(std::move(chunk), Kind::Blob);
+        break;
+    }
+    }
+}
+
+// A commit hash stored in a ref-like file, or "" if it is absent or symbolic
+std::string readCommitRef(const std::string& path) {
+    if (!IOManager::fileExists(path)) return "";
+    std::string content = utils::trim(IOManager::readFile(path));
+    return content.rfind("ref:", 0) == 0 ? "" : content;
+}
+
+std::vector<Node> findRoots() {
+    std::vector<Node> roots;
+    for (auto& [name, hash] : IOManager::listReferences()) {
+        roots.push_back({std::move(hash), Kind::Commit});
+    }
+    // A symbolic HEAD is covered by its branch; a detached one is a root of its own.
+    for (const std::string& file : {IOManager::HEAD_FILE, IOManager::MERGE_HEAD_FILE,
+                                    IOManager::CHERRY_PICK_HEAD_FILE}) {
+        std::string hash = readCommitRef(file);
+        if (!hash.empty()) roots.push_back({std::move(hash), Kind::Commit});
+    }
+    for (auto& entry : IOManager::readIndexEntries()) {
+        roots.push_back({std::move(entry.hash), Kind::Blob});
+    }
+    return roots;
+}
+
+std::int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::int64_t mtimeOf(const fs::path& path) {
+    IndexEntry stat;
+    return IOManager::statFile(path.string(), stat) ? stat.mtimeNs : 0;
+}
+
+// Deletes the temporary files in dir written before cutoff and, if objects is
+// set, the unmarked loose objects as well (file names are hashes minus
+// prefix). Returns the number of files left.
+std::size_t sweepDir(const fs::path& dir, const std::string& prefix, bool objects,
+                     const std::unordered_set<std::string>& reachable, std::int64_t cutoff, Stats& stats) {
+    std::size_t left = 0;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        if (!entry.is_regular_file()) continue;
+        const std::string name = entry.path().filename().string();
+        const bool temp = isTempName(name);
+        if ((!temp && !objects) || (!temp && reachable.count(prefix + name))) {
+            ++left;
+            continue;
+        }
+        if (mtimeOf(entry.path()) >= cutoff) {
+            if (!temp) ++stats.recent;
+            ++left;
+            continue;
+        }
+        std::uint64_t size = entry.file_size(ec);
+        if (!fs::remove(entry.path(), ec)) {
+            ++left;
+            continue;
+        }
+        if (temp) {
+            ++stats.tempRemoved;
+            stats.tempBytes += size;
+        } else {
+            ++stats.pruned;
+            stats.prunedBytes += size;
+        }
+    }
+    return left;
+}
+
+}
+
+bool parseGrace(const std::string& text, std::int64_t& seconds) {
+    if (text == "now") {
+        seconds = 0;
+        return true;
+    }
+    std::size_t digits = 0;
+    while (digits < text.size() && std::isdigit(static_cast<unsigned char>(text[digits]))) ++digits;
+    if (digits == 0 || digits > 12 || text.size() - digits > 1) return false;
+
+    std::int64_t unit = 1;
+    switch (digits < text.size() ? text[digits] : 's') {
+    case 's': unit = 1; break;
+    case 'm': unit = 60; break;
+    case 'h': unit = 3600; break;
+    case 'd': unit = 24 * 3600; break;
+    default: return false;
+    }
+    seconds = std::stoll(text.substr(0, digits)) * unit;
+    return true;
+}
+
+bool markReachable(std::unordered_set<std::string>& reachable) {
+    TRACE_SCOPE("gc::markReachable");
+    MarkSet marked;
+    std::atomic<bool> failed{false};
+
+    // Level-synchronous breadth-first walk: each level's objects are read in
+    // parallel, so the work done is proportional to what is reachable.
+    std::vector<Node> frontier;
+    for (Node& root : findRoots()) {
+        if (marked.insert(root.hash)) frontier.push_back(std::move(root));
+    }
+    while (!frontier.empty() && !failed) {
+        std::vector<std::vector<Node>> next(frontier.size());
+        utils::sharedPool().parallelFor(frontier.size(), [&](std::size_t i) {
+            expand(frontier[i], marked, next[i], failed);
+        });
+        frontier.clear();
+        for (auto& nodes : next) {
+            for (Node& node : nodes) frontier.push_back(std::move(node));
+        }
+    }
+
+    marked.moveInto(reachable);
+    return !failed;
+}
+
+bool collect(const Options& options, Stats& stats) {
+    TRACE_SCOPE("gc::collect");
+    std::unordered_set<std::string> reachable;
+    if (!markReachable(reachable)) {
+        utils::displayError("Cannot read every reachable object; nothing was removed.");
+        return false;
+    }
+    stats.reachable = reachable.size();
+    const std::int64_t cutoff = nowNs() - options.graceSeconds * 1000000000LL;
+
+    // Only temporary files there: objects are pruned by the repack.
+    const bool sweepObjects = !options.pack;
+    std::error_code ec;
+    sweepDir(IOManager::OBJECTS_DIR, "", false, reachable, cutoff, stats);
+    sweepDir(IOManager::PACK_DIR, "", false, reachable, cutoff, stats);
+    sweepDir(IOManager::COMMITS_DIR, "", sweepObjects, reachable, cutoff, stats);
+    for (const auto& entry : fs::directory_iterator(IOManager::OBJECTS_DIR, ec)) {
+        const std::string leaf = entry.path().filename().string();
+        if (!entry.is_directory() || leaf.size() != 2) continue;
+        if (sweepDir(entry.path(), leaf, sweepObjects, reachable, cutoff, stats) == 0) {
+            std::error_code removeEc;
+            fs::remove(entry.path(), removeEc);
+        }
+    }
+
+    if (options.pack) {
+        stats.pack = packfile::packObjects([&](const std::string& hash, std::int64_t mtimeNs) {
+            if (reachable.count(hash)) return true;
+            if (mtimeNs < cutoff) return false;
+            ++stats.recent;
+            return true;
+        });
+        stats.pruned += stats.pack.pruned;
+        stats.prunedBytes += stats.pack.prunedBytes;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,51 @@
+#ifndef GC_HPP
+#define GC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+
+#include "packfile.hpp"
+
+// Reachability-based garbage collection. Everything reachable from a branch,
+// HEAD, MERGE_HEAD, CHERRY_PICK_HEAD or the index is marked by walking commits, trees and chunk
+// manifests level by level on the shared pool; unmarked loose objects older
+// than the grace period are deleted, and packs are rewritten without them.
+namespace gc {
+
+// Two weeks, as in git: long enough that an object written by a command still
+// in progress (hashed but not yet staged or committed) is never collected
+constexpr std::int64_t DEFAULT_GRACE_SECONDS = 14 * 24 * 3600;
+
+struct Options {
+    std::int64_t graceSeconds = DEFAULT_GRACE_SECONDS;
+    bool pack = true; // repack what survives; otherwise only delete loose garbage
+};
+
+struct Stats {
+    std::size_t reachable = 0;
+    std::size_t pruned = 0;         // unreachable objects deleted
+    std::uint64_t prunedBytes = 0;
+    std::size_t recent = 0;         // unreachable but still inside the grace period
+    std::size_t tempRemoved = 0;    // abandoned temporary files
+    std::uint64_t tempBytes = 0;
+    packfile::PackStats pack;       // when Options::pack is set
+};
+
+// Parses a grace period: "now", or a number with an optional s/m/h/d unit
+// (seconds by default)
+bool parseGrace(const std::string& text, std::int64_t& seconds);
+
+// Hashes of every commit, tree, blob and chunk reachable from the refs, HEAD,
+// MERGE_HEAD, CHERRY_PICK_HEAD and the index. False (and nothing may be deleted) if a reachable
+// object could not be read, since whatever it points to would go unmarked.
+bool markReachable(std::unordered_set<std::string>& reachable);
+
+// Marks, then sweeps or repacks. False if marking failed, in which case
+// nothing was removed.
+bool collect(const Options& options, Stats& stats);
+
+}
+
+#endif
@@ -0,0 +1,716 @@
+#include "hash.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define MINIGIT_X86_DISPATCH 1
+#endif
+
+namespace hashing {
+
+namespace {
+
+// CPU feature detection
+
+struct CpuFeatures {
+    bool sha = false;  // SHA-NI plus the SSE4.1/SSSE3 it is used with
+    bool avx2 = false;
+};
+
+CpuFeatures detectCpu() {
+    CpuFeatures f;
+#ifdef MINIGIT_X86_DISPATCH
+    unsigned a = 0, b = 0, c = 0, d = 0;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) return f;
+    const bool ssse3 = c & (1u << 9);
+    const bool sse41 = c & (1u << 19);
+    const bool osxsave = c & (1u << 27);
+    const bool avx = c & (1u << 28);
+
+    bool ymmEnabled = false;
+    if (osxsave && avx) {
+        unsigned lo, hi;
+        __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        ymmEnabled = (lo & 0x6) == 0x6;
+    }
+
+    if (__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+        f.sha = ssse3 && sse41 && (b & (1u << 29));
+        f.avx2 = ymmEnabled && (b & (1u << 5));
+    }
+#endif
+    return f;
+}
+
+const CpuFeatures& cpu() {
+    static const CpuFeatures features = detectCpu();
+    return features;
+}
+
+std::uint32_t rotl(std::uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+std::uint32_t rotr(std::uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+std::uint32_t loadBE32(const unsigned char* p) {
+    return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+}
+
+std::uint32_t loadLE32(const unsigned char* p) {
+    return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8) | (std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24);
+}
+
+std::string toHex(const unsigned char* bytes, std::size_t n) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out(n * 2, '0');
+    for (std::size_t i = 0; i < n; ++i) {
+        out[2 * i] = digits[bytes[i] >> 4];
+        out[2 * i + 1] = digits[bytes[i] & 0xF];
+    }
+    return out;
+}
+
+// SHA-1 / SHA-256 block functions
+
+using BlockFn = void (*)(std::uint32_t* state, const unsigned char* data, std::size_t blocks);
+
+void sha1BlocksPortable(std::uint32_t* state, const unsigned char* data, std::size_t blocks) {
+    for (; blocks > 0; --blocks, data += 64) {
+        std::uint32_t w[80];
+        for (int i = 0; i < 16; ++i) w[i] = loadBE32(data + 4 * i);
+        for (int i = 16; i < 80; ++i) w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for (int i = 0; i < 80; ++i) {
+            std::uint32_t f, k;
+            if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+            std::uint32_t t = rotl(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rotl(b, 30); b = a; a = t;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+    }
+}
+
+alignas(16) const std::uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+void sha256BlocksPortable(std::uint32_t* state, const unsigned char* data, std::size_t blocks) {
+    for (; blocks > 0; --blocks, data += 64) {
+        std::uint32_t w[64];
+        for (int i = 0; i < 16; ++i) w[i] = loadBE32(data + 4 * i);
+        for (int i = 16; i < 64; ++i) {
+            std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        std::uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            std::uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+            std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#ifdef MINIGIT_X86_DISPATCH
+
+// SHA-NI paths. The message schedule is kept in a ring of four registers;
+// group g covers rounds 4g..4g+3.
+__attribute__((target("sha,sse4.1,ssse3")))
+void sha1BlocksShaNi(std::uint32_t* state, const unsigned char* data, std::size_t blocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+    __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+    __m128i e1;
+
+    for (; blocks > 0; --blocks, data += 64) {
+        const __m128i abcdSave = abcd;
+        const __m128i e0Save = e0;
+        __m128i w[4];
+
+        for (int g = 0; g < 20; ++g) {
+            if (g < 4) {
+                w[g] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * g)), MASK);
+            }
+            __m128i& cur = (g & 1) ? e1 : e0;
+            __m128i& next = (g & 1) ? e0 : e1;
+            cur = g == 0 ? _mm_add_epi32(e0, w[0]) : _mm_sha1nexte_epu32(cur, w[g & 3]);
+            next = abcd;
+            if (g >= 3 && g <= 18) w[(g + 1) & 3] = _mm_sha1msg2_epu32(w[(g + 1) & 3], w[g & 3]);
+            switch (g / 5) {
+                case 0: abcd = _mm_sha1rnds4_epu32(abcd, cur, 0); break;
+                case 1: abcd = _mm_sha1rnds4_epu32(abcd, cur, 1); break;
+                case 2: abcd = _mm_sha1rnds4_epu32(abcd, cur, 2); break;
+                default: abcd = _mm_sha1rnds4_epu32(abcd, cur, 3); break;
+            }
+            if (g >= 1 && g <= 16) w[(g + 3) & 3] = _mm_sha1msg1_epu32(w[(g + 3) & 3], w[g & 3]);
+            if (g >= 2 && g <= 17) w[(g + 2) & 3] = _mm_xor_si128(w[(g + 2) & 3], w[g & 3]);
+        }
+
+        e0 = _mm_sha1nexte_epu32(e0, e0Save);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = static_cast<std::uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+__attribute__((target("sha,sse4.1,ssse3")))
+void sha256BlocksShaNi(std::uint32_t* state, const unsigned char* data, std::size_t blocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);       // CDGH
+
+    for (; blocks > 0; --blocks, data += 64) {
+        const __m128i abefSave = state0;
+        const __m128i cdghSave = state1;
+        __m128i w[4];
+
+        for (int g = 0; g < 16; ++g) {
+            if (g < 4) {
+                w[g] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * g)), MASK);
+            }
+            __m128i msg = _mm_add_epi32(w[g & 3], _mm_load_si128(reinterpret_cast<const __m128i*>(SHA256_K + 4 * g)));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            if (g >= 3 && g <= 14) {
+                __m128i carry = _mm_alignr_epi8(w[g & 3], w[(g + 3) & 3], 4);
+                w[(g + 1) & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(w[(g + 1) & 3], carry), w[g & 3]);
+            }
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+            if (g >= 1 && g <= 12) w[(g + 3) & 3] = _mm_sha256msg1_epu32(w[(g + 3) & 3], w[g & 3]);
+        }
+
+        state0 = _mm_add_epi32(state0, abefSave);
+        state1 = _mm_add_epi32(state1, cdghSave);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);           // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);        // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);     // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);        // HGFE
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+#endif
+
+BlockFn sha1Blocks() {
+#ifdef MINIGIT_X86_DISPATCH
+    if (cpu().sha) return sha1BlocksShaNi;
+#endif
+    return sha1BlocksPortable;
+}
+
+BlockFn sha256Blocks() {
+#ifdef MINIGIT_X86_DISPATCH
+    if (cpu().sha) return sha256BlocksShaNi;
+#endif
+    return sha256BlocksPortable;
+}
+
+// BLAKE3
+
+constexpr std::size_t BLAKE3_BLOCK_LEN = 64;
+constexpr std::size_t BLAKE3_CHUNK_LEN = 1024;
+constexpr std::size_t BLAKE3_OUT_LEN = 32;
+constexpr std::uint32_t CHUNK_START = 1, CHUNK_END = 2, PARENT = 4, ROOT = 8;
+constexpr std::size_t PARALLEL_MIN_BYTES = 1u << 20; // below this, threads cost more than they save
+
+using CV = std::array<std::uint32_t, 8>;
+
+constexpr CV BLAKE3_IV = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                          0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+constexpr std::uint8_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+inline void g(std::uint32_t* v, int a, int b, int c, int d, std::uint32_t x, std::uint32_t y) {
+    v[a] = v[a] + v[b] + x; v[d] = rotr(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];     v[b] = rotr(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y; v[d] = rotr(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];     v[b] = rotr(v[b] ^ v[c], 7);
+}
+
+void compress(const CV& cv, const std::uint32_t block[16], std::uint64_t counter,
+              std::uint32_t blockLen, std::uint32_t flags, std::uint32_t out[16]) {
+    std::uint32_t v[16] = {cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                           BLAKE3_IV[0], BLAKE3_IV[1], BLAKE3_IV[2], BLAKE3_IV[3],
+                           static_cast<std::uint32_t>(counter), static_cast<std::uint32_t>(counter >> 32),
+                           blockLen, flags};
+    for (const auto& s : MSG_SCHEDULE) {
+        g(v, 0, 4, 8, 12, block[s[0]], block[s[1]]);
+        g(v, 1, 5, 9, 13, block[s[2]], block[s[3]]);
+        g(v, 2, 6, 10, 14, block[s[4]], block[s[5]]);
+        g(v, 3, 7, 11, 15, block[s[6]], block[s[7]]);
+        g(v, 0, 5, 10, 15, block[s[8]], block[s[9]]);
+        g(v, 1, 6, 11, 12, block[s[10]], block[s[11]]);
+        g(v, 2, 7, 8, 13, block[s[12]], block[s[13]]);
+        g(v, 3, 4, 9, 14, block[s[14]], block[s[15]]);
+    }
+    for (int i = 0; i < 8; ++i) {
+        out[i] = v[i] ^ v[i + 8];
+        out[i + 8] = v[i + 8] ^ cv[i];
+    }
+}
+
+void loadBlock(const unsigned char* p, std::size_t len, std::uint32_t block[16]) {
+    unsigned char padded[BLAKE3_BLOCK_LEN] = {};
+    std::memcpy(padded, p, len);
+    for (int i = 0; i < 16; ++i) block[i] = loadLE32(padded + 4 * i);
+}
+
+// The last compression of a node, deferred until we know whether it is the root.
+struct Output {
+    CV cv;
+    std::uint32_t block[16];
+    std::uint64_t counter;
+    std::uint32_t blockLen;
+    std::uint32_t flags;
+
+    CV chainingValue() const {
+        std::uint32_t out[16];
+        compress(cv, block, counter, blockLen, flags, out);
+        CV result;
+        std::copy(out, out + 8, result.begin());
+        return result;
+    }
+
+    void rootBytes(unsigned char digest[BLAKE3_OUT_LEN]) const {
+        std::uint32_t out[16];
+        compress(cv, block, 0, blockLen, flags | ROOT, out);
+        for (int i = 0; i < 8; ++i) {
+            for (int b = 0; b < 4; ++b) digest[4 * i + b] = static_cast<unsigned char>(out[i] >> (8 * b));
+        }
+    }
+};
+
+Output parentOutput(const CV& left, const CV& right) {
+    Output o;
+    o.cv = BLAKE3_IV;
+    std::copy(left.begin(), left.end(), o.block);
+    std::copy(right.begin(), right.end(), o.block + 8);
+    o.counter = 0;
+    o.blockLen = BLAKE3_BLOCK_LEN;
+    o.flags = PARENT;
+    return o;
+}
+
+struct ChunkState {
+    CV cv = BLAKE3_IV;
+    std::uint64_t counter = 0;
+    unsigned char buffer[BLAKE3_BLOCK_LEN] = {};
+    std::size_t bufferLen = 0;
+    std::size_t blocksCompressed = 0;
+
+    std::size_t length() const { return blocksCompressed * BLAKE3_BLOCK_LEN + bufferLen; }
+    std::uint32_t startFlag() const { return blocksCompressed == 0 ? CHUNK_START : 0; }
+
+    void update(const unsigned char* p, std::size_t len) {
+        while (len > 0) {
+            if (bufferLen == BLAKE3_BLOCK_LEN) {
+                std::uint32_t block[16], out[16];
+                loadBlock(buffer, BLAKE3_BLOCK_LEN, block);
+                compress(cv, block, counter, BLAKE3_BLOCK_LEN, startFlag(), out);
+                std::copy(out, out + 8, cv.begin());
+                ++blocksCompressed;
+                bufferLen = 0;
+            }
+            std::size_t take = std::min(BLAKE3_BLOCK_LEN - bufferLen, len);
+            std::memcpy(buffer + bufferLen, p, take);
+            bufferLen += take;
+            p += take;
+            len -= take;
+        }
+    }
+
+    Output output() const {
+        Output o;
+        o.cv = cv;
+        loadBlock(buffer, bufferLen, o.block);
+        o.counter = counter;
+        o.blockLen = static_cast<std::uint32_t>(bufferLen);
+        o.flags = startFlag() | CHUNK_END;
+        return o;
+    }
+};
+
+Output chunkOutput(const unsigned char* p, std::size_t len, std::uint64_t counter) {
+    ChunkState chunk;
+    chunk.counter = counter;
+    chunk.update(p, len);
+    return chunk.output();
+}
+
+#ifdef MINIGIT_X86_DISPATCH
+
+__attribute__((target("avx2")))
+inline __m256i rotr256(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+__attribute__((target("avx2")))
+inline void g8(__m256i* v, int a, int b, int c, int d, __m256i x, __m256i y) {
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x); v[d] = rotr256(_mm256_xor_si256(v[d], v[a]), 16);
+    v[c] = _mm256_add_epi32(v[c], v[d]);                      v[b] = rotr256(_mm256_xor_si256(v[b], v[c]), 12);
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y); v[d] = rotr256(_mm256_xor_si256(v[d], v[a]), 8);
+    v[c] = _mm256_add_epi32(v[c], v[d]);                      v[b] = rotr256(_mm256_xor_si256(v[b], v[c]), 7);
+}
+
+// Hashes eight consecutive full chunks at once, one chunk per 32-bit lane.
+__attribute__((target("avx2")))
+void hash8ChunksAvx2(const unsigned char* input, std::uint64_t counter, CV out[8]) {
+    const __m256i stride = _mm256_setr_epi32(0, 1024, 2048, 3072, 4096, 5120, 6144, 7168);
+    __m256i h[8];
+    for (int i = 0; i < 8; ++i) h[i] = _mm256_set1_epi32(static_cast<int>(BLAKE3_IV[i]));
+
+    alignas(32) std::uint32_t lo[8], hi[8];
+    for (int lane = 0; lane < 8; ++lane) {
+        lo[lane] = static_cast<std::uint32_t>(counter + lane);
+        hi[lane] = static_cast<std::uint32_t>((counter + lane) >> 32);
+    }
+    const __m256i counterLo = _mm256_load_si256(reinterpret_cast<const __m256i*>(lo));
+    const __m256i counterHi = _mm256_load_si256(reinterpret_cast<const __m256i*>(hi));
+
+    for (std::size_t blockIndex = 0; blockIndex < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; ++blockIndex) {
+        __m256i m[16];
+        const unsigned char* base = input + blockIndex * BLAKE3_BLOCK_LEN;
+        for (int w = 0; w < 16; ++w) {
+            m[w] = _mm256_i32gather_epi32(reinterpret_cast<const int*>(base + 4 * w), stride, 1);
+        }
+
+        std::uint32_t flags = (blockIndex == 0 ? CHUNK_START : 0) |
+                              (blockIndex + 1 == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN ? CHUNK_END : 0);
+        __m256i v[16] = {h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+                         _mm256_set1_epi32(static_cast<int>(BLAKE3_IV[0])), _mm256_set1_epi32(static_cast<int>(BLAKE3_IV[1])),
+                         _mm256_set1_epi32(static_cast<int>(BLAKE3_IV[2])), _mm256_set1_epi32(static_cast<int>(BLAKE3_IV[3])),
+                         counterLo, counterHi,
+                         _mm256_set1_epi32(static_cast<int>(BLAKE3_BLOCK_LEN)), _mm256_set1_epi32(static_cast<int>(flags))};
+        for (const auto& s : MSG_SCHEDULE) {
+            g8(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+            g8(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+            g8(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+            g8(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+            g8(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+            g8(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+            g8(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+            g8(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+        }
+        for (int i = 0; i < 8; ++i) h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+    }
+
+    alignas(32) std::uint32_t words[8][8];
+    for (int i = 0; i < 8; ++i) _mm256_store_si256(reinterpret_cast<__m256i*>(words[i]), h[i]);
+    for (int lane = 0; lane < 8; ++lane) {
+        for (int i = 0; i < 8; ++i) out[lane][i] = words[i][lane];
+    }
+}
+
+#endif
+
+// Chaining values of `count` consecutive full chunks, none of which is the root.
+void hashFullChunks(const unsigned char* input, std::size_t count, std::uint64_t counter, CV* out) {
+    std::size_t i = 0;
+#ifdef MINIGIT_X86_DISPATCH
+    if (cpu().avx2) {
+        for (; i + 8 <= count; i += 8) {
+            hash8ChunksAvx2(input + i * BLAKE3_CHUNK_LEN, counter + i, out + i);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = chunkOutput(input + i * BLAKE3_CHUNK_LEN, BLAKE3_CHUNK_LEN, counter + i).chainingValue();
+    }
+}
+
+// Merges a finished chunk into the stack of complete subtrees. The number of
+// trailing zero bits in the chunk total says how many subtrees it completes.
+void pushChunkCV(std::vector<CV>& stack, CV cv, std::uint64_t totalChunks) {
+    while ((totalChunks & 1) == 0) {
+        cv = parentOutput(stack.back(), cv).chainingValue();
+        stack.pop_back();
+        totalChunks >>= 1;
+    }
+    stack.push_back(cv);
+}
+
+// Largest power-of-two number of whole chunks strictly smaller than `len`.
+std::size_t leftSubtreeLen(std::size_t len) {
+    std::size_t chunks = (len - 1) / BLAKE3_CHUNK_LEN;
+    std::size_t pow2 = 1;
+    while (pow2 * 2 <= chunks) pow2 *= 2;
+    return pow2 * BLAKE3_CHUNK_LEN;
+}
+
+// Chaining value of a non-root subtree.
+CV subtreeCV(const unsigned char* input, std::size_t len, std::uint64_t counter, unsigned threads) {
+    if (len <= BLAKE3_CHUNK_LEN) return chunkOutput(input, len, counter).chainingValue();
+
+    if (threads > 1 && len >= 2 * PARALLEL_MIN_BYTES) {
+        std::size_t leftLen = leftSubtreeLen(len);
+        auto left = std::async(std::launch::async, subtreeCV, input, leftLen, counter, threads / 2);
+        CV right = subtreeCV(input + leftLen, len - leftLen, counter + leftLen / BLAKE3_CHUNK_LEN,
+                             threads - threads / 2);
+        return parentOutput(left.get(), right).chainingValue();
+    }
+
+    // Sequential: batch whole chunks through the SIMD path, folding as we go.
+    constexpr std::size_t BATCH = 64;
+    std::vector<CV> stack;
+    CV cvs[BATCH];
+    std::size_t fullChunks = len / BLAKE3_CHUNK_LEN;
+    std::size_t done = 0;
+    while (done < fullChunks) {
+        std::size_t n = std::min(BATCH, fullChunks - done);
+        hashFullChunks(input + done * BLAKE3_CHUNK_LEN, n, counter + done, cvs);
+        for (std::size_t i = 0; i < n; ++i) pushChunkCV(stack, cvs[i], done + i + 1);
+        done += n;
+    }
+    if (len % BLAKE3_CHUNK_LEN) {
+        CV tail = chunkOutput(input + done * BLAKE3_CHUNK_LEN, len % BLAKE3_CHUNK_LEN, counter + done).chainingValue();
+        pushChunkCV(stack, tail, done + 1);
+    }
+
+    CV cv = stack.back();
+    for (std::size_t i = stack.size() - 1; i-- > 0;) cv = parentOutput(stack[i], cv).chainingValue();
+    return cv;
+}
+
+std::string blake3OneShot(const unsigned char* input, std::size_t len) {
+    unsigned char digestBytes[BLAKE3_OUT_LEN];
+    if (len <= BLAKE3_CHUNK_LEN) {
+        chunkOutput(input, len, 0).rootBytes(digestBytes);
+        return toHex(digestBytes, BLAKE3_OUT_LEN);
+    }
+
+    unsigned threads = len >= PARALLEL_MIN_BYTES ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+    std::size_t leftLen = leftSubtreeLen(len);
+    CV left, right;
+    if (threads > 1) {
+        auto future = std::async(std::launch::async, subtreeCV, input, leftLen, 0, threads / 2);
+        right = subtreeCV(input + leftLen, len - leftLen, leftLen / BLAKE3_CHUNK_LEN, threads - threads / 2);
+        left = future.get();
+    } else {
+        left = subtreeCV(input, leftLen, 0, 1);
+        right = subtreeCV(input + leftLen, len - leftLen, leftLen / BLAKE3_CHUNK_LEN, 1);
+    }
+    parentOutput(left, right).rootBytes(digestBytes);
+    return toHex(digestBytes, BLAKE3_OUT_LEN);
+}
+
+}
+
+// Engines
+
+struct Hasher::Engine {
+    virtual ~Engine() = default;
+    virtual void update(const unsigned char* data, std::size_t length) = 0;
+    virtual std::string finalHex() = 0;
+};
+
+namespace {
+
+// Merkle-Damgard framing shared by SHA-1 and SHA-256.
+template <std::size_t Words>
+class MdEngine : public Hasher::Engine {
+public:
+    MdEngine(const std::uint32_t (&iv)[Words], BlockFn blocks) : blocks_(blocks) {
+        std::copy(iv, iv + Words, state_);
+    }
+
+    void update(const unsigned char* data, std::size_t length) override {
+        total_ += length;
+        if (bufferLen_ > 0) {
+            std::size_t take = std::min<std::size_t>(64 - bufferLen_, length);
+            std::memcpy(buffer_ + bufferLen_, data, take);
+            bufferLen_ += take;
+            data += take;
+            length -= take;
+            if (bufferLen_ < 64) return;
+            blocks_(state_, buffer_, 1);
+            bufferLen_ = 0;
+        }
+        if (length >= 64) {
+            blocks_(state_, data, length / 64);
+            data += length / 64 * 64;
+            length %= 64;
+        }
+        std::memcpy(buffer_, data, length);
+        bufferLen_ = length;
+    }
+
+    std::string finalHex() override {
+        const std::uint64_t bits = total_ * 8;
+        unsigned char pad[72] = {0x80};
+        std::size_t padLen = (bufferLen_ < 56 ? 56 : 120) - bufferLen_;
+        for (int i = 0; i < 8; ++i) pad[padLen + i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+        update(pad, padLen + 8);
+
+        unsigned char out[Words * 4];
+        for (std::size_t i = 0; i < Words; ++i) {
+            for (int b = 0; b < 4; ++b) out[4 * i + b] = static_cast<unsigned char>(state_[i] >> (24 - 8 * b));
+        }
+        return toHex(out, sizeof(out));
+    }
+
+private:
+    std::uint32_t state_[Words];
+    BlockFn blocks_;
+    unsigned char buffer_[64] = {};
+    std::size_t bufferLen_ = 0;
+    std::uint64_t total_ = 0;
+};
+
+const std::uint32_t SHA1_IV[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+const std::uint32_t SHA256_IV[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+class Blake3Engine : public Hasher::Engine {
+public:
+    void update(const unsigned char* data, std::size_t length) override {
+        // Whole chunks that are certainly not the last go through the SIMD path.
+        constexpr std::size_t BATCH = 8;
+        while (chunk_.length() == 0 && length > BATCH * BLAKE3_CHUNK_LEN) {
+            CV cvs[BATCH];
+            hashFullChunks(data, BATCH, chunk_.counter, cvs);
+            for (std::size_t i = 0; i < BATCH; ++i) pushChunkCV(stack_, cvs[i], chunk_.counter + i + 1);
+            chunk_.counter += BATCH;
+            data += BATCH * BLAKE3_CHUNK_LEN;
+            length -= BATCH * BLAKE3_CHUNK_LEN;
+        }
+
+        while (length > 0) {
+            if (chunk_.length() == BLAKE3_CHUNK_LEN) {
+                std::uint64_t total = chunk_.counter + 1;
+                pushChunkCV(stack_, chunk_.output().chainingValue(), total);
+                chunk_ = ChunkState();
+                chunk_.counter = total;
+            }
+            std::size_t take = std::min(BLAKE3_CHUNK_LEN - chunk_.length(), length);
+            chunk_.update(data, take);
+            data += take;
+            length -= take;
+        }
+    }
+
+    std::string finalHex() override {
+        Output output = chunk_.output();
+        for (std::size_t i = stack_.size(); i-- > 0;) {
+            output = parentOutput(stack_[i], output.chainingValue());
+        }
+        unsigned char digestBytes[BLAKE3_OUT_LEN];
+        output.rootBytes(digestBytes);
+        return toHex(digestBytes, BLAKE3_OUT_LEN);
+    }
+
+private:
+    ChunkState chunk_;
+    std::vector<CV> stack_;
+};
+
+// std::hash cannot be fed incrementally, so the legacy engine buffers.
+class LegacyEngine : public Hasher::Engine {
+public:
+    void update(const unsigned char* data, std::size_t length) override {
+        buffer_.append(reinterpret_cast<const char*>(data), length);
+    }
+
+    std::string finalHex() override {
+        std::stringstream ss;
+        ss << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>{}(buffer_);
+        return ss.str();
+    }
+
+private:
+    std::string buffer_;
+};
+
+}
+
+bool parseAlgorithm(const std::string& name, Algorithm& out) {
+    if (name == "sha1") out = Algorithm::SHA1;
+    else if (name == "sha256") out = Algorithm::SHA256;
+    else if (name == "blake3") out = Algorithm::BLAKE3;
+    else if (name == "legacy") out = Algorithm::Legacy;
+    else return false;
+    return true;
+}
+
+std::string algorithmName(Algorithm algorithm) {
+    switch (algorithm) {
+        case Algorithm::SHA1: return "sha1";
+        case Algorithm::SHA256: return "sha256";
+        case Algorithm::BLAKE3: return "blake3";
+        case Algorithm::Legacy: break;
+    }
+    return "legacy";
+}
+
+Hasher::Hasher(Algorithm algorithm) {
+    switch (algorithm) {
+        case Algorithm::SHA1: engine_ = std::make_unique<MdEngine<5>>(SHA1_IV, sha1Blocks()); break;
+        case Algorithm::SHA256: engine_ = std::make_unique<MdEngine<8>>(SHA256_IV, sha256Blocks()); break;
+        case Algorithm::BLAKE3: engine_ = std::make_unique<Blake3Engine>(); break;
+        case Algorithm::Legacy: engine_ = std::make_unique<LegacyEngine>(); break;
+    }
+}
+
+Hasher::~Hasher() = default;
+Hasher::Hasher(Hasher&&) noexcept = default;
+Hasher& Hasher::operator=(Hasher&&) noexcept = default;
+
+void Hasher::update(const void* data, std::size_t length) {
+    engine_->update(static_cast<const unsigned char*>(data), length);
+}
+
+std::string Hasher::finalHex() {
+    return engine_->finalHex();
+}
+
+std::string digest(Algorithm algorithm, const void* data, std::size_t length) {
+    if (algorithm == Algorithm::BLAKE3) {
+        return blake3OneShot(static_cast<const unsigned char*>(data), length);
+    }
+    Hasher hasher(algorithm);
+    hasher.update(data, length);
+    return hasher.finalHex();
+}
+
+std::string activeBackends() {
+    std::string sha = cpu().sha ? "sha-ni" : "portable";
+    std::string blake = cpu().avx2 ? "avx2" : "portable";
+    return "sha1/sha256: " + sha + ", blake3: " + blake + " x" +
+           std::to_string(std::max(1u, std::thread::hardware_concurrency())) + " threads";
+}
+
+}
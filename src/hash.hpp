@@ -0,0 +1,50 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace hashing {
+
+enum class Algorithm {
+    Legacy, // std::hash, kept so repositories created before the config existed stay readable
+    SHA1,
+    SHA256,
+    BLAKE3
+};
+
+// Parses "sha1", "sha256", "blake3" or "legacy". Legacy is only for reading
+// the config of an existing repository; init refuses it.
+bool parseAlgorithm(const std::string& name, Algorithm& out);
+std::string algorithmName(Algorithm algorithm);
+
+// Streaming hasher: construct, update() any number of times, then finalHex()
+class Hasher {
+public:
+    explicit Hasher(Algorithm algorithm);
+    ~Hasher();
+    Hasher(Hasher&&) noexcept;
+    Hasher& operator=(Hasher&&) noexcept;
+
+    void update(const void* data, std::size_t length);
+    void update(const std::string& data) { update(data.data(), data.size()); }
+    // Lowercase hex digest; the hasher must not be updated afterwards
+    std::string finalHex();
+
+    struct Engine;
+
+private:
+    std::unique_ptr<Engine> engine_;
+};
+
+// One-shot digest. Large BLAKE3 inputs are tree-hashed across threads.
+std::string digest(Algorithm algorithm, const void* data, std::size_t length);
+
+// Names of the accelerated code paths picked at runtime, for diagnostics
+std::string activeBackends();
+
+}
+
+#endif
@@ -1,19 +1,209 @@
 #include "io.hpp"
 #include "dsa.hpp"
+#include "hash.hpp"
 #include "utils.hpp"
+#include "packfile.hpp"
+#include "threadpool.hpp"
+#include "chunker.hpp"
+#include "trace.hpp"
 #include <fstream>
 #include <sstream>
 #include<filesystem>
 #include<string>
 #include <iostream>
 #include <ctime>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MINIGIT_HAVE_MMAP 1
+#endif
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define MINIGIT_HAVE_COPY_FILE_RANGE 1
+#endif
+#endif
 
 using namespace std;
 namespace fs = filesystem;
 
+namespace {
+// Like readFile, but a missing file is not an error (the object may be packed)
+bool readIfPresent(const string &path, string &content) {
+    ifstream file(path, ios::binary);
+    if (!file) return false;
+    content.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    trace::count(trace::Counter::FilesOpened);
+    trace::count(trace::Counter::BytesRead, content.size());
+    return true;
+}
+
+// Files are streamed in chunks of this size, so memory use does not grow with
+// file size. Smaller files are simply read whole.
+constexpr size_t STREAM_CHUNK = 1 << 20;
+
+// Copies in to out chunk by chunk, feeding every chunk to hasher if given
+bool streamCopy(istream &in, ostream *out, hashing::Hasher *hasher) {
+    vector<char> buffer(STREAM_CHUNK);
+    while (in) {
+        in.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+        const streamsize n = in.gcount();
+        if (n <= 0) break;
+        trace::count(trace::Counter::BytesRead, static_cast<uint64_t>(n));
+        if (hasher) hasher->update(buffer.data(), static_cast<size_t>(n));
+        if (out && !out->write(buffer.data(), n)) return false;
+        if (out) trace::count(trace::Counter::BytesWritten, static_cast<uint64_t>(n));
+    }
+    return !in.bad();
+}
+
+constexpr size_t DEFAULT_CACHE_MB = 64;
+
+size_t configuredCacheBudget() {
+    string value = IOManager::readConfig("cache_mb");
+    size_t mb = DEFAULT_CACHE_MB;
+    if (!value.empty()) {
+        try {
+            mb = stoul(value);
+        } catch (const exception &) {
+            utils::displayError("Invalid cache_mb '" + value + "' in config, using the default.");
+        }
+    }
+    return mb * 1024 * 1024;
+}
+
+// Three quarters of the budget go to raw objects, the rest to parsed commits.
+utils::LruCache<string> &objectCache() {
+    static utils::LruCache<string> cache(configuredCacheBudget() / 4 * 3,
+                                         [](const string &s) { return s.size(); });
+    return cache;
+}
+
+utils::LruCache<FileMap> &commitCache() {
+    static utils::LruCache<FileMap> cache(configuredCacheBudget() / 4, [](const FileMap &files) {
+        size_t bytes = 0;
+        for (const auto &[path, hash] : files) bytes += path.size() + hash.size() + 64;
+        return bytes;
+    });
+    return cache;
+}
+
+// The last index this process read or wrote. While IOManager::holdIndex is in
+// effect, writes only update it and reach the file when the hold is released;
+// otherwise it spares parsing the file again as long as nobody replaced it.
+struct CachedIndex {
+    mutex guard;
+    bool held = false;
+    bool loaded = false;  // entries mirror the index
+    bool dirty = false;   // entries have not been written yet
+    bool snapshot = true; // false for indexes from before the snapshot format
+    vector<IndexEntry> entries;
+    CacheTree trees;
+    IndexEntry stamp;     // stat of the index file when entries were loaded or written
+} indexCache;
+
+// True if the index file was not replaced since stamp was taken (index writes
+// are atomic renames, so a new inode or mtime means another process wrote it)
+bool sameIndexFile(const IndexEntry &stamp, const IndexEntry &current) {
+    return stamp.mtimeNs == current.mtimeNs && stamp.size == current.size && stamp.inode == current.inode;
+}
+
+// Loads an object from a loose file or a pack, going through the object cache
+shared_ptr<const string> loadShared(const string &hash, const string &loosePath) {
+    if (auto cached = objectCache().get(hash)) {
+        trace::count(trace::Counter::CacheHits);
+        return cached;
+    }
+    trace::count(trace::Counter::CacheMisses);
+    string content;
+    if (!readIfPresent(loosePath, content) && !packfile::readObject(hash, content)) return nullptr;
+    auto shared = make_shared<const string>(std::move(content));
+    objectCache().put(hash, shared);
+    return shared;
+}
+
+bool loadObject(const string &hash, const string &loosePath, string &content) {
+    auto shared = loadShared(hash, loosePath);
+    if (!shared) return false;
+    content = *shared;
+    return true;
+}
+}
+
+// Memory Mapping
+
+MappedFile::MappedFile(const string &path) {
+#ifdef MINIGIT_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    trace::count(trace::Counter::FilesOpened);
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *addr = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED) {
+            data_ = static_cast<const char *>(addr);
+            size_ = static_cast<size_t>(st.st_size);
+            mapped_ = true;
+        }
+    }
+    ::close(fd);
+#else
+    ifstream file(path, ios::binary);
+    if (!file) return;
+    buffer_.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    if (!buffer_.empty()) {
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+    }
+#endif
+}
+
+MappedFile::~MappedFile() {
+    release();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+        release();
+        buffer_ = std::move(other.buffer_);
+        mapped_ = other.mapped_;
+        size_ = other.size_;
+        data_ = mapped_ ? other.data_ : (size_ ? buffer_.data() : nullptr);
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.mapped_ = false;
+    }
+    return *this;
+}
+
+void MappedFile::release() {
+#ifdef MINIGIT_HAVE_MMAP
+    if (mapped_ && data_) ::munmap(const_cast<char *>(data_), size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    buffer_.clear();
+}
+
 // Directory Operations
 
-bool IOManager::initMinigitDir() {
+bool IOManager::initMinigitDir(const string &hashAlgorithm) {
     try {
         // Create repository structure
         fs::create_directory(MINIGIT_DIR);
@@ -21,11 +211,19 @@ bool IOManager::initMinigitDir() {
         fs::create_directories(COMMITS_DIR);
         fs::create_directories(REFS_HEADS_DIR);
 
+        writeFile(CONFIG_FILE, "");
+        writeConfig("hash", hashAlgorithm);
         writeReference("main","");
 
         // Initialize key files
         writeFile(HEAD_FILE, "ref: refs/heads/main\n");
         writeFile(INDEX_FILE, "");
+        {
+            lock_guard<mutex> lock(indexCache.guard);
+            indexCache.loaded = indexCache.dirty = false;
+            indexCache.entries.clear();
+            indexCache.trees.clear();
+        }
 
         return true;
     } catch (const exception &e) {
@@ -35,23 +233,31 @@ bool IOManager::initMinigitDir() {
 }
 
 bool IOManager::createDir(const string &path) {
-    return fs::create_directories(path);
+    error_code ec; // another thread may create it first; that is fine
+    return fs::create_directories(path, ec);
 }
 
 // File Operations
 
 string IOManager::readFile(const string &path) {
+    TRACE_SCOPE("io::readFile");
     ifstream file(path, ios::binary);
     if (!file) {
         utils::displayError(string("Cannot open file ")+path);
         return "";
     }
     
-    return string(istreambuf_iterator<char>(file), 
-                 istreambuf_iterator<char>());
+    string content(istreambuf_iterator<char>(file), 
+                   (istreambuf_iterator<char>()));
+    trace::count(trace::Counter::FilesOpened);
+    trace::count(trace::Counter::BytesRead, content.size());
+    return content;
 }
 
 bool IOManager::writeFile(const string &path, const string &content) {
+    TRACE_SCOPE("io::writeFile");
+    trace::count(trace::Counter::FilesOpened);
+    trace::count(trace::Counter::BytesWritten, content.size());
     ofstream file(path, ios::binary);
     if (!file) {
         utils::displayError(string("Error writing to: ")+path);
@@ -62,6 +268,29 @@ bool IOManager::writeFile(const string &path, const string &content) {
     return file.good();
 }
 
+string IOManager::tempPathFor(const string &path) {
+    static atomic<unsigned long> counter{0};
+#ifdef MINIGIT_HAVE_MMAP
+    return path + ".tmp-" + to_string(::getpid()) + "-" + to_string(counter++);
+#else
+    return path + ".tmp-" + to_string(counter++);
+#endif
+}
+
+bool IOManager::writeFileAtomic(const string &path, const string &content) {
+    const string tmp = tempPathFor(path);
+    if (!writeFile(tmp, content)) return false;
+
+    error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        utils::displayError(string("Error writing to: ")+path);
+        return false;
+    }
+    return true;
+}
+
 bool IOManager::copyFile(const string &src, const string &dest) {
     try {
         fs::copy_file(src, dest, fs::copy_options::overwrite_existing);
@@ -76,21 +305,520 @@ bool IOManager::fileExists(const string &path) {
     return fs::exists(path);
 }
 
+string IOManager::normalizePath(const string &path) {
+    fs::path p = fs::path(path).lexically_normal();
+    if (p.is_absolute()) p = p.lexically_relative(fs::current_path());
+    string out = p.generic_string();
+    while (out.rfind("./", 0) == 0) out.erase(0, 2);
+    if (!out.empty() && out.back() == '/') out.pop_back();
+    return out.empty() ? "." : out;
+}
+
+vector<string> IOManager::listFiles(const string &root) {
+    TRACE_SCOPE("io::listFiles");
+    vector<string> files;
+    error_code ec;
+    if (fs::is_regular_file(root, ec)) {
+        files.push_back(normalizePath(root));
+        return files;
+    }
+    if (!fs::is_directory(root, ec)) return files;
+
+    // One level of the tree at a time: parallelFor waits for this call's
+    // directories only, so listing from inside a pool task (or next to other
+    // work on the shared pool) neither hangs nor picks up foreign errors.
+    mutex filesMutex;
+    vector<fs::path> level{root};
+    while (!level.empty()) {
+        vector<vector<fs::path>> subdirs(level.size());
+        utils::sharedPool().parallelFor(level.size(), [&](size_t i) {
+            vector<string> local;
+            error_code walkEc;
+            for (const auto &entry : fs::directory_iterator(level[i], walkEc)) {
+                const string path = normalizePath(entry.path().string());
+                if (path == MINIGIT_DIR) continue;
+                if (entry.is_directory(walkEc) && !entry.is_symlink(walkEc)) {
+                    subdirs[i].push_back(entry.path());
+                } else if (entry.is_regular_file(walkEc)) {
+                    local.push_back(path);
+                }
+            }
+            lock_guard<mutex> lock(filesMutex);
+            files.insert(files.end(), make_move_iterator(local.begin()), make_move_iterator(local.end()));
+        });
+        level.clear();
+        for (auto &dirs : subdirs) {
+            level.insert(level.end(), make_move_iterator(dirs.begin()), make_move_iterator(dirs.end()));
+        }
+    }
+
+    sort(files.begin(), files.end());
+    return files;
+}
+
+// Repository Config
+
+string IOManager::readConfig(const string &key) {
+    string content;
+    if (!readIfPresent(CONFIG_FILE, content)) return "";
+
+    istringstream iss(content);
+    string line;
+    while (getline(iss, line)) {
+        size_t pos = line.find('=');
+        if (pos != string::npos && utils::trim(line.substr(0, pos)) == key) {
+            return utils::trim(line.substr(pos + 1));
+        }
+    }
+    return "";
+}
+
+bool IOManager::writeConfig(const string &key, const string &value) {
+    string content;
+    readIfPresent(CONFIG_FILE, content);
+
+    ostringstream out;
+    istringstream iss(content);
+    string line;
+    bool replaced = false;
+    while (getline(iss, line)) {
+        size_t pos = line.find('=');
+        if (pos != string::npos && utils::trim(line.substr(0, pos)) == key) {
+            if (replaced) continue;
+            line = key + " = " + value;
+            replaced = true;
+        }
+        out << line << "\n";
+    }
+    if (!replaced) out << key << " = " << value << "\n";
+    return writeFile(CONFIG_FILE, out.str());
+}
 
 // Blob Storage
 string IOManager::writeBlob(const string &content) {
+    TRACE_SCOPE("io::writeBlob");
     const string hash = dsa::computeSHA1(content);
     const string dir = OBJECTS_DIR + "/" + hash.substr(0,2);
     const string path = dir + "/" + hash.substr(2);
 
-    if(!fileExists(path)) createDir(dir);
-    writeFile(path,content);
+    // Content addressed: an existing copy, loose or packed, is already correct.
+    if (fileExists(path) || packfile::contains(hash)) return hash;
+
+    createDir(dir);
+    writeFileAtomic(path,content);
+
+    return hash;
+}
+
+namespace {
+// Files at least this large are stored chunked ("chunk_min_mb" in config;
+// unset or 0 turns chunking off)
+uintmax_t chunkThreshold() {
+    static const uintmax_t threshold = [] {
+        string value = IOManager::readConfig("chunk_min_mb");
+        if (value.empty()) return uintmax_t(0);
+        try {
+            return uintmax_t(stoull(value)) * 1024 * 1024;
+        } catch (const exception &) {
+            utils::displayError("Invalid chunk_min_mb '" + value + "' in config, chunking disabled.");
+            return uintmax_t(0);
+        }
+    }();
+    return threshold;
+}
+
+// Stores a file as content-defined chunks plus a manifest named by the hash of
+// the whole file. Reads a batch at a time and writes each batch's chunks in parallel.
+string writeChunkedBlob(const string &path) {
+    TRACE_SCOPE("io::writeChunkedBlob");
+    ifstream in(path, ios::binary);
+    if (!in) {
+        utils::displayError(string("Cannot open file ")+path);
+        return "";
+    }
+    constexpr size_t BATCH = 8 * STREAM_CHUNK;
+    hashing::Hasher whole(dsa::hashAlgorithm());
+    vector<chunker::ChunkRef> chunks;
+    string pending;
+    bool eof = false;
+    while (!eof || !pending.empty()) {
+        if (!eof) {
+            const size_t old = pending.size();
+            pending.resize(old + BATCH);
+            in.read(&pending[old], static_cast<streamsize>(BATCH));
+            const size_t n = static_cast<size_t>(in.gcount());
+            pending.resize(old + n);
+            whole.update(pending.data() + old, n);
+            if (in.bad()) {
+                utils::displayError(string("Cannot read file ")+path);
+                return "";
+            }
+            eof = n < BATCH;
+        }
 
+        // A cut is final once MAX_CHUNK bytes follow it (or the file has ended).
+        vector<pair<size_t, size_t>> spans;
+        size_t pos = 0;
+        while (pos < pending.size()) {
+            const size_t remaining = pending.size() - pos;
+            if (!eof && remaining < chunker::MAX_CHUNK) break;
+            const size_t length =
+                chunker::cutPoint(reinterpret_cast<const unsigned char *>(pending.data()) + pos, remaining);
+            spans.emplace_back(pos, length);
+            pos += length;
+        }
+        vector<string> hashes(spans.size());
+        utils::sharedPool().parallelFor(spans.size(), [&](size_t i) {
+            hashes[i] = IOManager::writeBlob(pending.substr(spans[i].first, spans[i].second));
+        });
+        for (size_t i = 0; i < spans.size(); ++i) chunks.push_back({std::move(hashes[i]), spans[i].second});
+        pending.erase(0, pos);
+    }
+
+    const string hash = whole.finalHex();
+    trace::count(trace::Counter::ObjectsHashed);
+    const string dir = IOManager::OBJECTS_DIR + "/" + hash.substr(0,2);
+    const string dest = dir + "/" + hash.substr(2);
+    if (!IOManager::fileExists(dest) && !packfile::contains(hash)) {
+        IOManager::createDir(dir);
+        IOManager::writeFileAtomic(dest, chunker::serializeManifest(chunks));
+    }
     return hash;
 }
 
+#ifdef MINIGIT_HAVE_COPY_FILE_RANGE
+// Appends size bytes from in to out inside the kernel, which shares extents
+// where the filesystem can. False if that is not possible here; out may then
+// hold part of them.
+bool kernelAppend(int in, int out, uint64_t size) {
+    uint64_t done = 0;
+    while (done < size) {
+        const ssize_t n = ::copy_file_range(in, nullptr, out, nullptr, size_t(size - done), 0);
+        if (n <= 0) return false;
+        done += uint64_t(n);
+    }
+    return true;
+}
+
+bool writeAll(int fd, const string &data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        const ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n <= 0) return false;
+        done += size_t(n);
+    }
+    trace::count(trace::Counter::BytesWritten, data.size());
+    return true;
+}
+#endif
+
+// True if content, stored under hash, is a chunk manifest, whose chunks are
+// then in chunks. A file that only starts like one is stored under the hash
+// of those very bytes, which a manifest never is.
+bool chunkManifest(const string &hash, const string &content, vector<chunker::ChunkRef> &chunks) {
+    if (!chunker::hasManifestHeader(content) || !chunker::parseManifest(content, chunks)) return false;
+    for (const auto &chunk : chunks) {
+        if (chunk.hash.size() != hash.size()) return false;
+    }
+    return dsa::computeSHA1(content) != hash;
+}
+
+// Writes chunks to dest one at a time. Loose chunks are appended inside the
+// kernel where it can; the rest are read and written.
+bool writeChunksTo(const vector<chunker::ChunkRef> &chunks, const string &dest) {
+#ifdef MINIGIT_HAVE_COPY_FILE_RANGE
+    int out = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    bool ok = out >= 0;
+    for (const auto &chunk : chunks) {
+        if (!ok) break;
+        const string path = IOManager::OBJECTS_DIR + "/" + chunk.hash.substr(0, 2) + "/" + chunk.hash.substr(2);
+        const off_t start = ::lseek(out, 0, SEEK_CUR);
+        int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        const bool appended = in >= 0 && kernelAppend(in, out, chunk.size);
+        if (in >= 0) ::close(in);
+        if (appended) {
+            trace::count(trace::Counter::BytesCloned, chunk.size);
+            continue;
+        }
+        ok = ::ftruncate(out, start) == 0 && ::lseek(out, start, SEEK_SET) == start &&
+             writeAll(out, IOManager::readBlob(chunk.hash));
+    }
+    if (out >= 0 && ::close(out) != 0) ok = false;
+#else
+    ofstream out(dest, ios::binary);
+    for (const auto &chunk : chunks) {
+        string data = IOManager::readBlob(chunk.hash);
+        if (!out.write(data.data(), static_cast<streamsize>(data.size()))) break;
+    }
+    const bool ok = static_cast<bool>(out);
+#endif
+    if (!ok) {
+        utils::displayError(string("Error writing to: ")+dest);
+        return false;
+    }
+    return true;
+}
+
+// True if "checkout_mode" in config is "hardlink": loose blobs are then
+// hard-linked into the working tree instead of cloned or copied
+bool hardlinkCheckout() {
+    static const bool hardlink = [] {
+        string value = IOManager::readConfig("checkout_mode");
+        if (value.empty() || value == "copy") return false;
+        if (value == "hardlink") return true;
+        utils::displayError("Invalid checkout_mode '" + value + "' in config, copying files.");
+        return false;
+    }();
+    return hardlink;
+}
+
+// True if the loose object at path, named hash, is a chunk manifest, which
+// is not the file's content and must be assembled instead. Only an object
+// with the manifest header is read whole.
+bool looseManifest(const string &hash, const string &path) {
+    ifstream in(path, ios::binary);
+    char head[16];
+    in.read(head, sizeof head);
+    string content(head, static_cast<size_t>(in.gcount()));
+    if (!chunker::hasManifestHeader(content)) return false;
+    content.append(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    vector<chunker::ChunkRef> chunks;
+    return chunkManifest(hash, content, chunks);
+}
+
+// Hard-links the loose object at src (named hash) to dest and removes its
+// write permission: the file is the object, so an edit in place would corrupt it.
+bool linkLoose(const string &hash, const string &src, const string &dest) {
+    if (!IOManager::fileExists(src) || looseManifest(hash, src)) return false;
+    error_code ec;
+    fs::create_hard_link(src, dest, ec);
+    if (ec) return false;
+    fs::permissions(dest, fs::perms::owner_write | fs::perms::group_write | fs::perms::others_write,
+                    fs::perm_options::remove, ec);
+    trace::count(trace::Counter::BytesCloned, fs::file_size(dest, ec));
+    return true;
+}
+
+// Creates dest as a copy of the loose object at src without moving the data
+// through user space: a reflink (FICLONE) sharing the extents on filesystems
+// that support it (btrfs, XFS), otherwise copy_file_range. False, leaving no
+// dest behind, if src is missing or neither call works here, or if it starts
+// like a manifest: the caller has to read it to tell.
+bool cloneLoose(const string &src, const string &dest) {
+#ifdef __linux__
+    int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    struct stat st;
+    char head[16];
+    const ssize_t headLen = ::pread(in, head, sizeof head, 0);
+    if (::fstat(in, &st) != 0 || headLen < 0 || chunker::hasManifestHeader(string(head, size_t(headLen)))) {
+        ::close(in);
+        return false;
+    }
+    int out = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (out < 0) {
+        ::close(in);
+        return false;
+    }
+
+    bool copied = false;
+#ifdef FICLONE
+    copied = ::ioctl(out, FICLONE, in) == 0;
+#endif
+#ifdef MINIGIT_HAVE_COPY_FILE_RANGE
+    if (!copied) copied = kernelAppend(in, out, uint64_t(st.st_size));
+#endif
+    ::close(in);
+    if (::close(out) != 0) copied = false;
+    if (!copied) {
+        ::unlink(dest.c_str());
+        return false;
+    }
+    trace::count(trace::Counter::FilesOpened, 2);
+    trace::count(trace::Counter::BytesCloned, uint64_t(st.st_size));
+    return true;
+#else
+    (void)src;
+    (void)dest;
+    return false;
+#endif
+}
+
+string assembleChunks(const vector<chunker::ChunkRef> &chunks) {
+    uint64_t total = 0;
+    for (const auto &chunk : chunks) total += chunk.size;
+    string content;
+    content.reserve(static_cast<size_t>(total));
+    for (const auto &chunk : chunks) content += IOManager::readBlob(chunk.hash);
+    return content;
+}
+}
+
+namespace {
+// Hashes the file at path in one call over a mapping of it, so large inputs
+// get the multi-threaded BLAKE3 tree hash; "" if it cannot be read
+string hashMapped(const string &path) {
+    MappedFile map(path);
+    error_code ec;
+    if (!map.valid() && fs::file_size(path, ec) != 0) {
+        utils::displayError(string("Cannot open file ")+path);
+        return "";
+    }
+    trace::count(trace::Counter::ObjectsHashed);
+    trace::count(trace::Counter::BytesHashed, map.size());
+    return hashing::digest(dsa::hashAlgorithm(), map.data(), map.size());
+}
+}
+
+string IOManager::writeBlobFromFile(const string &path) {
+    TRACE_SCOPE("io::writeBlobFromFile");
+    error_code ec;
+    const uintmax_t size = fs::file_size(path, ec);
+    if (!ec && size <= STREAM_CHUNK) return writeBlob(readFile(path));
+    if (!ec && chunkThreshold() > 0 && size >= chunkThreshold()) return writeChunkedBlob(path);
+
+    // The hash is only known once the data is in, so copy into a temporary
+    // object (outside the fan-out directories) and rename it once named. The
+    // copy is hashed rather than the file, which may change meanwhile.
+    const string tmp = tempPathFor(OBJECTS_DIR + "/incoming");
+    if (!cloneLoose(path, tmp)) {
+        ifstream in(path, ios::binary);
+        if (!in) {
+            utils::displayError(string("Cannot open file ")+path);
+            return "";
+        }
+        ofstream out(tmp, ios::binary);
+        trace::count(trace::Counter::FilesOpened, 2);
+        const bool copied = out && streamCopy(in, &out, nullptr);
+        out.close();
+        if (!copied || !out) {
+            fs::remove(tmp, ec);
+            utils::displayError(string("Error writing to: ")+tmp);
+            return "";
+        }
+    }
+
+    const string hash = hashMapped(tmp);
+    if (hash.empty()) {
+        fs::remove(tmp, ec);
+        return "";
+    }
+    const string dir = OBJECTS_DIR + "/" + hash.substr(0,2);
+    const string dest = dir + "/" + hash.substr(2);
+    if (fileExists(dest) || packfile::contains(hash)) {
+        fs::remove(tmp, ec);
+        return hash;
+    }
+    createDir(dir);
+    fs::rename(tmp, dest, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        utils::displayError(string("Error writing to: ")+dest);
+        return "";
+    }
+    return hash;
+}
+
+string IOManager::hashFile(const string &path) {
+    TRACE_SCOPE("io::hashFile");
+    ifstream in(path, ios::binary);
+    if (!in) {
+        utils::displayError(string("Cannot open file ")+path);
+        return "";
+    }
+    hashing::Hasher hasher(dsa::hashAlgorithm());
+    if (!streamCopy(in, nullptr, &hasher)) return "";
+    if (trace::enabled()) {
+        error_code ec;
+        const uintmax_t size = fs::file_size(path, ec);
+        trace::count(trace::Counter::FilesOpened);
+        trace::count(trace::Counter::ObjectsHashed);
+        if (!ec) trace::count(trace::Counter::BytesHashed, size);
+    }
+    return hasher.finalHex();
+}
+
+bool IOManager::readBlobToFile(const string &hash, const string &dest) {
+    TRACE_SCOPE("io::readBlobToFile");
+    // dest may be a hard link to an object from an earlier checkout; writing
+    // through it would change the object, so it is replaced, never rewritten.
+    error_code ec;
+    fs::remove(dest, ec);
+
+    // Loose blobs are stored as they are, so the filesystem can place them
+    // itself; the data is only copied here where it cannot.
+    const string path = OBJECTS_DIR + "/" + hash.substr(0,2) +"/"+hash.substr(2);
+    auto cached = objectCache().get(hash);
+    vector<chunker::ChunkRef> chunks;
+    if (hardlinkCheckout() && linkLoose(hash, path, dest)) return true;
+    if (cached) {
+        return chunkManifest(hash, *cached, chunks) ? writeChunksTo(chunks, dest) : writeFile(dest, *cached);
+    }
+    if (cloneLoose(path, dest)) return true;
+
+    ifstream in(path, ios::binary);
+    if (in) {
+        // Manifests are small and read whole; file data is streamed.
+        char head[16];
+        in.read(head, sizeof head);
+        string prefix(head, static_cast<size_t>(in.gcount()));
+        if (chunker::hasManifestHeader(prefix)) {
+            string content = prefix + string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+            return chunkManifest(hash, content, chunks) ? writeChunksTo(chunks, dest) : writeFile(dest, content);
+        }
+        in.clear();
+        in.seekg(0);
+        ofstream out(dest, ios::binary);
+        if (!out || !streamCopy(in, &out, nullptr)) {
+            utils::displayError(string("Error writing to: ")+dest);
+            return false;
+        }
+        return true;
+    }
+    // Packed objects may be deltas and are rebuilt in memory.
+    string content;
+    if (packfile::readObject(hash, content)) {
+        return chunkManifest(hash, content, chunks) ? writeChunksTo(chunks, dest) : writeFile(dest, content);
+    }
+
+    utils::displayError(string("Cannot open file ")+path);
+    return false;
+}
+
+bool IOManager::readChunkList(const string &hash, vector<string> &chunks) {
+    chunks.clear();
+    string content;
+    if (auto cached = objectCache().get(hash)) {
+        content = chunker::hasManifestHeader(*cached) ? *cached : "";
+    } else {
+        const string path = OBJECTS_DIR + "/" + hash.substr(0,2) +"/"+hash.substr(2);
+        ifstream in(path, ios::binary);
+        if (in) {
+            trace::count(trace::Counter::FilesOpened);
+            char head[16];
+            in.read(head, sizeof head);
+            content.assign(head, static_cast<size_t>(in.gcount()));
+            if (!chunker::hasManifestHeader(content)) return true;
+            content.append(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        } else if (!packfile::readObject(hash, content)) {
+            return false;
+        }
+    }
+    vector<chunker::ChunkRef> refs;
+    if (!chunkManifest(hash, content, refs)) return true;
+    for (auto &chunk : refs) chunks.push_back(std::move(chunk.hash));
+    return true;
+}
+
 string IOManager::readBlob(const string &hash) {
-    return readFile(OBJECTS_DIR + "/" + hash.substr(0,2) +"/"+hash.substr(2));
+    TRACE_SCOPE("io::readBlob");
+    const string path = OBJECTS_DIR + "/" + hash.substr(0,2) +"/"+hash.substr(2);
+    string content;
+    vector<chunker::ChunkRef> chunks;
+    if (loadObject(hash, path, content)) return chunkManifest(hash, content, chunks) ? assembleChunks(chunks) : content;
+
+    utils::displayError(string("Cannot open file ")+path);
+    return "";
 }
 
 // Commit Metadata
@@ -100,77 +828,610 @@ bool IOManager::writeCommit(const string &hash, const string &data) {
 }
 
 string IOManager::readCommit(const string &hash) {
-    return readFile(COMMITS_DIR + "/" + hash);
+    auto data = readCommitBuffer(hash);
+    return data ? *data : "";
+}
+
+shared_ptr<const string> IOManager::readCommitBuffer(const string &hash) {
+    const string path = COMMITS_DIR + "/" + hash;
+    auto data = loadShared(hash, path);
+    if (!data) utils::displayError(string("Cannot open file ")+path);
+    return data;
+}
+
+bool IOManager::hasCommit(const string &hash) {
+    if (hash.empty()) return false;
+    if (commitCache().get(hash)) return true;
+    return fileExists(COMMITS_DIR + "/" + hash) || packfile::contains(hash);
+}
+
+// Object Cache
+
+void IOManager::setCacheBudget(size_t bytes) {
+    objectCache().setBudget(bytes / 4 * 3);
+    commitCache().setBudget(bytes / 4);
+}
+
+utils::LruCache<string>::Stats IOManager::objectCacheStats() {
+    return objectCache().stats();
+}
+
+utils::LruCache<FileMap>::Stats IOManager::commitCacheStats() {
+    return commitCache().stats();
+}
+
+shared_ptr<const FileMap> IOManager::cachedCommitFiles(const string &hash) {
+    return commitCache().get(hash);
+}
+
+void IOManager::cacheCommitFiles(const string &hash, shared_ptr<const FileMap> files) {
+    commitCache().put(hash, std::move(files));
 }
 
 // Reference Management
+//
+// packed-refs: a "# minigit packed-refs" line, then one "<hash> <name>" line
+// per branch, sorted by name, so a lookup bisects the mapped file instead of
+// reading it. Loose files in refs/heads override packed entries.
+
+namespace {
+const string PACKED_REFS_HEADER = "# minigit packed-refs\n";
+
+const char *lineEnd(const char *p, const char *end) {
+    const void *newline = memchr(p, '\n', static_cast<size_t>(end - p));
+    return newline ? static_cast<const char *>(newline) : end;
+}
+
+// Name and hash of the record starting at line
+pair<string_view, string_view> parseRefLine(const char *line, const char *eol) {
+    string_view text(line, static_cast<size_t>(eol - line));
+    size_t space = text.find(' ');
+    if (space == string_view::npos) return {string_view(), string_view()};
+    return {text.substr(space + 1), text.substr(0, space)};
+}
+
+// The records of a packed-refs file, with the header skipped
+pair<const char *, const char *> packedRecords(const MappedFile &file) {
+    const char *begin = file.data(), *end = file.data() + file.size();
+    while (begin < end && *begin == '#') begin = min(lineEnd(begin, end) + 1, end);
+    return {begin, end};
+}
+
+// First record whose name is not less than key. lo and hi always sit at the
+// start of a line; each probe backs up from the midpoint to its line start.
+const char *lowerBound(const char *lo, const char *hi, string_view key) {
+    while (lo < hi) {
+        const char *mid = lo + (hi - lo) / 2;
+        while (mid > lo && mid[-1] != '\n') --mid;
+        const char *eol = lineEnd(mid, hi);
+        if (parseRefLine(mid, eol).first < key) lo = min(eol + 1, hi);
+        else hi = mid;
+    }
+    return lo;
+}
+
+bool readPackedRef(const string &name, string &hash) {
+    MappedFile file(IOManager::PACKED_REFS_FILE);
+    if (!file.data()) return false;
+    auto [begin, end] = packedRecords(file);
+    const char *line = lowerBound(begin, end, name);
+    if (line >= end) return false;
+    auto [found, value] = parseRefLine(line, lineEnd(line, end));
+    if (found != name) return false;
+    hash.assign(value);
+    return true;
+}
+
+string looseRefPath(const string &name) {
+    return IOManager::REFS_HEADS_DIR + "/" + name;
+}
+
+// Current value of a branch, loose first; false if it does not exist
+bool lookupReference(const string &name, string &hash) {
+    string content;
+    if (readIfPresent(looseRefPath(name), content)) {
+        hash = utils::trim(content);
+        return true;
+    }
+    return readPackedRef(name, hash);
+}
+
+// An exclusively created lock file next to path. Whoever creates it owns the
+// update; everyone else fails instead of waiting.
+class RefLock {
+public:
+    explicit RefLock(const string &path) : path_(path), lockPath_(path + ".lock") {
+        error_code ec;
+        fs::create_directories(fs::path(path).parent_path(), ec);
+        file_ = fopen(lockPath_.c_str(), "wx");
+        owned_ = file_ != nullptr;
+    }
+    ~RefLock() {
+        if (file_) fclose(file_);
+        if (owned_) remove(lockPath_.c_str());
+    }
+    RefLock(const RefLock &) = delete;
+    RefLock &operator=(const RefLock &) = delete;
+
+    bool held() const { return owned_; }
+
+    // Writes content to the lock file and renames it over path
+    bool commit(const string &content) {
+        if (!file_) return false;
+        bool ok = fwrite(content.data(), 1, content.size(), file_) == content.size();
+        ok = fclose(file_) == 0 && ok;
+        file_ = nullptr;
+        error_code ec;
+        if (ok) fs::rename(lockPath_, path_, ec);
+        if (!ok || ec) return false; // the destructor removes the lock
+        owned_ = false;
+        return true;
+    }
+
+private:
+    string path_;
+    string lockPath_;
+    FILE *file_ = nullptr;
+    bool owned_ = false;
+};
+
+bool isLockName(const string &name) {
+    return name.size() >= 5 && name.compare(name.size() - 5, 5, ".lock") == 0;
+}
+
+void lockFailure(const string &path) {
+    utils::displayError("Cannot lock " + path + ".lock (another update is running, or one was interrupted)");
+}
+}
 
 bool IOManager::writeReference(const string &refName, const string &hash) {
     if (refName == "HEAD") {
         return writeFile(HEAD_FILE, hash);
     }
-    return writeFile(REFS_HEADS_DIR + "/" + refName, hash);
+    return writeFileAtomic(looseRefPath(refName), hash);
 }
 
-string IOManager::readReference(const string &refName) {
-    if (refName == "HEAD") {
-        string headRef = readFile(HEAD_FILE);
-        if (headRef.find("ref: ") == 0) {
-            // Trim the symbolic reference to remove any extra whitespace or newlines.
-            string branchPath = utils::trim(headRef.substr(5));
-            // Use MINIGIT_DIR constant so the path becomes ".minigit/refs/heads/main"
-            return readFile(MINIGIT_DIR + "/" + branchPath);
-        }
-        return headRef;  // Detached HEAD mode
+bool IOManager::updateReference(const string &refName, const string &expected, const string &hash) {
+    TRACE_SCOPE("io::updateReference");
+    const string path = looseRefPath(refName);
+    RefLock lock(path);
+    if (!lock.held()) {
+        lockFailure(path);
+        return false;
     }
-    return readFile(REFS_HEADS_DIR + "/" + refName);
+    string current;
+    lookupReference(refName, current);
+    if (current != expected) {
+        utils::displayError("Branch '" + refName + "' was moved by another update (expected " +
+                            (expected.empty() ? "no commit" : expected.substr(0, 7)) + ", found " +
+                            (current.empty() ? "no commit" : current.substr(0, 7)) + ")");
+        return false;
+    }
+    return lock.commit(hash);
+}
+
+string IOManager::readReference(const string &refName) {
+    if (refName == "HEAD") return resolveHEAD();
+    string hash;
+    lookupReference(refName, hash);
+    return hash;
+}
+
+bool IOManager::hasReference(const string &refName) {
+    string hash;
+    return !refName.empty() && lookupReference(refName, hash);
 }
 
 std::string IOManager::resolveHEAD() {
     std::string headContent = readFile(HEAD_FILE);
     if (headContent.rfind("ref:", 0) == 0) {
-        std::string refPath = utils::trim(headContent.substr(5)); // trim any extra whitespace/newlines
+        std::string refPath = utils::trim(headContent.substr(4)); // trim any extra whitespace/newlines
+        const std::string heads = "refs/heads/";
+        if (refPath.rfind(heads, 0) == 0) return readReference(refPath.substr(heads.size()));
         return readFile(MINIGIT_DIR + "/" + refPath);
     }
     return headContent; // detached mode
 }
 
+vector<pair<string, string>> IOManager::listReferences(const string &prefix) {
+    TRACE_SCOPE("io::listReferences");
+    map<string, string> refs;
+
+    // Packed names in [prefix, prefix + 1) are one contiguous run.
+    MappedFile packed(PACKED_REFS_FILE);
+    if (packed.data()) {
+        auto [begin, end] = packedRecords(packed);
+        for (const char *line = lowerBound(begin, end, prefix); line < end;) {
+            const char *eol = lineEnd(line, end);
+            auto [name, hash] = parseRefLine(line, eol);
+            if (name.compare(0, prefix.size(), prefix) != 0) break;
+            if (!name.empty()) refs[string(name)] = string(hash);
+            line = eol + 1;
+        }
+    }
+
+    // Only the directory the prefix names needs scanning for loose refs.
+    const size_t slash = prefix.rfind('/');
+    const string dir = slash == string::npos ? "" : prefix.substr(0, slash + 1);
+    error_code ec;
+    for (auto it = fs::recursive_directory_iterator(REFS_HEADS_DIR + "/" + dir, ec);
+         !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (!it->is_regular_file()) continue;
+        const string name = dir + normalizePath(fs::relative(it->path(), REFS_HEADS_DIR + "/" + dir).string());
+        if (name.rfind(prefix, 0) != 0 || isLockName(name)) continue;
+        string content;
+        if (readIfPresent(it->path().string(), content)) refs[name] = utils::trim(content);
+    }
+
+    vector<pair<string, string>> result;
+    for (auto &[name, hash] : refs) {
+        if (!hash.empty()) result.emplace_back(name, std::move(hash)); // unborn branches have no commit yet
+    }
+    return result;
+}
+
+int IOManager::packReferences() {
+    TRACE_SCOPE("io::packReferences");
+    RefLock packedLock(PACKED_REFS_FILE);
+    if (!packedLock.held()) {
+        lockFailure(PACKED_REFS_FILE);
+        return -1;
+    }
+
+    map<string, string> refs;
+    {
+        MappedFile packed(PACKED_REFS_FILE);
+        if (packed.data()) {
+            auto [begin, end] = packedRecords(packed);
+            for (const char *line = begin; line < end;) {
+                const char *eol = lineEnd(line, end);
+                auto [name, hash] = parseRefLine(line, eol);
+                if (!name.empty()) refs[string(name)] = string(hash);
+                line = eol + 1;
+            }
+        }
+    }
+    map<string, string> loose;
+    for (auto &[name, hash] : listReferences()) {
+        string content;
+        if (readIfPresent(looseRefPath(name), content)) loose[name] = hash;
+        refs[name] = std::move(hash);
+    }
+
+    string content = PACKED_REFS_HEADER;
+    for (const auto &[name, hash] : refs) content += hash + " " + name + "\n";
+    if (!packedLock.commit(content)) {
+        utils::displayError("Cannot write " + PACKED_REFS_FILE);
+        return -1;
+    }
+
+    // A loose ref is only dropped if nobody moved it since it was packed.
+    int packedCount = 0;
+    for (const auto &[name, hash] : loose) {
+        const string path = looseRefPath(name);
+        error_code ec;
+        {
+            RefLock lock(path);
+            string current;
+            if (!lock.held() || !readIfPresent(path, current) || utils::trim(current) != hash) continue;
+            if (fs::remove(path, ec)) ++packedCount;
+        }
+        for (fs::path dir = fs::path(path).parent_path(); dir != fs::path(REFS_HEADS_DIR) && fs::is_empty(dir, ec);
+             dir = dir.parent_path()) {
+            fs::remove(dir, ec);
+        }
+    }
+    return packedCount;
+}
+
 // Staging Area (Index)
+//
+// Binary layout: "MGIX" | uint32 version | uint32 entry count | uint32 reserved,
+// then per entry (sorted by path):
+//   int64 mtime ns | uint64 size | uint64 inode | uint16 path length |
+//   uint8 hash length | uint8 flags | path bytes | hash bytes
+// Version 3 holds the whole snapshot to commit and ends with the cached trees:
+//   "TREE" | uint32 count, then per directory (sorted by path):
+//   uint16 path length | uint8 hash length | path bytes | hash bytes
+// Version 2 indexes and the older "name:hash" text lines only hold the paths
+// staged since the last commit.
 
-bool IOManager::updateIndex(const vector<pair<string, string>> &entries) {
-    ostringstream content;
-    for (const auto &[filename, hash] : entries) {
-        content << filename << ":" << hash << "\n";
+namespace {
+const char INDEX_MAGIC[4] = {'M', 'G', 'I', 'X'};
+const char TREE_MAGIC[4] = {'T', 'R', 'E', 'E'};
+const uint32_t INDEX_VERSION = 3;
+const size_t INDEX_HEADER_SIZE = 16;
+const size_t INDEX_ENTRY_FIXED = 8 + 8 + 8 + 2 + 1 + 1;
+
+template <typename T>
+void putRaw(string &out, T value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+T getRaw(const char *p) {
+    T value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+vector<IndexEntry> parseTextIndex(const char *data, size_t size) {
+    vector<IndexEntry> entries;
+    istringstream iss(string(data, size));
+    string line;
+    while (getline(iss, line)) {
+        size_t pos = line.find(':');
+        if (pos != string::npos) {
+            IndexEntry entry;
+            entry.path = line.substr(0, pos);
+            entry.hash = line.substr(pos + 1);
+            entries.push_back(std::move(entry));
+        }
     }
-    return writeFile(INDEX_FILE, content.str());
+    return entries;
 }
 
+int64_t nowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+               chrono::system_clock::now().time_since_epoch()).count();
+}
 
-vector<pair<string, string>> IOManager::readIndex() {
-    vector<pair<string, string>> entries;
-    
-    if (!fileExists(INDEX_FILE)) {
-        return entries;  // Empty staging area
+void parseCacheTree(const char *p, const char *end, CacheTree &trees) {
+    if (size_t(end - p) < 8 || memcmp(p, TREE_MAGIC, 4) != 0) return;
+    uint32_t count = getRaw<uint32_t>(p + 4);
+    p += 8;
+    for (uint32_t i = 0; i < count && size_t(end - p) >= 3; ++i) {
+        uint16_t pathLen = getRaw<uint16_t>(p);
+        uint8_t hashLen = getRaw<uint8_t>(p + 2);
+        p += 3;
+        if (size_t(end - p) < size_t(pathLen) + hashLen) break;
+        trees.emplace(string(p, pathLen), string(p + pathLen, hashLen));
+        p += pathLen + hashLen;
     }
+}
 
-    try {
-        string indexContent = readFile(INDEX_FILE);
-        istringstream iss(indexContent);
-        string line;
-        
-        while (getline(iss, line)) {
-            size_t pos = line.find(':');
-            if (pos != string::npos) {
-                entries.emplace_back(
-                    line.substr(0, pos),
-                    line.substr(pos + 1)
-                );
+// Loads the index file into index (the caller holds its guard)
+void loadIndexFile(CachedIndex &index) {
+    index.entries.clear();
+    index.trees.clear();
+    index.snapshot = true;
+    MappedFile map(IOManager::INDEX_FILE);
+    if (!map.valid() || map.size() == 0) {
+        return;  // Empty staging area
+    }
+
+    const char *p = map.data();
+    const char *end = p + map.size();
+    if (map.size() < INDEX_HEADER_SIZE || memcmp(p, INDEX_MAGIC, 4) != 0) {
+        index.entries = parseTextIndex(p, map.size());
+        sort(index.entries.begin(), index.entries.end(),
+             [](const IndexEntry &a, const IndexEntry &b) { return a.path < b.path; });
+        index.snapshot = false;
+        return;
+    }
+    uint32_t version = getRaw<uint32_t>(p + 4);
+    if (version != 2 && version != INDEX_VERSION) {
+        utils::displayError("Unsupported index version.");
+        return;
+    }
+    index.snapshot = version == INDEX_VERSION;
+
+    uint32_t count = getRaw<uint32_t>(p + 8);
+    index.entries.reserve(count);
+    p += INDEX_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (size_t(end - p) < INDEX_ENTRY_FIXED) break;
+        IndexEntry entry;
+        entry.mtimeNs = getRaw<int64_t>(p);
+        entry.size = getRaw<uint64_t>(p + 8);
+        entry.inode = getRaw<uint64_t>(p + 16);
+        uint16_t pathLen = getRaw<uint16_t>(p + 24);
+        uint8_t hashLen = getRaw<uint8_t>(p + 26);
+        p += INDEX_ENTRY_FIXED;
+        if (size_t(end - p) < size_t(pathLen) + hashLen) break;
+        entry.path.assign(p, pathLen);
+        entry.hash.assign(p + pathLen, hashLen);
+        p += pathLen + hashLen;
+        index.entries.push_back(std::move(entry));
+    }
+    if (index.entries.size() != count) {
+        utils::displayError("Error reading index file.");
+        return;
+    }
+    if (index.snapshot) parseCacheTree(p, end, index.trees);
+}
+
+// Writes index to the index file and remembers the file it wrote (the caller
+// holds its guard)
+bool storeIndexFile(CachedIndex &index) {
+    string out;
+    out.append(INDEX_MAGIC, 4);
+    putRaw<uint32_t>(out, INDEX_VERSION);
+    putRaw<uint32_t>(out, static_cast<uint32_t>(index.entries.size()));
+    putRaw<uint32_t>(out, 0);
+    for (const auto &entry : index.entries) {
+        putRaw<int64_t>(out, entry.mtimeNs);
+        putRaw<uint64_t>(out, entry.size);
+        putRaw<uint64_t>(out, entry.inode);
+        putRaw<uint16_t>(out, static_cast<uint16_t>(entry.path.size()));
+        putRaw<uint8_t>(out, static_cast<uint8_t>(entry.hash.size()));
+        putRaw<uint8_t>(out, 0);
+        out += entry.path;
+        out += entry.hash;
+    }
+    out.append(TREE_MAGIC, 4);
+    putRaw<uint32_t>(out, static_cast<uint32_t>(index.trees.size()));
+    for (const auto &[dir, hash] : index.trees) {
+        putRaw<uint16_t>(out, static_cast<uint16_t>(dir.size()));
+        putRaw<uint8_t>(out, static_cast<uint8_t>(hash.size()));
+        out += dir;
+        out += hash;
+    }
+
+    index.dirty = false;
+    bool stored = IOManager::writeFileAtomic(IOManager::INDEX_FILE, out);
+    index.stamp = IndexEntry();
+    IOManager::statFile(IOManager::INDEX_FILE, index.stamp);
+    return stored;
+}
+
+// Re-reads the index file unless the copy in memory is still current: it was
+// loaded from or written to the same file, or holds writes not yet saved
+void refreshIndex(CachedIndex &index) {
+    IndexEntry current;
+    IOManager::statFile(IOManager::INDEX_FILE, current);
+    if (index.loaded && (index.dirty || sameIndexFile(index.stamp, current))) return;
+    loadIndexFile(index);
+    index.stamp = current;
+    index.loaded = true;
+}
+
+// Forgets the cached tree of every directory above path
+void invalidateTrees(CacheTree &trees, const string &path) {
+    trees.erase("");
+    for (size_t slash = path.find('/'); slash != string::npos; slash = path.find('/', slash + 1)) {
+        trees.erase(path.substr(0, slash));
+    }
+}
+
+// Replaces the entries of index (the caller holds its guard); both sides are
+// sorted by path. Stat-only changes leave the cached trees alone.
+bool replaceIndex(CachedIndex &index, vector<IndexEntry> entries, const CacheTree *trees) {
+    // A file changed again within the timestamp granularity of its last stat
+    // would look clean; forget the stat data of such "racily clean" entries.
+    const int64_t racyCutoff = nowNs() - 2'000'000'000LL;
+    for (auto &entry : entries) {
+        if (entry.mtimeNs >= racyCutoff) entry.mtimeNs = 0;
+    }
+
+    refreshIndex(index);
+    if (trees) {
+        index.trees = *trees;
+    } else {
+        auto a = index.entries.begin();
+        auto b = entries.begin();
+        while (a != index.entries.end() || b != entries.end()) {
+            if (b == entries.end() || (a != index.entries.end() && a->path < b->path)) {
+                invalidateTrees(index.trees, (a++)->path);
+            } else if (a == index.entries.end() || b->path < a->path) {
+                invalidateTrees(index.trees, (b++)->path);
+            } else {
+                if (a->hash != b->hash) invalidateTrees(index.trees, a->path);
+                ++a;
+                ++b;
             }
         }
-    } catch (...) {
-        utils::displayError("Error reading index file.");
-        return entries;
     }
-    
+    index.entries = std::move(entries);
+    index.snapshot = true;
+    index.loaded = true;
+    index.dirty = true;
+    return index.held || storeIndexFile(index);
+}
+
+void sortByPath(vector<IndexEntry> &entries) {
+    sort(entries.begin(), entries.end(),
+         [](const IndexEntry &a, const IndexEntry &b) { return a.path < b.path; });
+}
+}
+
+bool IOManager::updateIndex(const vector<pair<string, string>> &entries) {
+    vector<IndexEntry> converted;
+    converted.reserve(entries.size());
+    for (const auto &[filename, hash] : entries) {
+        IndexEntry entry;
+        entry.path = filename;
+        entry.hash = hash;
+        converted.push_back(std::move(entry));
+    }
+    return writeIndexEntries(std::move(converted));
+}
+
+vector<pair<string, string>> IOManager::readIndex() {
+    vector<pair<string, string>> entries;
+    for (auto &entry : readIndexEntries()) {
+        entries.emplace_back(std::move(entry.path), std::move(entry.hash));
+    }
     return entries;
 }
+
+vector<IndexEntry> IOManager::readIndexEntries() {
+    TRACE_SCOPE("io::readIndex");
+    lock_guard<mutex> lock(indexCache.guard);
+    refreshIndex(indexCache);
+    return indexCache.entries;
+}
+
+CacheTree IOManager::readCacheTree() {
+    lock_guard<mutex> lock(indexCache.guard);
+    refreshIndex(indexCache);
+    return indexCache.trees;
+}
+
+bool IOManager::indexIsSnapshot() {
+    lock_guard<mutex> lock(indexCache.guard);
+    refreshIndex(indexCache);
+    return indexCache.snapshot;
+}
+
+bool IOManager::writeIndexEntries(vector<IndexEntry> entries) {
+    TRACE_SCOPE("io::writeIndex");
+    sortByPath(entries);
+    lock_guard<mutex> lock(indexCache.guard);
+    return replaceIndex(indexCache, std::move(entries), nullptr);
+}
+
+bool IOManager::writeIndexEntries(vector<IndexEntry> entries, const CacheTree &trees) {
+    TRACE_SCOPE("io::writeIndex");
+    sortByPath(entries);
+    lock_guard<mutex> lock(indexCache.guard);
+    return replaceIndex(indexCache, std::move(entries), &trees);
+}
+
+bool IOManager::holdIndex(bool hold) {
+    bool flushed = flushIndex();
+    lock_guard<mutex> lock(indexCache.guard);
+    indexCache.held = hold;
+    indexCache.loaded = false;
+    indexCache.entries.clear();
+    indexCache.trees.clear();
+    return flushed;
+}
+
+bool IOManager::flushIndex() {
+    lock_guard<mutex> lock(indexCache.guard);
+    if (!indexCache.dirty) return true;
+    return storeIndexFile(indexCache);
+}
+
+bool IOManager::statFile(const string &path, IndexEntry &entry) {
+#ifdef MINIGIT_HAVE_MMAP
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return false;
+#ifdef __APPLE__
+    entry.mtimeNs = int64_t(st.st_mtimespec.tv_sec) * 1'000'000'000LL + st.st_mtimespec.tv_nsec;
+#else
+    entry.mtimeNs = int64_t(st.st_mtim.tv_sec) * 1'000'000'000LL + st.st_mtim.tv_nsec;
+#endif
+    entry.size = static_cast<uint64_t>(st.st_size);
+    entry.inode = static_cast<uint64_t>(st.st_ino);
+    return true;
+#else
+    error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (ec) return false;
+    auto mtime = fs::last_write_time(path, ec);
+    if (ec) return false;
+    entry.mtimeNs = chrono::duration_cast<chrono::nanoseconds>(mtime.time_since_epoch()).count();
+    entry.size = size;
+    entry.inode = 0;
+    return true;
+#endif
+}
+
+bool IOManager::statMatches(const IndexEntry &cached, const IndexEntry &current) {
+    return cached.mtimeNs != 0 && !cached.hash.empty() &&
+           cached.mtimeNs == current.mtimeNs &&
+           cached.size == current.size &&
+           cached.inode == current.inode;
+}
@@ -6,10 +6,55 @@
 #include <utility>
 #include <fstream>
 #include <sstream>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include "lrucache.hpp"
 
 using namespace std;
 namespace fs = std::filesystem;
 
+using FileMap = map<string, string>; // path -> blob hash
+using CacheTree = map<string, string>; // directory ("" for the root) -> tree hash
+
+// Read-only view of a whole file. Uses mmap where available and falls back
+// to reading the file into memory elsewhere.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    explicit MappedFile(const string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool valid() const { return data_ != nullptr; }
+
+private:
+    void release();
+
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    string buffer_; // only used when mmap is unavailable
+};
+
+// One staged path plus the stat data it had when it was hashed, so unchanged
+// files can be recognised without reading them again.
+struct IndexEntry
+{
+    string path;
+    string hash;
+    int64_t mtimeNs = 0; // 0 means "unknown, always rehash"
+    uint64_t size = 0;
+    uint64_t inode = 0;
+};
+
 class IOManager
 {
 public:
@@ -18,13 +63,19 @@ public:
     //Constants
     inline static const std::string MINIGIT_DIR = ".minigit";
     inline static const std::string OBJECTS_DIR = MINIGIT_DIR + "/objects";
+    inline static const std::string PACK_DIR = OBJECTS_DIR + "/pack";
     inline static const std::string COMMITS_DIR = MINIGIT_DIR + "/commits";
     inline static const std::string REFS_HEADS_DIR = MINIGIT_DIR + "/refs/heads";
     inline static const std::string HEAD_FILE = MINIGIT_DIR + "/HEAD";
     inline static const std::string INDEX_FILE = MINIGIT_DIR + "/index";
+    inline static const std::string COMMIT_GRAPH_FILE = MINIGIT_DIR + "/commit-graph";
+    inline static const std::string CONFIG_FILE = MINIGIT_DIR + "/config";
+    inline static const std::string MERGE_HEAD_FILE = MINIGIT_DIR + "/MERGE_HEAD";
+    inline static const std::string CHERRY_PICK_HEAD_FILE = MINIGIT_DIR + "/CHERRY_PICK_HEAD";
+    inline static const std::string PACKED_REFS_FILE = MINIGIT_DIR + "/packed-refs";
 
-    // Creates the .minigit directory structure
-    static bool initMinigitDir();
+    // Creates the .minigit directory structure, recording the hash algorithm in config
+    static bool initMinigitDir(const string &hashAlgorithm);
     // Creates a directory at the given path (including parents)
     static bool createDir(const string &path);
 
@@ -33,34 +84,113 @@ public:
     static string readFile(const string &path);
     // Writes the given content to a file, overwriting if it exists
     static bool writeFile(const string &path, const string &content);
+    // Writes to a unique temporary file and renames it over path, so readers
+    // (and concurrent writers of the same object) never see a partial file
+    static bool writeFileAtomic(const string &path, const string &content);
+    // Unique sibling name for writing path before renaming it into place
+    static string tempPathFor(const string &path);
     // Copies a file from src to dest, returns success
     static bool copyFile(const string &src, const string &dest);
     // Checks if a file or directory exists at the path
     static bool fileExists(const string &path);
+    // Recursively lists regular files under root (or root itself if it is a
+    // file) as normalized relative paths, sorted. Directories are walked in
+    // parallel on the shared pool; .minigit is skipped.
+    static vector<string> listFiles(const string &root);
+    // Normalizes a path to the relative, '/'-separated form used in the index
+    static string normalizePath(const string &path);
+
+    // Repository Config (.minigit/config, "key = value" lines)
+    // Returns the value for key, or an empty string if unset
+    static string readConfig(const string &key);
+    // Sets key to value, keeping the other entries
+    static bool writeConfig(const string &key, const string &value);
 
     // Blob Storage 
     // Writes content as a blob in objects/ and returns its SHA-1 hash
     static string writeBlob(const string &content);
-    // Reads a blob's content by its hash
+    // Reads a blob's content by its hash (loose objects first, then packs),
+    // reassembling chunked blobs
     static string readBlob(const string &hash);
+    // Stores the file at path as a blob, hashing it while copying it in fixed-size
+    // chunks to a temporary object that is then renamed; returns the hash ("" on error).
+    // Files of at least "chunk_min_mb" (config) are stored as deduplicated chunks.
+    static string writeBlobFromFile(const string &path);
+    // Hashes the file at path in fixed-size chunks, the way writeBlobFromFile would
+    static string hashFile(const string &path);
+    // Writes a blob's content to dest, streaming loose objects chunk by chunk
+    static bool readBlobToFile(const string &hash, const string &dest);
+    // The chunks a chunked blob is stored as, or none for an ordinary blob (of
+    // which only the first bytes are read). False if the blob is missing.
+    static bool readChunkList(const string &hash, vector<string> &chunks);
 
     // Commit Metadata 
     // Writes commit data (parent, tree, timestamp, message) under objects/
     static bool writeCommit(const string &hash, const string &data);
-    // Reads commit data by its hash
+    // Reads commit data by its hash (loose commits first, then packs)
     static string readCommit(const string &hash);
+    // Same, but shares the cached buffer instead of copying it (nullptr if missing)
+    static shared_ptr<const string> readCommitBuffer(const string &hash);
+    // Checks whether a commit exists, loose or packed
+    static bool hasCommit(const string &hash);
 
+    // Object Cache
+    // Objects are immutable, so reads are served from sharded LRU caches: one
+    // for raw objects (blobs, trees, commits) and one for parsed commit file
+    // lists. Both share a memory budget, "cache_mb" in config (default 64 MiB).
+    static void setCacheBudget(size_t bytes);
+    static utils::LruCache<string>::Stats objectCacheStats();
+    static utils::LruCache<FileMap>::Stats commitCacheStats();
+    // Returns a commit's parsed file list if it is cached, or nullptr
+    static shared_ptr<const FileMap> cachedCommitFiles(const string &hash);
+    static void cacheCommitFiles(const string &hash, shared_ptr<const FileMap> files);
   
+    // Branches are loose files in refs/heads/ or lines in packed-refs, a
+    // sorted file that lookups bisect; a loose branch overrides a packed one.
     // Writes a branch or HEAD reference to refs/heads/
     static bool writeReference(const string &refName, const string &hash);
-    // Reads a branch or HEAD reference from refs/heads/
+    // Compare-and-swap: moves a branch from expected ("" for a branch with no
+    // commit yet) to hash under refs/heads/<name>.lock. Fails, leaving it
+    // alone, if the branch holds anything else or another update has the lock.
+    static bool updateReference(const string &refName, const string &expected, const string &hash);
+    // Reads a branch (loose, then packed) or HEAD; "" if it does not exist
     static string readReference(const string &refName);
+    static bool hasReference(const string &refName);
+    // Branches whose names start with prefix, with their commits, sorted by name
+    static vector<pair<string, string>> listReferences(const string &prefix = "");
+    // Moves every loose branch into packed-refs; returns how many (-1 on error)
+    static int packReferences();
     //Gets Head information 
     static std::string resolveHEAD();
 
     // Staging Area (Index)
+    // The index holds the whole snapshot the next commit records, plus the
+    // tree hash of every directory in it that has not changed since its tree
+    // was last written (the cache-tree).
     // Saves the staging entries (filename: hash pairs) to .minigit/index
     static bool updateIndex(const vector<pair<string, string>> &entries);
     // Loads staging entries from .minigit/index into a vector of pairs
     static vector<pair<string, string>> readIndex();
+    // Loads the index with its stat cache, sorted by path (reads legacy text indexes too)
+    static vector<IndexEntry> readIndexEntries();
+    // The cached trees that are still valid
+    static CacheTree readCacheTree();
+    // False for an index written before snapshots, which only holds the paths
+    // staged since the last commit
+    static bool indexIsSnapshot();
+    // Atomically replaces the index with the given entries, in binary form.
+    // Cached trees above paths that were added, removed or rehashed are dropped.
+    static bool writeIndexEntries(vector<IndexEntry> entries);
+    // Same, replacing the cached trees with trees
+    static bool writeIndexEntries(vector<IndexEntry> entries, const CacheTree &trees);
+    // While held, the index is kept in memory and only re-read if another
+    // process replaces the file; writes update the in-memory copy and reach
+    // .minigit/index when the hold is released or flushIndex is called. Used
+    // by batch and daemon mode. Returns false if the final write failed.
+    static bool holdIndex(bool hold);
+    static bool flushIndex();
+    // Fills the stat fields of entry from the file at path
+    static bool statFile(const string &path, IndexEntry &entry);
+    // True if the cached stat data still describes the file (its hash can be trusted)
+    static bool statMatches(const IndexEntry &cached, const IndexEntry &current);
 };
@@ -0,0 +1,155 @@
+#ifndef LRUCACHE_HPP
+#define LRUCACHE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace utils {
+
+// Thread-safe LRU cache bounded by total weight (normally bytes). Keys are
+// spread over independently locked shards, each holding an equal share of the
+// budget and evicting its own least recently used entries. Values are shared
+// and immutable, so a hit never copies under the lock.
+template <typename Value>
+class LruCache {
+public:
+    using Ptr = std::shared_ptr<const Value>;
+    using Weigher = std::function<std::size_t(const Value&)>;
+
+    struct Stats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        std::size_t entries = 0;
+        std::size_t bytes = 0;
+        std::size_t budget = 0;
+    };
+
+    LruCache(std::size_t budget, Weigher weigh, std::size_t shards = 16)
+        : weigh_(std::move(weigh)), budget_(budget) {
+        for (std::size_t i = 0; i < shards; ++i) shards_.push_back(std::make_unique<Shard>());
+    }
+
+    LruCache(const LruCache&) = delete;
+    LruCache& operator=(const LruCache&) = delete;
+
+    // Returns the cached value and marks it most recently used, or nullptr
+    Ptr get(const std::string& key) {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            ++misses_;
+            return nullptr;
+        }
+        ++hits_;
+        shard.order.splice(shard.order.begin(), shard.order, it->second);
+        return it->second->value;
+    }
+
+    // Inserts or replaces key. Values larger than a shard's budget are not cached.
+    void put(const std::string& key, Ptr value) {
+        if (!value) return;
+        const std::size_t weight = key.size() + weigh_(*value) + ENTRY_OVERHEAD;
+        const std::size_t limit = shardBudget();
+        if (weight > limit) return;
+
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.bytes -= it->second->weight;
+            shard.order.erase(it->second);
+            shard.index.erase(it);
+        }
+        shard.order.push_front({key, std::move(value), weight});
+        shard.index.emplace(key, shard.order.begin());
+        shard.bytes += weight;
+        evict(shard, limit);
+    }
+
+    // Changes the budget, evicting immediately if the cache is now over it
+    void setBudget(std::size_t budget) {
+        budget_ = budget;
+        const std::size_t limit = shardBudget();
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            evict(*shard, limit);
+        }
+    }
+
+    void clear() {
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->order.clear();
+            shard->index.clear();
+            shard->bytes = 0;
+        }
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.hits = hits_;
+        s.misses = misses_;
+        s.evictions = evictions_;
+        s.budget = budget_;
+        for (const auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            s.entries += shard->index.size();
+            s.bytes += shard->bytes;
+        }
+        return s;
+    }
+
+private:
+    // Rough cost of the list node, map slot and control block per entry
+    static constexpr std::size_t ENTRY_OVERHEAD = 96;
+
+    struct Node {
+        std::string key;
+        Ptr value;
+        std::size_t weight;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Node> order; // most recently used first
+        std::unordered_map<std::string, typename std::list<Node>::iterator> index;
+        std::size_t bytes = 0;
+    };
+
+    Shard& shardFor(const std::string& key) {
+        return *shards_[std::hash<std::string>{}(key) % shards_.size()];
+    }
+
+    std::size_t shardBudget() const { return budget_ / shards_.size(); }
+
+    void evict(Shard& shard, std::size_t limit) {
+        while (shard.bytes > limit && !shard.order.empty()) {
+            Node& victim = shard.order.back();
+            shard.bytes -= victim.weight;
+            shard.index.erase(victim.key);
+            shard.order.pop_back();
+            ++evictions_;
+        }
+    }
+
+    Weigher weigh_;
+    std::atomic<std::size_t> budget_;
+    std::atomic<std::uint64_t> hits_{0};
+    std::atomic<std::uint64_t> misses_{0};
+    std::atomic<std::uint64_t> evictions_{0};
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}
+
+#endif
@@ -0,0 +1,668 @@
+#include "packfile.hpp"
+#include "io.hpp"
+#include "dsa.hpp"
+#include "utils.hpp"
+#include "tree.hpp"
+#include "commit.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <mutex>
+#include <shared_mutex>
+
+namespace packfile {
+
+// Pack layout (pack-<hash>.pack):
+//   "MGPK" | uint32 version | uint32 object count | uint32 reserved
+//   entries: type byte (DELTA_FLAG set for deltas) | varint inflated size
+//            whole object: <size> raw bytes
+//            delta:        varint base entry offset | varint delta length | delta ops
+//
+// Index layout (pack-<hash>.idx):
+//   "MGPI" | uint32 version | uint32 object count | uint32 hash length
+//   uint32 fanout[256]  cumulative object counts by leading hash byte
+//   hashes              sorted, count * hash length bytes
+//   uint64 offsets      entry offset for each hash, in the same order
+namespace {
+
+constexpr char PACK_MAGIC[4] = {'M', 'G', 'P', 'K'};
+constexpr char INDEX_MAGIC[4] = {'M', 'G', 'P', 'I'};
+constexpr std::uint32_t PACK_VERSION = 1;
+constexpr std::uint8_t DELTA_FLAG = 0x80;
+constexpr std::size_t HEADER_SIZE = 16;
+constexpr std::size_t FANOUT_SIZE = 256 * sizeof(std::uint32_t);
+
+constexpr int MAX_DELTA_DEPTH = 10;                  // longest chain a reader replays
+constexpr std::size_t DELTA_WINDOW = 10;             // candidate bases tried per object
+constexpr std::size_t DELTA_BLOCK = 16;              // shortest copy worth encoding
+constexpr std::size_t MAX_DELTA_SOURCE = 64u << 20;  // larger objects are stored whole
+constexpr std::uint32_t ROLL_BASE = 257;
+
+enum : std::uint8_t { OP_INSERT = 0, OP_COPY = 1 };
+
+struct Pack {
+    MappedFile data;
+    MappedFile index;
+    std::uint32_t count = 0;
+    std::uint32_t hashLen = 0;
+    std::int64_t mtimeNs = 0;
+};
+
+std::vector<Pack> packs;
+bool scanned = false;
+std::int64_t scannedStamp = 0; // PACK_DIR's mtime when packs was last built
+bool scannedRacy = false;      // that mtime was too recent to rule out a later write in the same tick
+std::shared_mutex packsMutex;  // readers share; rescans and repacks are exclusive
+
+// Filesystems with coarse timestamps can leave the directory's mtime unchanged
+// across a write this soon after the scan.
+constexpr std::int64_t RACY_WINDOW_NS = 2'000'000'000LL;
+
+std::uint32_t readU32(const char* p) { std::uint32_t v; std::memcpy(&v, p, 4); return v; }
+std::uint64_t readU64(const char* p) { std::uint64_t v; std::memcpy(&v, p, 8); return v; }
+void putU32(std::string& out, std::uint32_t v) { out.append(reinterpret_cast<const char*>(&v), 4); }
+void putU64(std::string& out, std::uint64_t v) { out.append(reinterpret_cast<const char*>(&v), 8); }
+
+void putVarint(std::string& out, std::uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+bool getVarint(const char*& p, const char* end, std::uint64_t& v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        std::uint8_t byte = static_cast<std::uint8_t>(*p++);
+        v |= std::uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+unsigned leadingByte(const std::string& hash) {
+    unsigned value = 0;
+    for (int i = 0; i < 2 && i < static_cast<int>(hash.size()); ++i) {
+        char c = hash[i];
+        unsigned nibble = (c >= '0' && c <= '9') ? c - '0'
+                        : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                        : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : 0;
+        value = (value << 4) | nibble;
+    }
+    return value;
+}
+
+std::int64_t packDirStamp() {
+    IndexEntry stat;
+    return IOManager::statFile(IOManager::PACK_DIR, stat) ? stat.mtimeNs : 0;
+}
+
+// True if packs still reflects PACK_DIR. A stat of one directory, so misses
+// need not re-map every pack to find out nothing changed.
+bool packsCurrent() {
+    return scanned && !scannedRacy && packDirStamp() == scannedStamp;
+}
+
+void scanPacks() {
+    packs.clear();
+    scanned = true;
+    scannedStamp = packDirStamp();
+    const std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    scannedRacy = now - scannedStamp < RACY_WINDOW_NS;
+
+    std::error_code ec;
+    if (!fs::is_directory(IOManager::PACK_DIR, ec)) return;
+
+    for (const auto& entry : fs::directory_iterator(IOManager::PACK_DIR, ec)) {
+        if (entry.path().extension() != ".idx") continue;
+
+        fs::path packPath = entry.path();
+        packPath.replace_extension(".pack");
+
+        Pack pack;
+        pack.index = MappedFile(entry.path().string());
+        pack.data = MappedFile(packPath.string());
+        if (pack.index.size() < HEADER_SIZE + FANOUT_SIZE || pack.data.size() < HEADER_SIZE ||
+            std::memcmp(pack.index.data(), INDEX_MAGIC, 4) != 0 ||
+            std::memcmp(pack.data.data(), PACK_MAGIC, 4) != 0 ||
+            readU32(pack.index.data() + 4) != PACK_VERSION) {
+            utils::displayError("Ignoring corrupt pack: " + entry.path().string());
+            continue;
+        }
+
+        IndexEntry stat;
+        if (IOManager::statFile(packPath.string(), stat)) pack.mtimeNs = stat.mtimeNs;
+        pack.count = readU32(pack.index.data() + 8);
+        pack.hashLen = readU32(pack.index.data() + 12);
+        std::size_t needed = HEADER_SIZE + FANOUT_SIZE + std::size_t(pack.count) * (pack.hashLen + 8);
+        if (pack.index.size() < needed) {
+            utils::displayError("Ignoring truncated pack index: " + entry.path().string());
+            continue;
+        }
+        packs.push_back(std::move(pack));
+    }
+}
+
+const char* hashAt(const Pack& pack, std::uint32_t i) {
+    return pack.index.data() + HEADER_SIZE + FANOUT_SIZE + std::size_t(i) * pack.hashLen;
+}
+
+std::uint64_t offsetAt(const Pack& pack, std::uint32_t i) {
+    const char* offsets = hashAt(pack, pack.count);
+    return readU64(offsets + std::size_t(i) * 8);
+}
+
+// Narrows the search to one fan-out bucket, then binary searches the sorted hashes.
+bool findOffset(const Pack& pack, const std::string& hash, std::uint64_t& offset) {
+    if (hash.size() != pack.hashLen || hash.size() < 2) return false;
+
+    const char* fanout = pack.index.data() + HEADER_SIZE;
+    unsigned bucket = leadingByte(hash);
+    std::uint32_t lo = bucket == 0 ? 0 : readU32(fanout + (bucket - 1) * 4);
+    std::uint32_t hi = readU32(fanout + bucket * 4);
+
+    while (lo < hi) {
+        std::uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = std::memcmp(hashAt(pack, mid), hash.data(), pack.hashLen);
+        if (cmp == 0) {
+            offset = offsetAt(pack, mid);
+            return true;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return false;
+}
+
+// Reads the type and inflated size from the header of the entry at offset
+bool entryHeader(const Pack& pack, std::uint64_t offset, std::uint8_t& type, std::uint64_t& size) {
+    if (offset >= pack.data.size()) return false;
+    const char* p = pack.data.data() + offset;
+    const char* end = pack.data.data() + pack.data.size();
+    type = static_cast<std::uint8_t>(*p++) & ~DELTA_FLAG;
+    return getVarint(p, end, size);
+}
+
+bool applyDelta(const std::string& base, const char* p, const char* end,
+                std::uint64_t size, std::string& out) {
+    out.clear();
+    out.reserve(size);
+    while (p < end) {
+        std::uint8_t op = static_cast<std::uint8_t>(*p++);
+        std::uint64_t a = 0, b = 0;
+        if (op == OP_INSERT) {
+            if (!getVarint(p, end, a) || std::uint64_t(end - p) < a) return false;
+            out.append(p, a);
+            p += a;
+        } else if (op == OP_COPY) {
+            if (!getVarint(p, end, a) || !getVarint(p, end, b) || a + b > base.size()) return false;
+            out.append(base, a, b);
+        } else {
+            return false;
+        }
+    }
+    return out.size() == size;
+}
+
+bool inflate(const Pack& pack, std::uint64_t offset, std::string& out,
+             std::uint8_t* typeOut = nullptr, int depth = 0) {
+    if (depth > MAX_DELTA_DEPTH || offset >= pack.data.size()) return false;
+
+    const char* p = pack.data.data() + offset;
+    const char* end = pack.data.data() + pack.data.size();
+    std::uint8_t type = static_cast<std::uint8_t>(*p++);
+    if (typeOut) *typeOut = type & ~DELTA_FLAG;
+
+    std::uint64_t size = 0;
+    if (!getVarint(p, end, size)) return false;
+
+    if (!(type & DELTA_FLAG)) {
+        if (std::uint64_t(end - p) < size) return false;
+        out.assign(p, size);
+        return true;
+    }
+
+    std::uint64_t baseOffset = 0, deltaLen = 0;
+    if (!getVarint(p, end, baseOffset) || !getVarint(p, end, deltaLen) ||
+        std::uint64_t(end - p) < deltaLen || baseOffset >= offset) {
+        return false;
+    }
+
+    std::string base;
+    if (!inflate(pack, baseOffset, base, nullptr, depth + 1)) return false;
+    return applyDelta(base, p, p + deltaLen, size, out);
+}
+
+std::uint32_t blockHash(const unsigned char* p) {
+    std::uint32_t h = 0;
+    for (std::size_t i = 0; i < DELTA_BLOCK; ++i) h = h * ROLL_BASE + p[i];
+    return h;
+}
+
+// Encodes `target` as copy/insert ops against `base`. Returns an empty string
+// when no delta shorter than `limit` exists.
+std::string computeDelta(const std::string& base, const std::string& target, std::size_t limit) {
+    if (base.size() < DELTA_BLOCK || target.size() < DELTA_BLOCK) return "";
+
+    const auto* b = reinterpret_cast<const unsigned char*>(base.data());
+    const auto* t = reinterpret_cast<const unsigned char*>(target.data());
+
+    std::unordered_map<std::uint32_t, std::size_t> blocks;
+    blocks.reserve(base.size() / DELTA_BLOCK);
+    for (std::size_t i = 0; i + DELTA_BLOCK <= base.size(); i += DELTA_BLOCK) {
+        blocks.emplace(blockHash(b + i), i);
+    }
+
+    std::uint32_t outPow = 1; // ROLL_BASE^(DELTA_BLOCK-1), for removing the outgoing byte
+    for (std::size_t i = 1; i < DELTA_BLOCK; ++i) outPow *= ROLL_BASE;
+
+    std::string delta;
+    std::size_t insertStart = 0;
+    auto flushInsert = [&](std::size_t upto) {
+        if (upto <= insertStart) return;
+        delta.push_back(static_cast<char>(OP_INSERT));
+        putVarint(delta, upto - insertStart);
+        delta.append(target, insertStart, upto - insertStart);
+    };
+
+    std::size_t i = 0;
+    std::uint32_t h = blockHash(t);
+    while (i + DELTA_BLOCK <= target.size()) {
+        auto it = blocks.find(h);
+        if (it != blocks.end() && std::memcmp(b + it->second, t + i, DELTA_BLOCK) == 0) {
+            std::size_t bOff = it->second, tOff = i, len = DELTA_BLOCK;
+            while (tOff > insertStart && bOff > 0 && b[bOff - 1] == t[tOff - 1]) { --bOff; --tOff; ++len; }
+            while (tOff + len < target.size() && bOff + len < base.size() && b[bOff + len] == t[tOff + len]) ++len;
+
+            flushInsert(tOff);
+            delta.push_back(static_cast<char>(OP_COPY));
+            putVarint(delta, bOff);
+            putVarint(delta, len);
+            if (delta.size() >= limit) return "";
+
+            i = insertStart = tOff + len;
+            if (i + DELTA_BLOCK <= target.size()) h = blockHash(t + i);
+            continue;
+        }
+        if (i + DELTA_BLOCK < target.size()) h = (h - t[i] * outPow) * ROLL_BASE + t[i + DELTA_BLOCK];
+        ++i;
+        if (i - insertStart >= limit) return "";
+    }
+    flushInsert(target.size());
+
+    return delta.size() < limit ? delta : "";
+}
+
+// Content is only read while the object is being written (or named), so a
+// repack holds one delta window of objects rather than the repository.
+struct Candidate {
+    std::string hash;
+    ObjectType type;
+    std::string name;      // file name the blob was committed under, for grouping
+    std::uint64_t size = 0;
+    fs::path loosePath;    // empty if it came from an existing pack
+    std::size_t pack = 0;  // otherwise where it is packed
+    std::uint64_t offset = 0;
+    std::int64_t mtimeNs = 0;
+    int depth = 0;         // length of its delta chain once written
+};
+
+// Half-written objects of a concurrent writer, not yet renamed into place
+bool isTempName(const std::string& name) {
+    return name.find(".tmp-") != std::string::npos;
+}
+
+void collectLoose(const std::string& dir, ObjectType type, bool fanned,
+                  std::vector<Candidate>& out, std::unordered_set<std::string>& seen) {
+    std::error_code ec;
+    if (!fs::is_directory(dir, ec)) return;
+
+    auto addFile = [&](const fs::path& path, const std::string& hash) {
+        if (!seen.insert(hash).second) return;
+        IndexEntry stat;
+        if (!IOManager::statFile(path.string(), stat)) return;
+        Candidate c;
+        c.hash = hash;
+        c.type = type;
+        c.size = stat.size;
+        c.loosePath = path;
+        c.mtimeNs = stat.mtimeNs;
+        out.push_back(std::move(c));
+    };
+
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        const std::string leaf = entry.path().filename().string();
+        if (!fanned) {
+            if (entry.is_regular_file() && !isTempName(leaf)) addFile(entry.path(), leaf);
+            continue;
+        }
+        if (!entry.is_directory() || leaf.size() != 2) continue; // skips objects/pack
+        for (const auto& object : fs::directory_iterator(entry.path(), ec)) {
+            const std::string name = object.path().filename().string();
+            if (object.is_regular_file() && !isTempName(name)) addFile(object.path(), leaf + name);
+        }
+    }
+}
+
+// Reads c back from its loose file or the pack it was found in
+bool loadContent(const Candidate& c, std::string& content) {
+    if (!c.loosePath.empty()) {
+        content = IOManager::readFile(c.loosePath.string());
+        return content.size() == c.size;
+    }
+    return inflate(packs[c.pack], c.offset, content);
+}
+
+void removeLooseDirs() {
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(IOManager::OBJECTS_DIR, ec)) {
+        if (entry.is_directory() && entry.path().filename().string().size() == 2 &&
+            fs::is_empty(entry.path(), ec)) {
+            fs::remove(entry.path(), ec);
+        }
+    }
+}
+
+
+}
+
+bool readObject(const std::string& hash, std::string& content) {
+    std::uint64_t offset = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(packsMutex);
+        for (const Pack& pack : packs) {
+            if (findOffset(pack, hash, offset)) return inflate(pack, offset, content);
+        }
+        if (packsCurrent()) return false;
+    }
+
+    // Not found, and another process has packed since the last look.
+    std::unique_lock<std::shared_mutex> lock(packsMutex);
+    if (!packsCurrent()) scanPacks();
+    for (const Pack& pack : packs) {
+        if (findOffset(pack, hash, offset)) return inflate(pack, offset, content);
+    }
+    return false;
+}
+
+bool contains(const std::string& hash) {
+    std::uint64_t offset = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(packsMutex);
+        for (const Pack& pack : packs) {
+            if (findOffset(pack, hash, offset)) return true;
+        }
+        if (packsCurrent()) return false;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(packsMutex);
+    if (!packsCurrent()) scanPacks();
+    for (const Pack& pack : packs) {
+        if (findOffset(pack, hash, offset)) return true;
+    }
+    return false;
+}
+
+PackStats packObjects(const KeepFilter& keep) {
+    std::unique_lock<std::shared_mutex> lock(packsMutex);
+    PackStats stats;
+    std::vector<Candidate> objects;
+    std::unordered_set<std::string> seen;
+
+    collectLoose(IOManager::OBJECTS_DIR, ObjectType::Blob, true, objects, seen);
+    collectLoose(IOManager::COMMITS_DIR, ObjectType::Commit, false, objects, seen);
+    for (const Candidate& c : objects) {
+        stats.looseBytes += c.size;
+    }
+
+    // Carry over everything already packed so the new pack supersedes the old ones.
+    scanPacks();
+    for (std::size_t p = 0; p < packs.size(); ++p) {
+        const Pack& pack = packs[p];
+        for (std::uint32_t i = 0; i < pack.count; ++i) {
+            std::string hash(hashAt(pack, i), pack.hashLen);
+            if (seen.count(hash)) continue;
+            Candidate c;
+            std::uint8_t type = 0;
+            c.offset = offsetAt(pack, i);
+            if (!entryHeader(pack, c.offset, type, c.size)) {
+                utils::displayError("Skipping unreadable packed object " + hash);
+                continue;
+            }
+            seen.insert(hash);
+            c.hash = std::move(hash);
+            c.type = static_cast<ObjectType>(type);
+            c.pack = p;
+            c.mtimeNs = pack.mtimeNs;
+            objects.push_back(std::move(c));
+        }
+    }
+
+    if (objects.empty()) return stats;
+
+    // All hashes in one repository share a length; anything else stays loose.
+    const std::size_t hashLen = objects.front().hash.size();
+    objects.erase(std::remove_if(objects.begin(), objects.end(),
+                                 [&](const Candidate& c) { return c.hash.size() != hashLen; }),
+                  objects.end());
+
+    // Old packs and every loose copy, kept or not, go once the new pack is written.
+    std::vector<fs::path> superseded;
+    for (const Candidate& c : objects) {
+        if (!c.loosePath.empty()) superseded.push_back(c.loosePath);
+    }
+    auto removeSuperseded = [&] {
+        packs.clear();
+        scanned = false;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(IOManager::PACK_DIR, ec)) {
+            const fs::path& path = entry.path();
+            if (path.stem().string() != stats.name &&
+                (path.extension() == ".pack" || path.extension() == ".idx")) {
+                fs::remove(path, ec);
+            }
+        }
+        for (const fs::path& path : superseded) {
+            if (fs::remove(path, ec)) ++stats.looseRemoved;
+        }
+        removeLooseDirs();
+    };
+
+    if (keep) {
+        auto dropped = std::stable_partition(objects.begin(), objects.end(),
+                                             [&](const Candidate& c) { return keep(c.hash, c.mtimeNs); });
+        for (auto it = dropped; it != objects.end(); ++it) {
+            ++stats.pruned;
+            stats.prunedBytes += it->size;
+        }
+        objects.erase(dropped, objects.end());
+        if (objects.empty()) {
+            removeSuperseded();
+            return stats;
+        }
+    }
+
+    // Name blobs after the files that reference them, and trees after their
+    // directories, so versions of the same file end up next to each other and
+    // can delta against one another.
+    std::unordered_map<std::string, std::string> names;
+    std::vector<std::pair<std::string, std::string>> trees; // (tree hash, directory) to visit
+    std::string content;
+    for (const Candidate& c : objects) {
+        if (c.type != ObjectType::Commit || !loadContent(c, content)) continue;
+        Commit commit = Commit::parse(content);
+        if (!commit.tree.empty()) trees.emplace_back(std::string(commit.tree), "");
+        for (const auto& [path, hash] : commit.files) {
+            names.emplace(std::string(hash), fs::path(std::string(path)).filename().string());
+        }
+    }
+    std::unordered_map<std::string, const Candidate*> byHash;
+    for (const Candidate& c : objects) byHash.emplace(c.hash, &c);
+    while (!trees.empty()) {
+        auto [hash, dir] = std::move(trees.back());
+        trees.pop_back();
+        // Subtrees shared between commits are walked once.
+        if (!names.emplace(hash, dir + "/").second) continue;
+        auto it = byHash.find(hash);
+        if (it == byHash.end() || !loadContent(*it->second, content)) continue;
+        for (auto& entry : tree::parse(content)) {
+            if (entry.isTree) trees.emplace_back(std::move(entry.hash), dir + "/" + entry.name);
+            else names.emplace(std::move(entry.hash), std::move(entry.name));
+        }
+    }
+    byHash.clear();
+    for (Candidate& c : objects) {
+        auto it = names.find(c.hash);
+        if (it != names.end()) c.name = it->second;
+    }
+
+    // Larger versions first: deltas then mostly delete bytes, which encode smaller.
+    std::sort(objects.begin(), objects.end(), [](const Candidate& a, const Candidate& b) {
+        if (a.type != b.type) return a.type < b.type;
+        if (a.name != b.name) return a.name < b.name;
+        if (a.size != b.size) return a.size > b.size;
+        return a.hash < b.hash;
+    });
+
+    // Pack body, streamed to a temporary file as each object is encoded; bases
+    // always precede their deltas because deltas only look back. Only the last
+    // DELTA_WINDOW objects are held in memory as candidate bases.
+    IOManager::createDir(IOManager::PACK_DIR);
+    const std::string tmp = IOManager::tempPathFor(IOManager::PACK_DIR + "/incoming.pack");
+    std::ofstream out(tmp, std::ios::binary);
+    std::string header;
+    putU32(header, 0); // placeholder for the magic, patched below
+    putU32(header, PACK_VERSION);
+    putU32(header, 0); // object count, patched once known
+    putU32(header, 0);
+    std::memcpy(&header[0], PACK_MAGIC, 4);
+    out.write(header.data(), header.size());
+
+    std::vector<std::uint64_t> offsets(objects.size());
+    std::vector<bool> written(objects.size());
+    std::vector<std::string> window(DELTA_WINDOW + 1);
+    std::uint64_t packSize = header.size();
+    std::uint32_t count = 0;
+    std::string entry;
+    for (std::size_t i = 0; i < objects.size() && out; ++i) {
+        Candidate& target = objects[i];
+        std::string& data = window[i % window.size()];
+        if (!loadContent(target, data)) {
+            utils::displayError("Skipping unreadable object " + target.hash);
+            data.clear();
+            continue;
+        }
+
+        std::string delta;
+        std::size_t base = 0;
+        if (target.size <= MAX_DELTA_SOURCE) {
+            std::size_t best = data.size() / 2;
+            for (std::size_t j = i > DELTA_WINDOW ? i - DELTA_WINDOW : 0; j < i; ++j) {
+                const Candidate& candidate = objects[j];
+                if (!written[j] || candidate.type != target.type || candidate.depth >= MAX_DELTA_DEPTH ||
+                    candidate.size > MAX_DELTA_SOURCE) {
+                    continue;
+                }
+                std::string attempt = computeDelta(window[j % window.size()], data, best);
+                if (!attempt.empty()) {
+                    best = attempt.size();
+                    delta = std::move(attempt);
+                    base = j;
+                }
+            }
+        }
+
+        entry.clear();
+        std::uint8_t type = static_cast<std::uint8_t>(target.type);
+        if (!delta.empty()) {
+            entry.push_back(static_cast<char>(type | DELTA_FLAG));
+            putVarint(entry, data.size());
+            putVarint(entry, offsets[base]);
+            putVarint(entry, delta.size());
+            entry += delta;
+            target.depth = objects[base].depth + 1;
+            ++stats.deltas;
+        } else {
+            entry.push_back(static_cast<char>(type));
+            putVarint(entry, data.size());
+        }
+        out.write(entry.data(), entry.size());
+        if (delta.empty()) out.write(data.data(), data.size());
+        offsets[i] = packSize;
+        packSize += entry.size() + (delta.empty() ? data.size() : 0);
+        written[i] = true;
+        ++count;
+    }
+    window.clear();
+
+    if (count > 0) {
+        std::string patched;
+        putU32(patched, count);
+        out.seekp(8);
+        out.write(patched.data(), patched.size());
+    }
+    out.close();
+    std::error_code ec;
+    if (!out || count == 0) {
+        if (count > 0) utils::displayError("Error writing to: " + tmp);
+        fs::remove(tmp, ec);
+        return stats;
+    }
+
+    std::vector<std::size_t> order;
+    order.reserve(count);
+    for (std::size_t i = 0; i < objects.size(); ++i) {
+        if (written[i]) order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(),
+              [&](std::size_t a, std::size_t b) { return objects[a].hash < objects[b].hash; });
+
+    std::string index;
+    putU32(index, 0);
+    putU32(index, PACK_VERSION);
+    putU32(index, count);
+    putU32(index, static_cast<std::uint32_t>(hashLen));
+    std::memcpy(&index[0], INDEX_MAGIC, 4);
+
+    std::uint32_t fanout[256] = {};
+    for (std::size_t i : order) ++fanout[leadingByte(objects[i].hash)];
+    for (int b = 1; b < 256; ++b) fanout[b] += fanout[b - 1];
+    for (std::uint32_t n : fanout) putU32(index, n);
+
+    std::string hashes;
+    for (std::size_t i : order) hashes += objects[i].hash;
+    index += hashes;
+    for (std::size_t i : order) putU64(index, offsets[i]);
+
+    stats.name = "pack-" + dsa::computeSHA1(hashes);
+    stats.objects = count;
+    stats.packBytes = packSize + index.size();
+
+    // The pack goes in before its index: readers only look for packs with one.
+    const std::string base = IOManager::PACK_DIR + "/" + stats.name;
+    fs::rename(tmp, base + ".pack", ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        utils::displayError("Error writing to: " + base + ".pack");
+        stats.name.clear();
+        return stats;
+    }
+    if (!IOManager::writeFileAtomic(base + ".idx", index)) {
+        stats.name.clear();
+        return stats;
+    }
+
+    // Only now is it safe to drop the superseded copies.
+    removeSuperseded();
+    return stats;
+}
+
+}
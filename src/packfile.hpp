@@ -0,0 +1,42 @@
+#ifndef PACKFILE_HPP
+#define PACKFILE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace packfile {
+
+enum class ObjectType : std::uint8_t {
+    Blob = 1,
+    Commit = 2
+};
+
+struct PackStats {
+    std::string name;          // pack-<hash>, empty if nothing was packed
+    std::size_t objects = 0;
+    std::size_t deltas = 0;
+    std::size_t looseRemoved = 0;
+    std::uint64_t looseBytes = 0;
+    std::uint64_t packBytes = 0;
+    std::size_t pruned = 0;          // objects the keep filter dropped
+    std::uint64_t prunedBytes = 0;   // their inflated size
+};
+
+// Decides whether an object survives a repack. mtimeNs is when its loose file,
+// or the pack it was found in, was last written.
+using KeepFilter = std::function<bool(const std::string& hash, std::int64_t mtimeNs)>;
+
+// Looks an object up in the packs under objects/pack and inflates it into `content`
+bool readObject(const std::string& hash, std::string& content);
+// True if any pack holds the object
+bool contains(const std::string& hash);
+
+// Consolidates every loose object and existing pack into a single new pack,
+// then removes the loose copies and the superseded packs. Objects rejected by
+// keep are left out of the new pack and deleted with the rest.
+PackStats packObjects(const KeepFilter& keep = nullptr);
+
+}
+
+#endif
@@ -0,0 +1,287 @@
+#include "server.hpp"
+#include "io.hpp"
+#include "fsmonitor.hpp"
+#include "threadpool.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <shared_mutex>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define MINIGIT_HAVE_UNIX_SOCKETS 1
+#endif
+
+namespace server {
+
+const std::string& socketPath() {
+    static const std::string path = IOManager::MINIGIT_DIR + "/daemon.sock";
+    return path;
+}
+
+#ifdef MINIGIT_HAVE_UNIX_SOCKETS
+
+namespace {
+
+// Guards against a confused or hostile client making the daemon allocate without bound
+constexpr std::uint32_t MAX_ARGS = 4096;
+constexpr std::uint32_t MAX_FIELD = 64u << 20;
+// A client gets this long to send its whole command, and each write of the
+// reply may block this long, so an idle or stalled connection is closed
+// instead of holding a worker forever.
+constexpr std::chrono::seconds CLIENT_TIMEOUT{10};
+
+using Deadline = std::chrono::steady_clock::time_point;
+
+std::atomic<bool> stopRequested{false};
+
+void onSignal(int) {
+    stopRequested = true;
+}
+
+bool writeAll(int fd, const void* data, std::size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+// Without a deadline, waits as long as the peer takes
+bool readAll(int fd, void* data, std::size_t size, const Deadline* deadline = nullptr) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        if (deadline) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                *deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0) return false;
+            pollfd readable{fd, POLLIN, 0};
+            int ready = ::poll(&readable, 1, static_cast<int>(left));
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready <= 0) return false;
+        }
+        ssize_t n = ::read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+bool writeField(int fd, const std::string& field) {
+    std::uint32_t length = static_cast<std::uint32_t>(field.size());
+    return writeAll(fd, &length, sizeof(length)) && writeAll(fd, field.data(), field.size());
+}
+
+bool readField(int fd, std::string& field, const Deadline* deadline = nullptr) {
+    std::uint32_t length = 0;
+    if (!readAll(fd, &length, sizeof(length), deadline) || length > MAX_FIELD) return false;
+    field.resize(length);
+    return readAll(fd, field.data(), length, deadline);
+}
+
+bool fillAddress(sockaddr_un& address, const std::string& path) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// A connected socket to the daemon, or -1
+int connectToDaemon() {
+    sockaddr_un address;
+    if (!fillAddress(address, socketPath())) return -1;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+struct Request {
+    const Handler& execute;
+    const std::function<bool(const Command&)>& readOnly;
+    std::shared_mutex& repository;
+};
+
+// Reads one command from the client, runs it with its output captured and
+// sends back the result
+void handleClient(int fd, const Request& request) {
+    timeval sendTimeout{static_cast<time_t>(CLIENT_TIMEOUT.count()), 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+    const Deadline deadline = std::chrono::steady_clock::now() + CLIENT_TIMEOUT;
+    Command command;
+    std::uint32_t argc = 0;
+    bool valid = readAll(fd, &argc, sizeof(argc), &deadline) && argc > 0 && argc <= MAX_ARGS;
+    for (std::uint32_t i = 0; valid && i < argc; ++i) {
+        command.emplace_back();
+        valid = readField(fd, command.back(), &deadline);
+    }
+    if (!valid) {
+        ::close(fd);
+        return;
+    }
+
+    utils::OutputCapture capture;
+    int status = 0;
+    {
+        utils::ScopedCapture scope(&capture);
+        if (command[0] == "daemon") {
+            if (command.size() == 2 && command[1] == "stop") {
+                stopRequested = true;
+                std::cout << "Daemon stopping.\n";
+            } else {
+                utils::displayError("A daemon is already running for this repository.");
+                status = 1;
+            }
+        } else if (request.readOnly(command)) {
+            std::shared_lock<std::shared_mutex> lock(request.repository);
+            status = request.execute(command);
+            IOManager::flushIndex();
+        } else {
+            std::unique_lock<std::shared_mutex> lock(request.repository);
+            status = request.execute(command);
+            IOManager::flushIndex();
+        }
+    }
+
+    // If the client has gone away there is nobody left to tell.
+    std::int32_t code = status;
+    static_cast<void>(writeAll(fd, &code, sizeof(code)) && writeField(fd, capture.out) &&
+                      writeField(fd, capture.err));
+    ::close(fd);
+}
+
+}
+
+int serve(const Handler& execute, const std::function<bool(const Command&)>& readOnly) {
+    if (!IOManager::fileExists(IOManager::MINIGIT_DIR)) {
+        utils::displayError("Not a MiniGit repository (run init first).");
+        return 1;
+    }
+
+    const std::string& path = socketPath();
+    if (int probe = connectToDaemon(); probe >= 0) {
+        ::close(probe);
+        utils::displayError("A daemon is already running on " + path);
+        return 1;
+    }
+    ::unlink(path.c_str()); // left behind by a daemon that did not shut down cleanly
+
+    sockaddr_un address;
+    if (!fillAddress(address, path)) {
+        utils::displayError("Socket path too long: " + path);
+        return 1;
+    }
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(listener, 64) != 0) {
+        utils::displayError("Cannot listen on " + path + ": " + std::strerror(errno));
+        if (listener >= 0) ::close(listener);
+        return 1;
+    }
+    ::chmod(path.c_str(), 0600);
+
+    stopRequested = false;
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+    ::signal(SIGPIPE, SIG_IGN); // a client that hangs up must not kill the daemon
+
+    IOManager::holdIndex(true);
+    // With "fsmonitor = true" the daemon follows the working tree itself,
+    // unless a helper process already does.
+    fsmonitor::Watcher watcher;
+    if (fsmonitor::enabled() && watcher.start()) std::cout << "Watching the working tree." << std::endl;
+    std::cout << "MiniGit daemon listening on " << path << " (stop with 'minigit daemon stop')" << std::endl;
+    utils::routeStandardStreams();
+
+    // Requests get a pool of their own: they block on the repository lock,
+    // which must never happen on a shared-pool thread that others are waiting on.
+    utils::ThreadPool workers(std::max(2u, std::thread::hardware_concurrency()));
+    std::shared_mutex repository;
+    const Request request{execute, readOnly, repository};
+
+    while (!stopRequested) {
+        pollfd pending{listener, POLLIN, 0};
+        if (::poll(&pending, 1, 200) <= 0) continue; // timeout or signal: recheck the flag
+        int client = ::accept(listener, nullptr, nullptr);
+        if (client < 0) continue;
+        workers.submit([client, &request] { handleClient(client, request); });
+    }
+
+    workers.wait();
+    ::close(listener);
+    ::unlink(path.c_str());
+    bool saved = IOManager::holdIndex(false);
+    std::cout << "MiniGit daemon stopped." << std::endl;
+    return saved ? 0 : 1;
+}
+
+bool forward(const Command& command, int& status) {
+    int fd = connectToDaemon();
+    if (fd < 0) return false;
+    ::signal(SIGPIPE, SIG_IGN);
+
+    std::uint32_t argc = static_cast<std::uint32_t>(command.size());
+    bool sent = writeAll(fd, &argc, sizeof(argc));
+    for (const auto& arg : command) sent = sent && writeField(fd, arg);
+    if (!sent) {
+        ::close(fd);
+        return false; // the daemon never saw the whole command, so it did not run
+    }
+
+    std::int32_t code = 0;
+    std::string out, err;
+    bool received = readAll(fd, &code, sizeof(code)) && readField(fd, out) && readField(fd, err);
+    ::close(fd);
+    if (!received) {
+        // It may or may not have run; running it again here could do it twice.
+        utils::displayError("Lost connection to the MiniGit daemon.");
+        status = 1;
+        return true;
+    }
+    std::cout << out << std::flush;
+    std::cerr << err << std::flush;
+    status = code;
+    return true;
+}
+
+#else
+
+int serve(const Handler&, const std::function<bool(const Command&)>&) {
+    utils::displayError("Daemon mode needs Unix domain sockets, which this platform lacks.");
+    return 1;
+}
+
+bool forward(const Command&, int&) {
+    return false;
+}
+
+#endif
+
+}
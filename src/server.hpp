@@ -0,0 +1,35 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Daemon mode: "minigit daemon" keeps the repository state (index, commit
+// graph, object caches) warm in one process and runs commands sent by other
+// minigit invocations over a Unix domain socket in .minigit.
+//
+// Wire format (native byte order, local socket only):
+//   request:  uint32 argc, then per argument uint32 length + bytes
+//   response: int32 exit status, uint32 length + stdout, uint32 length + stderr
+namespace server {
+
+using Command = std::vector<std::string>;
+// Runs a command in this process and returns its exit status
+using Handler = std::function<int(const Command&)>;
+
+// The socket a daemon for the repository in the current directory listens on
+const std::string& socketPath();
+
+// Serves requests until "daemon stop" or SIGINT/SIGTERM. Commands for which
+// readOnly is true run concurrently on a pool; the others run one at a time
+// with no read in progress. Returns the process exit status.
+int serve(const Handler& execute, const std::function<bool(const Command&)>& readOnly);
+
+// Runs command on a running daemon and relays its output and status. False if
+// no daemon answered, in which case the command was not run.
+bool forward(const Command& command, int& status);
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+#include "sparse.hpp"
+#include "io.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+
+namespace sparse {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+const std::string SPARSE_FILE = IOManager::MINIGIT_DIR + "/sparse-checkout";
+
+}
+
+Patterns::Patterns(const std::vector<std::string>& cones) {
+    for (const auto& cone : cones) {
+        const std::string trimmed = utils::trim(cone);
+        const std::string dir = trimmed == "/" ? "." : IOManager::normalizePath(trimmed);
+        if (dir == ".") {
+            prefixes_.clear();
+            return; // the whole tree
+        }
+        prefixes_.push_back(dir + "/");
+    }
+    std::sort(prefixes_.begin(), prefixes_.end());
+    prefixes_.erase(std::unique(prefixes_.begin(), prefixes_.end()), prefixes_.end());
+
+    // A cone inside another adds nothing. With the rest prefix-free, the only
+    // cone that can hold a path is the greatest one not after it.
+    std::vector<std::string> outer;
+    for (auto& prefix : prefixes_) {
+        if (!outer.empty() && prefix.compare(0, outer.back().size(), outer.back()) == 0) continue;
+        outer.push_back(std::move(prefix));
+    }
+    prefixes_ = std::move(outer);
+    full_ = prefixes_.empty();
+}
+
+std::vector<std::string> Patterns::cones() const {
+    std::vector<std::string> cones;
+    for (const auto& prefix : prefixes_) cones.push_back(prefix.substr(0, prefix.size() - 1));
+    return cones;
+}
+
+bool Patterns::includes(const std::string& path) const {
+    if (full_) return true;
+    const std::size_t slash = path.find('/');
+    if (slash == std::string::npos) return true; // a file in the root
+
+    auto after = std::upper_bound(prefixes_.begin(), prefixes_.end(), path);
+    if (after != prefixes_.begin()) {
+        const std::string& cone = *std::prev(after);
+        if (path.compare(0, cone.size(), cone) == 0) return true;
+    }
+    // A directory above a cone has to be entered to reach it.
+    return path.back() == '/' && after != prefixes_.end() && after->compare(0, path.size(), path) == 0;
+}
+
+std::vector<std::string> Patterns::listFiles() const {
+    if (full_) return IOManager::listFiles(".");
+    TRACE_SCOPE("sparse::listFiles");
+    std::vector<std::string> files;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(".", ec)) {
+        if (entry.is_regular_file(ec)) files.push_back(IOManager::normalizePath(entry.path().string()));
+    }
+    for (const auto& cone : cones()) {
+        auto found = IOManager::listFiles(cone);
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+Patterns load() {
+    if (!IOManager::fileExists(SPARSE_FILE)) return Patterns();
+    std::istringstream lines(IOManager::readFile(SPARSE_FILE));
+    std::vector<std::string> cones;
+    std::string line;
+    while (std::getline(lines, line)) {
+        line = utils::trim(line);
+        if (!line.empty() && line[0] != '#') cones.push_back(line);
+    }
+    return cones.empty() ? Patterns() : Patterns(cones);
+}
+
+bool save(const Patterns& patterns) {
+    if (patterns.full()) {
+        std::error_code ec;
+        fs::remove(SPARSE_FILE, ec);
+        return !ec;
+    }
+    std::string content;
+    for (const auto& cone : patterns.cones()) content += cone + "\n";
+    return IOManager::writeFileAtomic(SPARSE_FILE, content);
+}
+
+}
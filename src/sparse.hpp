@@ -0,0 +1,43 @@
+#ifndef SPARSE_HPP
+#define SPARSE_HPP
+
+#include <string>
+#include <vector>
+
+// Sparse checkout: .minigit/sparse-checkout lists the directories ("cones")
+// the working tree holds, one per line. Files directly in the root always
+// belong to it. Everything else stays in the index and in every commit, but
+// is never read from objects/ or written to disk. Without the file (or with
+// an empty one, or a "/" line) the whole tree is checked out.
+namespace sparse {
+
+class Patterns {
+public:
+    // The whole tree
+    Patterns() = default;
+    explicit Patterns(const std::vector<std::string>& cones);
+
+    bool full() const { return full_; }
+    // The cones, sorted, without those inside another one
+    std::vector<std::string> cones() const;
+    // True if the file at path belongs to the checkout; a directory given
+    // with its trailing '/' does if any file under it may. One bisection of
+    // the sorted cone prefixes either way.
+    bool includes(const std::string& path) const;
+    // The files of the checkout present in the working tree, sorted; only
+    // the root and the cones are walked
+    std::vector<std::string> listFiles() const;
+
+private:
+    bool full_ = true;
+    std::vector<std::string> prefixes_; // each cone with its trailing '/', sorted
+};
+
+// The patterns in .minigit/sparse-checkout
+Patterns load();
+// Replaces them; a full checkout removes the file
+bool save(const Patterns& patterns);
+
+}
+
+#endif
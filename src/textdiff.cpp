@@ -0,0 +1,461 @@
+#include "textdiff.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <unordered_map>
+
+namespace textdiff {
+
+namespace {
+
+constexpr std::uint32_t MAX_HISTOGRAM_CHAIN = 64; // lines more common than this never anchor
+
+struct Range {
+    int aLo, aHi, bLo, bHi;
+};
+
+// Lines are interned to dense integer ids once, so every comparison in the
+// algorithms below is an integer compare rather than a string compare.
+class Differ {
+public:
+    Differ(const std::vector<std::uint32_t>& a, const std::vector<std::uint32_t>& b, std::size_t ids)
+        : a_(a), b_(b), deleted_(a.size(), 0), inserted_(b.size(), 0),
+          count_(ids, 0), countB_(ids, 0), head_(ids, -1), chain_(a.size(), -1) {}
+
+    void run(Algorithm algorithm) {
+        work_.push_back({0, static_cast<int>(a_.size()), 0, static_cast<int>(b_.size())});
+        while (!work_.empty()) {
+            Range r = work_.back();
+            work_.pop_back();
+            if (!trim(r)) continue;
+            switch (algorithm) {
+                case Algorithm::Myers: myers(r); break;
+                case Algorithm::Histogram: histogram(r); break;
+                case Algorithm::Patience: patience(r); break;
+            }
+        }
+    }
+
+    std::vector<Change> changes() const {
+        std::vector<Change> out;
+        std::size_t i = 0, j = 0;
+        while (i < a_.size() || j < b_.size()) {
+            if (i < a_.size() && j < b_.size() && !deleted_[i] && !inserted_[j]) { ++i; ++j; continue; }
+            Change c{i, 0, j, 0};
+            while (i < a_.size() && deleted_[i]) ++i;
+            while (j < b_.size() && inserted_[j]) ++j;
+            c.oldCount = i - c.oldStart;
+            c.newCount = j - c.newStart;
+            out.push_back(c);
+        }
+        return out;
+    }
+
+private:
+    // Strips the common prefix and suffix; returns false if nothing is left to
+    // compare (marking a one-sided remainder as deleted or inserted).
+    bool trim(Range& r) {
+        while (r.aLo < r.aHi && r.bLo < r.bHi && a_[r.aLo] == b_[r.bLo]) { ++r.aLo; ++r.bLo; }
+        while (r.aLo < r.aHi && r.bLo < r.bHi && a_[r.aHi - 1] == b_[r.bHi - 1]) { --r.aHi; --r.bHi; }
+        if (r.aLo == r.aHi || r.bLo == r.bHi) {
+            markAll(r);
+            return false;
+        }
+        return true;
+    }
+
+    void markAll(const Range& r) {
+        for (int i = r.aLo; i < r.aHi; ++i) deleted_[i] = 1;
+        for (int j = r.bLo; j < r.bHi; ++j) inserted_[j] = 1;
+    }
+
+    // Myers' bisection: run the O(ND) search from both ends until the paths
+    // meet, then split at the meeting point. Only two diagonal vectors are kept,
+    // so memory stays linear however large the inputs are.
+    void myers(const Range& r) {
+        const int n = r.aHi - r.aLo, m = r.bHi - r.bLo;
+        const std::uint32_t* a = a_.data() + r.aLo;
+        const std::uint32_t* b = b_.data() + r.bLo;
+
+        const int maxD = (n + m + 1) / 2;
+        const int offset = maxD;
+        const int length = 2 * maxD + 2;
+        v1_.assign(length, -1);
+        v2_.assign(length, -1);
+        v1_[offset + 1] = 0;
+        v2_[offset + 1] = 0;
+
+        const int delta = n - m;
+        const bool front = (delta % 2) != 0; // which direction can detect the overlap
+        int k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+
+        for (int d = 0; d < maxD; ++d) {
+            for (int k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+                const int k1off = offset + k1;
+                int x1 = (k1 == -d || (k1 != d && v1_[k1off - 1] < v1_[k1off + 1]))
+                             ? v1_[k1off + 1] : v1_[k1off - 1] + 1;
+                int y1 = x1 - k1;
+                while (x1 < n && y1 < m && a[x1] == b[y1]) { ++x1; ++y1; }
+                v1_[k1off] = x1;
+                if (x1 > n) k1end += 2;        // ran off the right of the grid
+                else if (y1 > m) k1start += 2; // ran off the bottom
+                else if (front) {
+                    const int k2off = offset + delta - k1;
+                    if (k2off >= 0 && k2off < length && v2_[k2off] != -1 && x1 >= n - v2_[k2off]) {
+                        split(r, x1, y1);
+                        return;
+                    }
+                }
+            }
+            for (int k2 = -d + k2start; k2 <= d - k2end; k2 += 2) {
+                const int k2off = offset + k2;
+                int x2 = (k2 == -d || (k2 != d && v2_[k2off - 1] < v2_[k2off + 1]))
+                             ? v2_[k2off + 1] : v2_[k2off - 1] + 1;
+                int y2 = x2 - k2;
+                while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1]) { ++x2; ++y2; }
+                v2_[k2off] = x2;
+                if (x2 > n) k2end += 2;
+                else if (y2 > m) k2start += 2;
+                else if (!front) {
+                    const int k1off = offset + delta - k2;
+                    if (k1off >= 0 && k1off < length && v1_[k1off] != -1) {
+                        const int x1 = v1_[k1off];
+                        const int y1 = offset + x1 - k1off;
+                        if (x1 >= n - x2) {
+                            split(r, x1, y1);
+                            return;
+                        }
+                    }
+                }
+            }
+        }
+        markAll(r); // nothing in common
+    }
+
+    void split(const Range& r, int x, int y) {
+        work_.push_back({r.aLo + x, r.aHi, r.bLo + y, r.bHi});
+        work_.push_back({r.aLo, r.aLo + x, r.bLo, r.bLo + y});
+    }
+
+    // Histogram diff: anchor on the rarest line the two sides share, grow it
+    // into the longest common run around it and recurse on either side.
+    void histogram(const Range& r) {
+        for (int i = r.aLo; i < r.aHi; ++i) {
+            ++count_[a_[i]];
+            chain_[i] = head_[a_[i]];
+            head_[a_[i]] = i;
+        }
+
+        int bestA = -1, bestB = -1, bestLen = 0;
+        std::uint32_t bestCount = MAX_HISTOGRAM_CHAIN + 1;
+        for (int j = r.bLo; j < r.bHi; ++j) {
+            std::uint32_t c = count_[b_[j]];
+            if (c == 0 || c > bestCount) continue;
+            for (int i = head_[b_[j]]; i != -1; i = chain_[i]) {
+                int before = 0, after = 1;
+                while (i - before > r.aLo && j - before > r.bLo && a_[i - before - 1] == b_[j - before - 1]) ++before;
+                while (i + after < r.aHi && j + after < r.bHi && a_[i + after] == b_[j + after]) ++after;
+                if (c < bestCount || before + after > bestLen) {
+                    bestA = i - before;
+                    bestB = j - before;
+                    bestLen = before + after;
+                    bestCount = c;
+                }
+            }
+        }
+
+        for (int i = r.aLo; i < r.aHi; ++i) {
+            count_[a_[i]] = 0;
+            head_[a_[i]] = -1;
+        }
+
+        if (bestLen == 0) {
+            myers(r);
+            return;
+        }
+        work_.push_back({bestA + bestLen, r.aHi, bestB + bestLen, r.bHi});
+        work_.push_back({r.aLo, bestA, r.bLo, bestB});
+    }
+
+    // Patience diff: match lines that occur exactly once on each side, keep the
+    // longest run of matches that is increasing on both, and recurse between them.
+    void patience(const Range& r) {
+        for (int i = r.aLo; i < r.aHi; ++i) { ++count_[a_[i]]; head_[a_[i]] = i; }
+        for (int j = r.bLo; j < r.bHi; ++j) ++countB_[b_[j]];
+
+        std::vector<std::pair<int, int>> unique; // (a index, b index) in b order
+        for (int j = r.bLo; j < r.bHi; ++j) {
+            if (count_[b_[j]] == 1 && countB_[b_[j]] == 1) unique.emplace_back(head_[b_[j]], j);
+        }
+
+        for (int i = r.aLo; i < r.aHi; ++i) { count_[a_[i]] = 0; head_[a_[i]] = -1; }
+        for (int j = r.bLo; j < r.bHi; ++j) countB_[b_[j]] = 0;
+
+        if (unique.empty()) {
+            myers(r);
+            return;
+        }
+
+        // Longest increasing subsequence of a indices (patience sorting).
+        std::vector<int> tails, prev(unique.size(), -1);
+        for (int k = 0; k < static_cast<int>(unique.size()); ++k) {
+            auto it = std::lower_bound(tails.begin(), tails.end(), unique[k].first,
+                                       [&](int idx, int value) { return unique[idx].first < value; });
+            if (it != tails.begin()) prev[k] = *(it - 1);
+            if (it == tails.end()) tails.push_back(k);
+            else *it = k;
+        }
+
+        std::vector<int> anchors;
+        for (int k = tails.back(); k != -1; k = prev[k]) anchors.push_back(k);
+        // anchors is in reverse order, which is what the LIFO work list wants.
+        int aHi = r.aHi, bHi = r.bHi;
+        for (int k : anchors) {
+            work_.push_back({unique[k].first + 1, aHi, unique[k].second + 1, bHi});
+            aHi = unique[k].first;
+            bHi = unique[k].second;
+        }
+        work_.push_back({r.aLo, aHi, r.bLo, bHi});
+    }
+
+    const std::vector<std::uint32_t>& a_;
+    const std::vector<std::uint32_t>& b_;
+    std::vector<char> deleted_, inserted_;
+    std::vector<std::uint32_t> count_, countB_;
+    std::vector<int> head_, chain_;
+    std::vector<int> v1_, v2_;
+    std::vector<Range> work_;
+};
+
+void intern(const std::vector<std::string_view>& a, const std::vector<std::string_view>& b,
+            std::vector<std::uint32_t>& idsA, std::vector<std::uint32_t>& idsB, std::size_t& ids) {
+    std::unordered_map<std::string_view, std::uint32_t> table;
+    table.reserve(a.size() + b.size());
+    auto idOf = [&](std::string_view line) {
+        auto [it, inserted] = table.emplace(line, static_cast<std::uint32_t>(table.size()));
+        return it->second;
+    };
+    idsA.reserve(a.size());
+    idsB.reserve(b.size());
+    for (auto line : a) idsA.push_back(idOf(line));
+    for (auto line : b) idsB.push_back(idOf(line));
+    ids = table.size();
+}
+
+void writeLine(std::ostringstream& out, char prefix, std::string_view line, const char* color) {
+    if (color) out << color;
+    out << prefix;
+    bool newline = !line.empty() && line.back() == '\n';
+    out << (newline ? line.substr(0, line.size() - 1) : line);
+    if (color) out << "\033[0m";
+    out << "\n";
+    if (!newline) out << "\\ No newline at end of file\n";
+}
+
+// Lines [begin, end) of one side of a merge
+struct Span {
+    std::size_t begin, end;
+};
+
+// What a side has in place of base[lo, hi), given that its changes
+// [first, last) all fall inside that range. Lines between them match the base.
+Span sideSpan(const std::vector<Change>& changes, std::size_t first, std::size_t last,
+              std::size_t lo, std::size_t hi) {
+    const Change& head = changes[first];
+    const Change& tail = changes[last - 1];
+    return {head.newStart - (head.oldStart - lo),
+            tail.newStart + tail.newCount + (hi - (tail.oldStart + tail.oldCount))};
+}
+
+bool sameLines(const std::vector<std::string_view>& a, Span sa,
+               const std::vector<std::string_view>& b, Span sb) {
+    return sa.end - sa.begin == sb.end - sb.begin &&
+           std::equal(a.begin() + sa.begin, a.begin() + sa.end, b.begin() + sb.begin);
+}
+
+std::string hunkRange(std::size_t start, std::size_t count) {
+    // An empty range names the line before it, as in diff(1).
+    std::size_t first = count == 0 ? start : start + 1;
+    return count == 1 ? std::to_string(first) : std::to_string(first) + "," + std::to_string(count);
+}
+
+}
+
+bool parseAlgorithm(const std::string& name, Algorithm& out) {
+    if (name == "myers") out = Algorithm::Myers;
+    else if (name == "histogram") out = Algorithm::Histogram;
+    else if (name == "patience") out = Algorithm::Patience;
+    else return false;
+    return true;
+}
+
+std::vector<std::string_view> splitLines(std::string_view text) {
+    std::vector<std::string_view> lines;
+    std::size_t start = 0;
+    while (start < text.size()) {
+        std::size_t end = text.find('\n', start);
+        end = end == std::string_view::npos ? text.size() : end + 1;
+        lines.push_back(text.substr(start, end - start));
+        start = end;
+    }
+    return lines;
+}
+
+std::vector<Change> diffLines(const std::vector<std::string_view>& a,
+                              const std::vector<std::string_view>& b,
+                              Algorithm algorithm) {
+    TRACE_SCOPE("textdiff::diffLines");
+    std::vector<std::uint32_t> idsA, idsB;
+    std::size_t ids = 0;
+    intern(a, b, idsA, idsB, ids);
+
+    Differ differ(idsA, idsB, ids);
+    differ.run(algorithm);
+    return differ.changes();
+}
+
+std::string unifiedDiff(const std::string& a, const std::string& b,
+                        const std::string& labelA, const std::string& labelB,
+                        const UnifiedOptions& options) {
+    auto linesA = splitLines(a);
+    auto linesB = splitLines(b);
+    auto changes = diffLines(linesA, linesB, options.algorithm);
+    if (changes.empty()) return "";
+
+    const char* red = options.color ? "\033[1;31m" : nullptr;
+    const char* green = options.color ? "\033[1;32m" : nullptr;
+    const char* cyan = options.color ? "\033[36m" : nullptr;
+    const std::size_t ctx = options.context;
+
+    std::ostringstream out;
+    out << "--- " << labelA << "\n+++ " << labelB << "\n";
+
+    std::size_t first = 0;
+    while (first < changes.size()) {
+        // Changes closer than two contexts apart share a hunk.
+        std::size_t last = first;
+        while (last + 1 < changes.size() &&
+               changes[last + 1].oldStart - (changes[last].oldStart + changes[last].oldCount) <= 2 * ctx) {
+            ++last;
+        }
+
+        const Change& head = changes[first];
+        const Change& tail = changes[last];
+        std::size_t oldStart = head.oldStart - std::min(ctx, head.oldStart);
+        std::size_t newStart = head.newStart - (head.oldStart - oldStart);
+        std::size_t oldEnd = std::min(linesA.size(), tail.oldStart + tail.oldCount + ctx);
+        std::size_t newEnd = tail.newStart + tail.newCount + (oldEnd - (tail.oldStart + tail.oldCount));
+
+        if (cyan) out << cyan;
+        out << "@@ -" << hunkRange(oldStart, oldEnd - oldStart)
+            << " +" << hunkRange(newStart, newEnd - newStart) << " @@";
+        if (cyan) out << "\033[0m";
+        out << "\n";
+
+        std::size_t i = oldStart;
+        for (std::size_t c = first; c <= last; ++c) {
+            for (; i < changes[c].oldStart; ++i) writeLine(out, ' ', linesA[i], nullptr);
+            for (std::size_t k = 0; k < changes[c].oldCount; ++k) writeLine(out, '-', linesA[changes[c].oldStart + k], red);
+            for (std::size_t k = 0; k < changes[c].newCount; ++k) writeLine(out, '+', linesB[changes[c].newStart + k], green);
+            i = changes[c].oldStart + changes[c].oldCount;
+        }
+        for (; i < oldEnd; ++i) writeLine(out, ' ', linesA[i], nullptr);
+
+        first = last + 1;
+    }
+    return out.str();
+}
+
+MergeResult merge3(const std::string& base, const std::string& ours, const std::string& theirs,
+                   const MergeOptions& options) {
+    TRACE_SCOPE("textdiff::merge3");
+    auto baseLines = splitLines(base);
+    auto oursLines = splitLines(ours);
+    auto theirsLines = splitLines(theirs);
+    auto oursChanges = diffLines(baseLines, oursLines, options.algorithm);
+    auto theirsChanges = diffLines(baseLines, theirsLines, options.algorithm);
+
+    MergeResult result;
+    std::string& out = result.text;
+    out.reserve(std::max(ours.size(), theirs.size()));
+    auto copy = [&](const std::vector<std::string_view>& lines, std::size_t begin, std::size_t end) {
+        for (std::size_t k = begin; k < end; ++k) out.append(lines[k]);
+    };
+    // Inside a conflict every line needs its '\n' so the next marker starts a line.
+    auto copyBlock = [&](const std::vector<std::string_view>& lines, std::size_t begin, std::size_t end) {
+        for (std::size_t k = begin; k < end; ++k) {
+            out.append(lines[k]);
+            if (lines[k].back() != '\n') out += '\n';
+        }
+    };
+
+    std::size_t pos = 0, i = 0, j = 0;
+    while (i < oursChanges.size() || j < theirsChanges.size()) {
+        // Start at the earliest pending change and absorb every change, from
+        // either side, that overlaps or touches the region so far.
+        const bool oursFirst = j == theirsChanges.size() ||
+                               (i < oursChanges.size() && oursChanges[i].oldStart <= theirsChanges[j].oldStart);
+        const Change& seed = oursFirst ? oursChanges[i] : theirsChanges[j];
+        std::size_t lo = seed.oldStart, hi = seed.oldStart + seed.oldCount;
+        const std::size_t i0 = i, j0 = j;
+        for (bool grew = true; grew;) {
+            grew = false;
+            if (i < oursChanges.size() && oursChanges[i].oldStart <= hi) {
+                hi = std::max(hi, oursChanges[i].oldStart + oursChanges[i].oldCount);
+                ++i;
+                grew = true;
+            }
+            if (j < theirsChanges.size() && theirsChanges[j].oldStart <= hi) {
+                hi = std::max(hi, theirsChanges[j].oldStart + theirsChanges[j].oldCount);
+                ++j;
+                grew = true;
+            }
+        }
+
+        copy(baseLines, pos, lo);
+        pos = hi;
+        if (i0 == i) {
+            Span t = sideSpan(theirsChanges, j0, j, lo, hi);
+            copy(theirsLines, t.begin, t.end);
+            continue;
+        }
+        Span o = sideSpan(oursChanges, i0, i, lo, hi);
+        if (j0 == j) {
+            copy(oursLines, o.begin, o.end);
+            continue;
+        }
+        Span t = sideSpan(theirsChanges, j0, j, lo, hi);
+        if (sameLines(oursLines, o, theirsLines, t)) {
+            copy(oursLines, o.begin, o.end);
+            continue;
+        }
+
+        // A real conflict: keep lines both sides agree on outside the markers.
+        while (o.begin < o.end && t.begin < t.end && oursLines[o.begin] == theirsLines[t.begin]) {
+            out.append(oursLines[o.begin]);
+            ++o.begin;
+            ++t.begin;
+        }
+        std::size_t suffix = 0;
+        while (o.end - suffix > o.begin && t.end - suffix > t.begin &&
+               oursLines[o.end - suffix - 1] == theirsLines[t.end - suffix - 1]) {
+            ++suffix;
+        }
+
+        ++result.conflicts;
+        out += "<<<<<<< " + options.oursLabel + "\n";
+        copyBlock(oursLines, o.begin, o.end - suffix);
+        out += "||||||| " + options.baseLabel + "\n";
+        copyBlock(baseLines, lo, hi);
+        out += "=======\n";
+        copyBlock(theirsLines, t.begin, t.end - suffix);
+        out += ">>>>>>> " + options.theirsLabel + "\n";
+        copy(oursLines, o.end - suffix, o.end);
+    }
+    copy(baseLines, pos, baseLines.size());
+    return result;
+}
+
+}
@@ -0,0 +1,69 @@
+#ifndef TEXTDIFF_HPP
+#define TEXTDIFF_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace textdiff {
+
+enum class Algorithm {
+    Myers,     // minimal edit script, O(ND) time, linear space
+    Histogram, // anchors on rare lines first; reads better on code, falls back to Myers
+    Patience   // anchors on lines unique to both sides, falls back to Myers
+};
+
+// Parses "myers", "histogram" or "patience"
+bool parseAlgorithm(const std::string& name, Algorithm& out);
+
+// A[oldStart, oldStart+oldCount) was replaced by B[newStart, newStart+newCount).
+// Lines between consecutive changes are equal on both sides.
+struct Change {
+    std::size_t oldStart;
+    std::size_t oldCount;
+    std::size_t newStart;
+    std::size_t newCount;
+};
+
+// Splits text into lines; each view keeps its trailing '\n' (the last may lack one)
+std::vector<std::string_view> splitLines(std::string_view text);
+
+// Changes turning a into b, in order
+std::vector<Change> diffLines(const std::vector<std::string_view>& a,
+                              const std::vector<std::string_view>& b,
+                              Algorithm algorithm = Algorithm::Histogram);
+
+struct UnifiedOptions {
+    std::size_t context = 3;
+    Algorithm algorithm = Algorithm::Histogram;
+    bool color = false;
+};
+
+// Unified diff ("---/+++" header and "@@" hunks); empty if the texts are equal
+std::string unifiedDiff(const std::string& a, const std::string& b,
+                        const std::string& labelA, const std::string& labelB,
+                        const UnifiedOptions& options = {});
+
+struct MergeOptions {
+    std::string oursLabel = "HEAD";
+    std::string baseLabel = "base";
+    std::string theirsLabel = "theirs";
+    Algorithm algorithm = Algorithm::Histogram;
+};
+
+struct MergeResult {
+    std::string text;
+    std::size_t conflicts = 0; // number of conflict blocks in text
+};
+
+// Three-way line merge of ours and theirs against their common base. Hunks
+// changed on only one side (or identically on both) are taken as-is; the rest
+// become diff3-style conflict blocks, with lines common to both sides moved
+// outside the markers.
+MergeResult merge3(const std::string& base, const std::string& ours, const std::string& theirs,
+                   const MergeOptions& options = {});
+
+}
+
+#endif
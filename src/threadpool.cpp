@@ -0,0 +1,178 @@
+#include "threadpool.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+
+namespace utils {
+
+namespace {
+// Which pool and deque the current thread works for, so nested submits stay local.
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local std::size_t currentQueue = 0;
+}
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < threads; ++i) queues_.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < threads; ++i) threads_.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stop_ = true;
+    }
+    workAvailable_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    // Output of a daemon request follows its work onto the pool.
+    if (OutputCapture* capture = currentCapture()) {
+        task = [capture, inner = std::move(task)] {
+            ScopedCapture scope(capture);
+            inner();
+        };
+    }
+    std::size_t target = currentPool == this ? currentQueue : nextQueue_++ % queues_.size();
+    ++pending_;
+    {
+        std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+        queues_[target]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        ++queued_;
+    }
+    workAvailable_.notify_one();
+}
+
+bool ThreadPool::takeTask(std::size_t self, std::function<void()>& task) {
+    // Own work first, newest first (it is the most likely to be cache-warm)...
+    if (self < queues_.size()) {
+        Queue& own = *queues_[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --queued_;
+            return true;
+        }
+    }
+    // ...then steal the oldest task from someone else.
+    for (std::size_t i = 1; i <= queues_.size(); ++i) {
+        Queue& victim = *queues_[(self + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --queued_;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::runTask(std::function<void()>& task) {
+    try {
+        task();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex_);
+        if (!error_) error_ = std::current_exception();
+    }
+    task = nullptr;
+    if (--pending_ == 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        allDone_.notify_all();
+    }
+}
+
+void ThreadPool::workerLoop(std::size_t index) {
+    currentPool = this;
+    currentQueue = index;
+    std::function<void()> task;
+    while (true) {
+        if (takeTask(index, task)) {
+            runTask(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        workAvailable_.wait(lock, [this] { return stop_ || queued_ > 0; });
+        if (stop_) return;
+    }
+}
+
+void ThreadPool::wait() {
+    std::function<void()> task;
+    const std::size_t self = currentPool == this ? currentQueue : queues_.size();
+    while (pending_ > 0) {
+        if (takeTask(self, task)) {
+            runTask(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        allDone_.wait(lock, [this] { return pending_ == 0 || queued_ > 0; });
+    }
+
+    std::lock_guard<std::mutex> lock(errorMutex_);
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::parallelFor(std::size_t count, const std::function<void(std::size_t)>& fn) {
+    if (count == 0) return;
+    // A few batches per thread keeps stealing effective without a task per item.
+    const std::size_t batch = std::max<std::size_t>(1, count / (std::size_t(size()) * 8));
+
+    // Completion is tracked per call rather than with wait(): wait() counts
+    // every task in the pool, including the caller's own task when
+    // parallelFor is used from inside one, and would never return.
+    struct Latch {
+        std::atomic<std::size_t> remaining{0};
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    };
+    auto latch = std::make_shared<Latch>();
+    latch->remaining = (count + batch - 1) / batch;
+
+    for (std::size_t begin = 0; begin < count; begin += batch) {
+        std::size_t end = std::min(count, begin + batch);
+        submit([latch, &fn, begin, end] {
+            try {
+                for (std::size_t i = begin; i < end; ++i) fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(latch->mutex);
+                if (!latch->error) latch->error = std::current_exception();
+            }
+            if (--latch->remaining == 0) {
+                std::lock_guard<std::mutex> lock(latch->mutex);
+                latch->done.notify_all();
+            }
+        });
+    }
+
+    // Help with queued work; once nothing is left to take, every remaining
+    // batch is already running on some thread.
+    std::function<void()> task;
+    const std::size_t self = currentPool == this ? currentQueue : queues_.size();
+    while (latch->remaining > 0) {
+        if (takeTask(self, task)) {
+            runTask(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(latch->mutex);
+        latch->done.wait(lock, [&] { return latch->remaining == 0; });
+    }
+    if (latch->error) std::rethrow_exception(latch->error);
+}
+
+ThreadPool& sharedPool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+}
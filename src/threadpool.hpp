@@ -0,0 +1,68 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utils {
+
+// Work-stealing thread pool. Each worker owns a deque: it pushes and pops its
+// own tasks at the back, and idle workers steal from the front of the others.
+// Tasks may submit further tasks (e.g. one per subdirectory while walking).
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = 0); // 0 = one per hardware thread
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    // Blocks until every submitted task, including nested ones, has finished.
+    // The calling thread runs queued tasks while it waits. Rethrows the first
+    // exception a task threw.
+    void wait();
+    // Runs fn(i) for every i in [0, count), in batches, and waits for those
+    // batches only, so it is safe to call from inside a task. Rethrows the
+    // first exception fn threw.
+    void parallelFor(std::size_t count, const std::function<void(std::size_t)>& fn);
+
+    unsigned size() const { return static_cast<unsigned>(threads_.size()); }
+
+private:
+    struct Queue {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    bool takeTask(std::size_t self, std::function<void()>& task);
+    void runTask(std::function<void()>& task);
+    void workerLoop(std::size_t index);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<std::size_t> queued_{0};   // tasks sitting in a deque
+    std::atomic<std::size_t> pending_{0};  // tasks queued or running
+    std::atomic<std::size_t> nextQueue_{0};
+    std::atomic<bool> stop_{false};
+    std::mutex sleepMutex_;
+    std::condition_variable workAvailable_;
+    std::condition_variable allDone_;
+    std::mutex errorMutex_;
+    std::exception_ptr error_;
+};
+
+// Process-wide pool shared by add, status, checkout and merge
+ThreadPool& sharedPool();
+
+}
+
+#endif
@@ -0,0 +1,217 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <streambuf>
+#include <vector>
+
+namespace trace {
+
+namespace detail {
+std::atomic<bool> enabled{false};
+}
+
+namespace {
+
+constexpr std::size_t COUNTERS = static_cast<std::size_t>(Counter::Count_);
+
+const char* const COUNTER_NAMES[COUNTERS] = {
+    "files opened", "bytes read", "bytes written", "objects hashed", "bytes hashed",
+    "cache hits", "cache misses", "commits parsed", "bytes cloned", "output bytes", "output ns",
+};
+
+std::array<std::atomic<std::uint64_t>, COUNTERS> counters{};
+
+struct Event {
+    const char* name;
+    std::int64_t startNs;
+    std::int64_t durationNs;
+};
+
+// Each thread appends to its own buffer; the lock is only ever contended
+// while a report is being written.
+struct ThreadBuffer {
+    std::mutex mutex;
+    std::vector<Event> events;
+    unsigned tid = 0;
+};
+
+std::mutex registryMutex;
+std::vector<std::shared_ptr<ThreadBuffer>> registry; // kept after their threads exit
+std::set<std::string> interned;
+
+ThreadBuffer& localBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+        auto created = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(registryMutex);
+        created->tid = static_cast<unsigned>(registry.size()) + 1;
+        registry.push_back(created);
+        return created;
+    }();
+    return *buffer;
+}
+
+std::int64_t origin() {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count();
+}
+
+// Counts and times everything written to std::cout on its way to the terminal
+class TimedOutput : public std::streambuf {
+public:
+    explicit TimedOutput(std::streambuf* target) : target_(target) {}
+
+protected:
+    int overflow(int ch) override {
+        if (ch == traits_type::eof()) return traits_type::not_eof(ch);
+        char c = traits_type::to_char_type(ch);
+        return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        const std::int64_t start = detail::now();
+        std::streamsize written = target_->sputn(s, n);
+        detail::add(Counter::OutputNs, static_cast<std::uint64_t>(detail::now() - start));
+        detail::add(Counter::OutputBytes, static_cast<std::uint64_t>(written));
+        return written;
+    }
+
+    int sync() override {
+        const std::int64_t start = detail::now();
+        int result = target_->pubsync();
+        detail::add(Counter::OutputNs, static_cast<std::uint64_t>(detail::now() - start));
+        return result;
+    }
+
+private:
+    std::streambuf* target_;
+};
+
+}
+
+namespace detail {
+
+void add(Counter counter, std::uint64_t amount) {
+    counters[static_cast<std::size_t>(counter)].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void record(const char* name, std::int64_t startNs, std::int64_t endNs) {
+    ThreadBuffer& buffer = localBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back({name, startNs, endNs - startNs});
+}
+
+std::int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count() - origin();
+}
+
+}
+
+void enable() {
+    if (detail::enabled.exchange(true)) return;
+    origin();
+    static TimedOutput output(std::cout.rdbuf());
+    std::cout.rdbuf(&output);
+}
+
+const char* intern(const std::string& name) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    return interned.insert(name).first->c_str();
+}
+
+Snapshot snapshot() {
+    Snapshot snap;
+    for (std::size_t i = 0; i < COUNTERS; ++i) snap.counters[i] = counters[i].load(std::memory_order_relaxed);
+    snap.timeNs = detail::now();
+    return snap;
+}
+
+void printStats(std::ostream& out, const Snapshot& since, const std::string& title) {
+    const Snapshot current = snapshot();
+
+    struct Total {
+        std::int64_t ns = 0;
+        std::uint64_t calls = 0;
+    };
+    std::map<std::string, Total> totals;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const auto& buffer : registry) {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            for (const auto& event : buffer->events) {
+                if (event.startNs < since.timeNs) continue;
+                Total& total = totals[event.name];
+                total.ns += event.durationNs;
+                ++total.calls;
+            }
+        }
+    }
+    std::vector<std::pair<std::string, Total>> spans(totals.begin(), totals.end());
+    std::sort(spans.begin(), spans.end(), [](const auto& a, const auto& b) { return a.second.ns > b.second.ns; });
+
+    std::ostringstream text;
+    text << "--- stats: " << title << " (" << std::fixed << std::setprecision(3)
+         << (current.timeNs - since.timeNs) / 1e6 << " ms) ---\n";
+    for (std::size_t i = 0; i < COUNTERS; ++i) {
+        text << "  " << std::left << std::setw(16) << COUNTER_NAMES[i] << std::right << std::setw(14)
+             << current.counters[i] - since.counters[i] << "\n";
+    }
+    if (!spans.empty()) text << "  time by scope (ms, calls):\n";
+    for (std::size_t i = 0; i < spans.size() && i < 20; ++i) {
+        text << "    " << std::left << std::setw(28) << spans[i].first << std::right << std::setw(12)
+             << spans[i].second.ns / 1e6 << std::setw(9) << spans[i].second.calls << "\n";
+    }
+    out << text.str() << std::flush;
+}
+
+bool writeChromeTrace(const std::string& path) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+
+    auto quoted = [](const char* name) {
+        std::string s = "\"";
+        for (const char* p = name; *p; ++p) {
+            if (*p == '"' || *p == '\\') s += '\\';
+            s += *p;
+        }
+        return s + "\"";
+    };
+
+    // Timestamps and durations are in microseconds.
+    out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+    bool first = true;
+    std::int64_t last = 0;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const auto& buffer : registry) {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            for (const auto& event : buffer->events) {
+                out << (first ? "" : ",\n") << "{\"name\":" << quoted(event.name)
+                    << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid << ",\"ts\":" << event.startNs / 1000.0
+                    << ",\"dur\":" << event.durationNs / 1000.0 << "}";
+                last = std::max(last, event.startNs + event.durationNs);
+                first = false;
+            }
+        }
+    }
+    const Snapshot end = snapshot();
+    for (std::size_t i = 0; i < COUNTERS; ++i) {
+        out << (first ? "" : ",\n") << "{\"name\":" << quoted(COUNTER_NAMES[i])
+            << ",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":" << last / 1000.0
+            << ",\"args\":{\"value\":" << end.counters[i] << "}}";
+        first = false;
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return out.good();
+}
+
+}
@@ -0,0 +1,89 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Lightweight tracing: scoped timers and counters, off by default. While
+// disabled a TRACE_SCOPE or trace::count costs one relaxed atomic load.
+// Enabled by --trace <file> (Chrome trace-event JSON, viewable in
+// chrome://tracing or Perfetto) and --stats (a summary after each command).
+namespace trace {
+
+enum class Counter {
+    FilesOpened,
+    BytesRead,
+    BytesWritten,
+    ObjectsHashed,
+    BytesHashed,
+    CacheHits,
+    CacheMisses,
+    CommitsParsed,
+    BytesCloned, // placed in the working tree by reflink, in-kernel copy or hard link
+    OutputBytes, // written to stdout
+    OutputNs,    // time spent writing them
+    Count_
+};
+
+namespace detail {
+extern std::atomic<bool> enabled;
+void add(Counter counter, std::uint64_t amount);
+void record(const char* name, std::int64_t startNs, std::int64_t endNs);
+std::int64_t now();
+}
+
+inline bool enabled() {
+    return detail::enabled.load(std::memory_order_relaxed);
+}
+
+inline void count(Counter counter, std::uint64_t amount = 1) {
+    if (enabled()) detail::add(counter, amount);
+}
+
+// Records the time between construction and destruction as one event. name
+// must outlive the trace (a string literal, or from intern()).
+class Scope {
+public:
+    explicit Scope(const char* name) : name_(enabled() ? name : nullptr), start_(name_ ? detail::now() : 0) {}
+    ~Scope() {
+        if (name_) detail::record(name_, start_, detail::now());
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    const char* name_;
+    std::int64_t start_;
+};
+
+// Turns tracing on: from now on scopes and counters are recorded, and
+// writes to std::cout are counted and timed
+void enable();
+// A stable copy of name for use with Scope
+const char* intern(const std::string& name);
+
+// Counter totals and a point in time, to report on what happened since
+struct Snapshot {
+    std::array<std::uint64_t, static_cast<std::size_t>(Counter::Count_)> counters{};
+    std::int64_t timeNs = 0;
+};
+Snapshot snapshot();
+
+// Prints the counters and the time per scope name (inclusive of nested
+// scopes) recorded since `since`
+void printStats(std::ostream& out, const Snapshot& since, const std::string& title);
+// Writes every recorded event and the final counter values as Chrome
+// trace-event JSON
+bool writeChromeTrace(const std::string& path);
+
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// Times the rest of the enclosing block under the given name
+#define TRACE_SCOPE(name) ::trace::Scope TRACE_CONCAT(traceScope_, __LINE__)(name)
+
+#endif
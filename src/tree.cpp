@@ -0,0 +1,189 @@
+#include "tree.hpp"
+#include "io.hpp"
+
+#include <algorithm>
+
+namespace tree {
+
+namespace {
+
+using FileIt = std::map<std::string, std::string>::const_iterator;
+
+// Writes the tree for files [begin, end), whose paths all share their first
+// `prefix` characters (the directory being written, with its trailing '/').
+// Directories found in cache are not written again; the others are added.
+std::string writeDir(FileIt begin, FileIt end, std::size_t prefix, DirHashes* cache) {
+    const std::string dirPath = prefix == 0 ? "" : begin->first.substr(0, prefix - 1);
+    if (cache) {
+        auto cached = cache->find(dirPath);
+        if (cached != cache->end()) return cached->second;
+    }
+
+    std::vector<Entry> entries;
+    for (FileIt it = begin; it != end;) {
+        const std::string& path = it->first;
+        std::size_t slash = path.find('/', prefix);
+        if (slash == std::string::npos) {
+            entries.push_back({path.substr(prefix), it->second, false});
+            ++it;
+            continue;
+        }
+        // Paths under one directory are contiguous in a sorted map.
+        const std::string dir = path.substr(0, slash + 1);
+        FileIt last = it;
+        while (last != end && last->first.compare(0, dir.size(), dir) == 0) ++last;
+        entries.push_back({path.substr(prefix, slash - prefix), writeDir(it, last, slash + 1, cache), true});
+        it = last;
+    }
+    std::string hash = IOManager::writeBlob(serialize(std::move(entries)));
+    if (cache && !hash.empty()) (*cache)[dirPath] = hash;
+    return hash;
+}
+
+std::vector<Entry> readEntries(const std::string& treeHash) {
+    if (treeHash.empty()) return {};
+    return parse(IOManager::readBlob(treeHash));
+}
+
+void collectFiles(const std::string& treeHash, const std::string& prefix,
+                  std::map<std::string, std::string>& files, DirHashes* dirs = nullptr,
+                  const PathFilter* include = nullptr) {
+    if (dirs) dirs->emplace(prefix.empty() ? "" : prefix.substr(0, prefix.size() - 1), treeHash);
+    for (auto& entry : readEntries(treeHash)) {
+        std::string path = prefix + entry.name;
+        if (entry.isTree) path += '/';
+        if (include && !(*include)(path)) continue;
+        if (entry.isTree) collectFiles(entry.hash, path, files, dirs, include);
+        else files.emplace(std::move(path), std::move(entry.hash));
+    }
+}
+
+// Reports every file under entry as removed (side == old) or added
+void addWholeEntry(const Entry& entry, const std::string& prefix, bool old,
+                   std::vector<FileChange>& changes, const PathFilter* include) {
+    std::map<std::string, std::string> files;
+    const std::string path = prefix + entry.name + (entry.isTree ? "/" : "");
+    if (include && !(*include)(path)) return;
+    if (entry.isTree) collectFiles(entry.hash, path, files, nullptr, include);
+    else files.emplace(path, entry.hash);
+    for (auto& [path, hash] : files) {
+        if (old) changes.push_back({path, hash, ""});
+        else changes.push_back({path, "", hash});
+    }
+}
+
+void diffDir(const std::string& oldTree, const std::string& newTree, const std::string& prefix,
+             std::vector<FileChange>& changes, const PathFilter* include) {
+    if (oldTree == newTree) return;
+    auto a = readEntries(oldTree);
+    auto b = readEntries(newTree);
+
+    std::size_t i = 0, j = 0;
+    while (i < a.size() || j < b.size()) {
+        if (j == b.size() || (i < a.size() && a[i].name < b[j].name)) {
+            addWholeEntry(a[i++], prefix, true, changes, include);
+            continue;
+        }
+        if (i == a.size() || b[j].name < a[i].name) {
+            addWholeEntry(b[j++], prefix, false, changes, include);
+            continue;
+        }
+        const Entry& oldEntry = a[i++];
+        const Entry& newEntry = b[j++];
+        if (oldEntry.isTree == newEntry.isTree && oldEntry.hash == newEntry.hash) continue;
+        if (oldEntry.isTree && newEntry.isTree) {
+            const std::string dir = prefix + oldEntry.name + "/";
+            if (!include || (*include)(dir)) diffDir(oldEntry.hash, newEntry.hash, dir, changes, include);
+        } else if (!oldEntry.isTree && !newEntry.isTree) {
+            const std::string path = prefix + oldEntry.name;
+            if (!include || (*include)(path)) changes.push_back({path, oldEntry.hash, newEntry.hash});
+        } else {
+            // A file became a directory or the other way round.
+            addWholeEntry(oldEntry, prefix, true, changes, include);
+            addWholeEntry(newEntry, prefix, false, changes, include);
+        }
+    }
+}
+
+}
+
+std::vector<Entry> parse(const std::string& content) {
+    std::vector<Entry> entries;
+    std::size_t start = 0;
+    while (start < content.size()) {
+        std::size_t end = content.find('\n', start);
+        if (end == std::string::npos) end = content.size();
+        std::size_t typeEnd = content.find(' ', start);
+        std::size_t hashEnd = typeEnd == std::string::npos ? typeEnd : content.find(' ', typeEnd + 1);
+        if (hashEnd != std::string::npos && hashEnd < end) {
+            Entry entry;
+            entry.isTree = content.compare(start, typeEnd - start, "tree") == 0;
+            entry.hash = content.substr(typeEnd + 1, hashEnd - typeEnd - 1);
+            entry.name = content.substr(hashEnd + 1, end - hashEnd - 1);
+            entries.push_back(std::move(entry));
+        }
+        start = end + 1;
+    }
+    return entries;
+}
+
+std::string serialize(std::vector<Entry> entries) {
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) { return a.name < b.name; });
+    std::string out;
+    for (const auto& entry : entries) {
+        out += entry.isTree ? "tree " : "blob ";
+        out += entry.hash + " " + entry.name + "\n";
+    }
+    return out;
+}
+
+std::string writeTree(const std::map<std::string, std::string>& files) {
+    return writeDir(files.begin(), files.end(), 0, nullptr);
+}
+
+std::string writeTree(const std::map<std::string, std::string>& files, DirHashes& cache) {
+    return writeDir(files.begin(), files.end(), 0, &cache);
+}
+
+std::map<std::string, std::string> readTreeFiles(const std::string& treeHash, DirHashes* dirs) {
+    std::map<std::string, std::string> files;
+    if (!treeHash.empty()) collectFiles(treeHash, "", files, dirs);
+    return files;
+}
+
+std::vector<FileChange> diffTrees(const std::string& oldTree, const std::string& newTree) {
+    return diffTrees(oldTree, newTree, nullptr);
+}
+
+std::vector<FileChange> diffTrees(const std::string& oldTree, const std::string& newTree,
+                                  const PathFilter& include) {
+    std::vector<FileChange> changes;
+    diffDir(oldTree, newTree, "", changes, include ? &include : nullptr);
+    std::sort(changes.begin(), changes.end(),
+              [](const FileChange& a, const FileChange& b) { return a.path < b.path; });
+    return changes;
+}
+
+std::vector<FileChange> diffFiles(const std::map<std::string, std::string>& oldFiles,
+                                  const std::map<std::string, std::string>& newFiles) {
+    std::vector<FileChange> changes;
+    auto a = oldFiles.begin();
+    auto b = newFiles.begin();
+    while (a != oldFiles.end() || b != newFiles.end()) {
+        if (b == newFiles.end() || (a != oldFiles.end() && a->first < b->first)) {
+            changes.push_back({a->first, a->second, ""});
+            ++a;
+        } else if (a == oldFiles.end() || b->first < a->first) {
+            changes.push_back({b->first, "", b->second});
+            ++b;
+        } else {
+            if (a->second != b->second) changes.push_back({a->first, a->second, b->second});
+            ++a;
+            ++b;
+        }
+    }
+    return changes;
+}
+
+}
@@ -0,0 +1,57 @@
+#ifndef TREE_HPP
+#define TREE_HPP
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Tree objects: one per directory, listing its files (blobs) and
+// subdirectories (trees) by hash. A commit records only its root tree, so
+// directories that did not change are shared between commits.
+namespace tree {
+
+struct Entry {
+    std::string name; // a single path component
+    std::string hash;
+    bool isTree = false;
+};
+
+// Parses a tree object: one "blob <hash> <name>" or "tree <hash> <name>" line per entry
+std::vector<Entry> parse(const std::string& content);
+// Serializes entries into a tree object, sorted by name
+std::string serialize(std::vector<Entry> entries);
+
+// Directory path ("" for the root, no trailing '/') -> tree hash
+using DirHashes = std::map<std::string, std::string>;
+
+// Writes one tree per directory of a path -> blob map and returns the root tree's hash
+std::string writeTree(const std::map<std::string, std::string>& files);
+// Same, but directories listed in cache are taken from it without being
+// written; the ones that had to be written are added to it
+std::string writeTree(const std::map<std::string, std::string>& files, DirHashes& cache);
+// Flattens a tree back into path -> blob, recording every directory's tree in dirs
+std::map<std::string, std::string> readTreeFiles(const std::string& treeHash, DirHashes* dirs = nullptr);
+
+// A file that differs between two snapshots; an empty hash means "absent"
+struct FileChange {
+    std::string path;
+    std::string oldHash;
+    std::string newHash;
+};
+
+// Files that differ between two trees, sorted by path. Subtrees with equal
+// hashes are skipped without being read.
+std::vector<FileChange> diffTrees(const std::string& oldTree, const std::string& newTree);
+// Says whether a file, or a directory given with its trailing '/', matters
+using PathFilter = std::function<bool(const std::string& path)>;
+// Same, leaving out what include rejects; rejected subtrees are not read
+std::vector<FileChange> diffTrees(const std::string& oldTree, const std::string& newTree,
+                                  const PathFilter& include);
+// The same for two flattened snapshots
+std::vector<FileChange> diffFiles(const std::map<std::string, std::string>& oldFiles,
+                                  const std::map<std::string, std::string>& newFiles);
+
+}
+
+#endif
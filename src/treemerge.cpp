@@ -0,0 +1,191 @@
+#include "treemerge.hpp"
+#include "commit.hpp"
+#include "io.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
+#include "tree.hpp"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+
+namespace treemerge {
+
+namespace {
+
+constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+
+// A file that changed differently on both sides, merged once the whole tree
+// has been walked
+struct FileMerge {
+    std::string path;
+    std::string base, ours, theirs; // blob hashes; "" where the file is absent
+    std::string result;             // blob for the merged tree
+    Conflict conflict{"", "", nullptr};
+};
+
+struct Dir;
+
+// One entry of a merged directory: a known hash, a pending file merge, or a
+// subdirectory that is still being merged
+struct Item {
+    std::string name;
+    bool isTree = false;
+    std::string hash;
+    std::size_t pending = NONE;
+    std::unique_ptr<Dir> dir;
+};
+
+struct Dir {
+    std::vector<Item> items;
+};
+
+// Entries of a tree, sorted by name (as tree::serialize writes them)
+std::vector<tree::Entry> readEntries(const std::string& treeHash) {
+    if (treeHash.empty()) return {};
+    return tree::parse(IOManager::readBlob(treeHash));
+}
+
+// The entry called name at position i of a sorted entry list, advancing past it
+const tree::Entry* take(const std::vector<tree::Entry>& entries, std::size_t& i, const std::string& name) {
+    if (i < entries.size() && entries[i].name == name) return &entries[i++];
+    return nullptr;
+}
+
+bool same(const tree::Entry* a, const tree::Entry* b) {
+    if (!a || !b) return a == b;
+    return a->isTree == b->isTree && a->hash == b->hash;
+}
+
+class Merger {
+public:
+    std::vector<FileMerge> files;
+    std::vector<Conflict> conflicts; // those found while walking (file/directory)
+
+    std::unique_ptr<Dir> mergeDir(const std::string& base, const std::string& ours, const std::string& theirs,
+                                  const std::string& prefix) {
+        auto b = readEntries(base), o = readEntries(ours), t = readEntries(theirs);
+
+        // Walks the three sorted lists side by side, one name at a time.
+        auto dir = std::make_unique<Dir>();
+        std::size_t ib = 0, io = 0, it = 0;
+        while (ib < b.size() || io < o.size() || it < t.size()) {
+            const std::string* next = nullptr;
+            if (ib < b.size()) next = &b[ib].name;
+            if (io < o.size() && (!next || o[io].name < *next)) next = &o[io].name;
+            if (it < t.size() && (!next || t[it].name < *next)) next = &t[it].name;
+            const std::string name = *next;
+            const tree::Entry* eb = take(b, ib, name);
+            const tree::Entry* eo = take(o, io, name);
+            const tree::Entry* et = take(t, it, name);
+
+            // Changed on at most one side, or the same way on both: take it whole.
+            const tree::Entry* taken = nullptr;
+            bool decided = true;
+            if (same(eo, et) || same(et, eb)) taken = eo;
+            else if (same(eo, eb)) taken = et;
+            else decided = false;
+            if (decided) {
+                if (taken) dir->items.push_back({name, taken->isTree, taken->hash, NONE, nullptr});
+                continue;
+            }
+
+            const std::string path = prefix + name;
+            const bool oursDir = eo && eo->isTree, theirsDir = et && et->isTree;
+            if ((oursDir || !eo) && (theirsDir || !et)) {
+                // A side that deleted the directory merges as an empty one, so
+                // only files it deleted and the other side changed conflict.
+                auto child = mergeDir(eb && eb->isTree ? eb->hash : "", eo ? eo->hash : "",
+                                      et ? et->hash : "", path + "/");
+                if (!child->items.empty()) dir->items.push_back({name, true, "", NONE, std::move(child)});
+            } else if (!oursDir && !theirsDir) {
+                FileMerge merge;
+                merge.path = path;
+                merge.base = eb && !eb->isTree ? eb->hash : "";
+                merge.ours = eo ? eo->hash : "";
+                merge.theirs = et ? et->hash : "";
+                files.push_back(std::move(merge));
+                dir->items.push_back({name, false, "", files.size() - 1, nullptr});
+            } else {
+                // A file on one side is a directory on the other; keep ours.
+                conflicts.push_back({path, "", "file/directory"});
+                if (eo) dir->items.push_back({name, eo->isTree, eo->hash, NONE, nullptr});
+            }
+        }
+        return dir;
+    }
+
+    void mergeFiles(const textdiff::MergeOptions& options) {
+        utils::sharedPool().parallelFor(files.size(), [&](std::size_t i) {
+            FileMerge& m = files[i];
+            if (m.ours.empty() || m.theirs.empty()) {
+                // Modified on one side, deleted on the other: keep the modified text.
+                m.result = m.ours.empty() ? m.theirs : m.ours;
+                m.conflict = {m.path, IOManager::readBlob(m.result), "modify/delete"};
+                return;
+            }
+            std::string base = m.base.empty() ? "" : IOManager::readBlob(m.base);
+            auto merged = textdiff::merge3(base, IOManager::readBlob(m.ours), IOManager::readBlob(m.theirs), options);
+            if (merged.conflicts > 0) {
+                m.result = m.ours;
+                m.conflict = {m.path, std::move(merged.text), "content"};
+            } else {
+                m.result = IOManager::writeBlob(merged.text);
+            }
+        });
+    }
+
+    // Writes the trees of dir bottom-up; "" if it ended up empty
+    std::string writeDir(Dir& dir) {
+        std::vector<tree::Entry> entries;
+        for (Item& item : dir.items) {
+            if (item.dir) item.hash = writeDir(*item.dir);
+            else if (item.pending != NONE) item.hash = files[item.pending].result;
+            if (!item.hash.empty()) entries.push_back({item.name, item.hash, item.isTree});
+        }
+        if (entries.empty()) return "";
+        return IOManager::writeBlob(tree::serialize(std::move(entries)));
+    }
+};
+
+}
+
+std::string treeOf(const std::string& commitHash) {
+    if (commitHash.empty()) return "";
+    auto commit = Commit::load(commitHash);
+    if (!commit) return "";
+    if (!commit->tree.empty()) return std::string(commit->tree);
+    std::map<std::string, std::string> files;
+    for (const auto& [path, hash] : commit->files) files.emplace(path, hash);
+    return tree::writeTree(files);
+}
+
+Result mergeTrees(const std::string& base, const std::string& ours, const std::string& theirs,
+                  const textdiff::MergeOptions& options) {
+    TRACE_SCOPE("treemerge::mergeTrees");
+    Result result;
+    if (ours == theirs || theirs == base) {
+        result.tree = ours;
+        return result;
+    }
+    if (ours == base) {
+        result.tree = theirs;
+        return result;
+    }
+
+    Merger merger;
+    auto root = merger.mergeDir(base, ours, theirs, "");
+    merger.mergeFiles(options);
+    result.tree = merger.writeDir(*root);
+    if (result.tree.empty()) result.tree = IOManager::writeBlob(tree::serialize({})); // an empty root
+
+    result.conflicts = std::move(merger.conflicts);
+    for (FileMerge& m : merger.files) {
+        if (m.conflict.kind) result.conflicts.push_back(std::move(m.conflict));
+    }
+    std::sort(result.conflicts.begin(), result.conflicts.end(),
+              [](const Conflict& a, const Conflict& b) { return a.path < b.path; });
+    return result;
+}
+
+}
@@ -0,0 +1,43 @@
+#ifndef TREEMERGE_HPP
+#define TREEMERGE_HPP
+
+#include <string>
+#include <vector>
+
+#include "textdiff.hpp"
+
+// In-memory three-way merge of trees: blobs are read from the object store
+// and merged blobs and trees are written back to it; the working directory
+// and the index are never touched. Subtrees equal on two sides are resolved
+// by hash without being read, so the cost follows what changed, not the size
+// of the repository. Merge, cherry-pick and rebase are built on it.
+namespace treemerge {
+
+struct Conflict {
+    std::string path;
+    std::string content; // merged text with conflict blocks, or the side that was not deleted
+    const char* kind;    // "content", "modify/delete" or "file/directory"
+};
+
+struct Result {
+    // Root tree of the merge. Conflicting paths hold their modified side
+    // (ours when both sides modified), so the tree is only a commit once
+    // conflicts is empty.
+    std::string tree;
+    std::vector<Conflict> conflicts;
+
+    bool clean() const { return conflicts.empty(); }
+};
+
+// The root tree of a commit ("" for no commit). Older commits that list their
+// files inline get a tree written for them.
+std::string treeOf(const std::string& commitHash);
+
+// Merges the changes from base to theirs into ours. Files changed on both
+// sides are merged line by line in parallel on the shared pool.
+Result mergeTrees(const std::string& base, const std::string& ours, const std::string& theirs,
+                  const textdiff::MergeOptions& options = {});
+
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include "utils.hpp"
+#include <atomic>
 #include <iostream>
+#include <streambuf>
 #include <sstream>
 #include <algorithm>
 #include <vector>
@@ -14,37 +16,152 @@ namespace utils {
         return (start == std::string::npos) ? "" : str.substr(start, end - start + 1);
     }
 
+    namespace {
+        std::atomic<std::size_t> errorsDisplayed{0};
+        thread_local OutputCapture* activeCapture = nullptr;
+
+        // Unbuffered, so threads writing at the same time never share a put
+        // area; each write goes to the writer's capture or to the original buffer.
+        class RoutingBuffer : public std::streambuf {
+        public:
+            RoutingBuffer(std::streambuf* fallback, bool isError) : fallback_(fallback), isError_(isError) {}
+
+        protected:
+            int overflow(int ch) override {
+                if (ch == traits_type::eof()) return traits_type::not_eof(ch);
+                char c = traits_type::to_char_type(ch);
+                return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+            }
+
+            std::streamsize xsputn(const char* s, std::streamsize n) override {
+                if (OutputCapture* capture = activeCapture) {
+                    std::lock_guard<std::mutex> lock(capture->mutex);
+                    (isError_ ? capture->err : capture->out).append(s, static_cast<std::size_t>(n));
+                    return n;
+                }
+                return fallback_->sputn(s, n);
+            }
+
+            int sync() override {
+                return activeCapture ? 0 : fallback_->pubsync();
+            }
+
+        private:
+            std::streambuf* fallback_;
+            bool isError_;
+        };
+    }
+
     void displayError(const std::string& message) {
+        if (OutputCapture* capture = activeCapture) {
+            std::lock_guard<std::mutex> lock(capture->mutex);
+            ++capture->errors;
+        } else {
+            ++errorsDisplayed;
+        }
         std::cerr << message << std::endl;
     }
 
-    void showDiff(const std::string& content1, const std::string& content2,
-                  const std::string& label1, const std::string& label2) {
-        std::istringstream stream1(content1);
-        std::istringstream stream2(content2);
-
-        std::string line1, line2;
-        std::vector<std::string> lines1, lines2;
+    std::size_t errorCount() {
+        if (OutputCapture* capture = activeCapture) {
+            std::lock_guard<std::mutex> lock(capture->mutex);
+            return capture->errors;
+        }
+        return errorsDisplayed;
+    }
 
-        while (std::getline(stream1, line1)) lines1.push_back(line1);
-        while (std::getline(stream2, line2)) lines2.push_back(line2);
+    OutputCapture* currentCapture() {
+        return activeCapture;
+    }
 
-        size_t maxLines = std::max(lines1.size(), lines2.size());
+    ScopedCapture::ScopedCapture(OutputCapture* capture) : previous_(activeCapture) {
+        activeCapture = capture;
+    }
 
-        std::cout << " Diff between " << label1 << " and " << label2 << ":\n\n";
+    ScopedCapture::~ScopedCapture() {
+        activeCapture = previous_;
+    }
 
-        for (size_t i = 0; i < maxLines; ++i) {
-            std::string l1 = (i < lines1.size()) ? lines1[i] : "";
-            std::string l2 = (i < lines2.size()) ? lines2[i] : "";
+    void routeStandardStreams() {
+        static RoutingBuffer out(std::cout.rdbuf(), false);
+        static RoutingBuffer err(std::cerr.rdbuf(), true);
+        std::cout.rdbuf(&out);
+        std::cerr.rdbuf(&err);
+    }
 
-            if (l1 != l2) {
-                std::cout << "\033[1;31m- " << i + 1 << "    " << l1 << "\033[0m\n"; // red
-                std::cout << "\033[1;32m+ " << i + 1 << "    " << l2 << "\033[0m\n"; // green
-            }
-        }
+    void showDiff(const std::string& content1, const std::string& content2,
+                  const std::string& label1, const std::string& label2,
+                  textdiff::Algorithm algorithm) {
+        textdiff::UnifiedOptions options;
+        options.algorithm = algorithm;
+        options.color = true;
+        std::cout << textdiff::unifiedDiff(content1, content2, label1, label2, options);
     }
-}
 
+    bool isGlob(const std::string& pattern) {
+        return pattern.find_first_of("*?[") != std::string::npos;
+    }
 
+    namespace {
+        // Matches a [...] class at pattern[p]; on success advances p past the ']'
+        bool matchClass(const std::string& pattern, size_t& p, char c) {
+            size_t i = p + 1;
+            bool negate = i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^');
+            if (negate) ++i;
+            bool matched = false;
+            bool first = true;
+            while (i < pattern.size() && (first || pattern[i] != ']')) {
+                first = false;
+                char lo = pattern[i];
+                char hi = lo;
+                if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+                    hi = pattern[i + 2];
+                    i += 2;
+                }
+                if (lo <= c && c <= hi) matched = true;
+                ++i;
+            }
+            if (i >= pattern.size()) return false; // unterminated class
+            p = i + 1;
+            return matched != negate;
+        }
 
+        bool globFrom(const std::string& pattern, size_t p, const std::string& path, size_t s) {
+            while (p < pattern.size()) {
+                char pc = pattern[p];
+                if (pc == '*') {
+                    if (p + 1 < pattern.size() && pattern[p + 1] == '*') {
+                        p += 2;
+                        bool dirs = p < pattern.size() && pattern[p] == '/';
+                        if (dirs) ++p; // "**/" also matches zero directories
+                        for (size_t k = s; k <= path.size(); ++k) {
+                            if ((!dirs || k == s || path[k - 1] == '/') && globFrom(pattern, p, path, k)) return true;
+                        }
+                        return false;
+                    }
+                    ++p;
+                    for (size_t k = s; k <= path.size(); ++k) {
+                        if (globFrom(pattern, p, path, k)) return true;
+                        if (k < path.size() && path[k] == '/') break;
+                    }
+                    return false;
+                }
+                if (s >= path.size() || (path[s] == '/' && pc != '/')) return false;
+                if (pc == '?') {
+                    ++p;
+                } else if (pc == '[') {
+                    if (!matchClass(pattern, p, path[s])) return false;
+                } else {
+                    if (pc != path[s]) return false;
+                    ++p;
+                }
+                ++s;
+            }
+            return s == path.size();
+        }
+    }
 
+    bool globMatch(const std::string& pattern, const std::string& path) {
+        return globFrom(pattern, 0, path, 0);
+    }
+}
@@ -1,15 +1,56 @@
 #ifndef UTILS_HPP
 #define UTILS_HPP
 
+#include <cstddef>
+#include <mutex>
 #include <string>
 #include <vector>
+#include "textdiff.hpp"
 
 namespace utils {
 
     std::string trim(const std::string& str);
     void displayError(const std::string& message);
+    // Number of errors displayed so far; the CLI compares it around a command
+    // to decide its exit status
+    std::size_t errorCount();
+
+    // Output of one daemon request. While a thread has a capture installed,
+    // what it writes to std::cout/std::cerr (once routeStandardStreams has
+    // been called) and the errors it displays are collected here instead.
+    // Pool tasks run under the capture of the thread that submitted them.
+    struct OutputCapture {
+        std::mutex mutex;
+        std::string out;
+        std::string err;
+        std::size_t errors = 0;
+    };
+    OutputCapture* currentCapture();
+
+    // Installs a capture on the calling thread for the lifetime of the scope
+    class ScopedCapture {
+    public:
+        explicit ScopedCapture(OutputCapture* capture);
+        ~ScopedCapture();
+        ScopedCapture(const ScopedCapture&) = delete;
+        ScopedCapture& operator=(const ScopedCapture&) = delete;
+    private:
+        OutputCapture* previous_;
+    };
+
+    // Points std::cout and std::cerr at buffers that honour captures; output
+    // from threads without one still reaches the terminal
+    void routeStandardStreams();
+    // Prints a colored unified diff of the two texts (nothing if they are equal)
     void showDiff(const std::string& content1, const std::string& content2,
-                  const std::string& label1, const std::string& label2);
+                  const std::string& label1, const std::string& label2,
+                  textdiff::Algorithm algorithm = textdiff::Algorithm::Histogram);
+
+    // True if the string contains glob metacharacters (* ? [)
+    bool isGlob(const std::string& pattern);
+    // Shell-style match on '/'-separated paths: '*' and '?' stay within one
+    // component, '**' spans components, '[...]' is a character class
+    bool globMatch(const std::string& pattern, const std::string& path);
 }
 
 #endif // UTILS_HPP
@@ -2,6 +2,15 @@
 #include "io.hpp"
 #include "dsa.hpp"
 #include "utils.hpp"
+#include "trace.hpp"
+#include "packfile.hpp"
+#include "threadpool.hpp"
+#include "tree.hpp"
+#include "commit.hpp"
+#include "gc.hpp"
+#include "treemerge.hpp"
+#include "fsmonitor.hpp"
+#include "sparse.hpp"
 
 #include <iostream>
 #include <filesystem>
@@ -9,76 +18,572 @@
 #include <ctime>
 #include <sstream>
 #include <algorithm>
+#include <cctype>
 #include <unordered_map>
 #include <fstream>
 #include <set>
+#include <map>
+#include <iomanip>
 
 namespace fs = std::filesystem;
 
 namespace vcs{
 
-void init() {
+void init(const std::string& hashAlgorithm) {
     if(IOManager::fileExists(IOManager::MINIGIT_DIR)){
         utils::displayError("MiniGit repo already exists.\n");
         return;
     }
-    if(!IOManager::initMinigitDir()){
+    hashing::Algorithm algorithm;
+    // std::hash ids are only read from old repositories, never created.
+    if (!hashing::parseAlgorithm(hashAlgorithm, algorithm) || algorithm == hashing::Algorithm::Legacy) {
+        utils::displayError("Unknown hash algorithm '" + hashAlgorithm + "'. Use sha1, sha256 or blake3.\n");
+        return;
+    }
+    if(!IOManager::initMinigitDir(hashing::algorithmName(algorithm))){
         utils::displayError("Failed to create .minigit .\n");
         return;
     }
-    std::cout << "Initialized empty MiniGit repository.\n";
+    dsa::setHashAlgorithm(algorithm);
+    std::cout << "Initialized empty MiniGit repository (" << hashing::algorithmName(algorithm) << ").\n";
 }
 
-void add(const std::string& filename) {
-    if (!IOManager::fileExists(filename)) {
-        utils::displayError("Error: File does not exist.\n");
-        return;
+namespace {
+// Branch names become paths under refs/heads, so they must stay inside it
+// and not collide with lock files
+bool validBranchName(const std::string& name) {
+    if (name.empty() || name.front() == '/' || name.front() == '-' || name.back() == '/' ||
+        name.find("..") != std::string::npos || name.find("//") != std::string::npos) {
+        return false;
+    }
+    if (name.size() >= 5 && name.compare(name.size() - 5, 5, ".lock") == 0) return false;
+    return std::none_of(name.begin(), name.end(), [](char c) {
+        return std::isspace(static_cast<unsigned char>(c)) || std::iscntrl(static_cast<unsigned char>(c)) || c == '\\';
+    });
+}
+
+// Name of the checked-out branch, or "" when HEAD is detached
+std::string currentBranch() {
+    std::string head = utils::trim(IOManager::readFile(IOManager::HEAD_FILE));
+    const std::string prefix = "ref: refs/heads/";
+    return head.rfind(prefix, 0) == 0 ? head.substr(prefix.size()) : "";
+}
+
+// Maps each file recorded in a commit to its blob hash. Parsed lists are
+// cached, since merge, status and diff ask for the same commits repeatedly.
+std::map<std::string, std::string> readCommitFiles(const std::string& commitHash) {
+    TRACE_SCOPE("vcs::readCommitFiles");
+    if (commitHash.empty()) return {};
+    if (auto cached = IOManager::cachedCommitFiles(commitHash)) return *cached;
+
+    auto commit = Commit::load(commitHash);
+    if (!commit) return {};
+    std::map<std::string, std::string> files;
+    if (!commit->tree.empty()) {
+        files = tree::readTreeFiles(std::string(commit->tree));
+    } else {
+        for (const auto& [path, hash] : commit->files) files.emplace(path, hash);
+    }
+    IOManager::cacheCommitFiles(commitHash, std::make_shared<const FileMap>(files));
+    return files;
+}
+
+// Files that differ between two commits (either may be "" for "no commit"),
+// leaving out what include rejects. Trees are compared by hash when both
+// sides have them.
+std::vector<tree::FileChange> changedFiles(const std::string& oldCommit, const std::string& newCommit,
+                                           const tree::PathFilter& include = nullptr) {
+    TRACE_SCOPE("vcs::changedFiles");
+    auto oldParsed = Commit::load(oldCommit);
+    auto newParsed = Commit::load(newCommit);
+    const bool oldHasTree = !oldParsed || !oldParsed->tree.empty();
+    const bool newHasTree = !newParsed || !newParsed->tree.empty();
+    if (oldHasTree && newHasTree) {
+        return tree::diffTrees(oldParsed ? std::string(oldParsed->tree) : "",
+                               newParsed ? std::string(newParsed->tree) : "", include);
+    }
+    auto changes = tree::diffFiles(readCommitFiles(oldCommit), readCommitFiles(newCommit));
+    if (include) {
+        changes.erase(std::remove_if(changes.begin(), changes.end(),
+                                     [&](const tree::FileChange& change) { return !include(change.path); }),
+                      changes.end());
+    }
+    return changes;
+}
+
+// Keeps a diff to the sparse checkout, which is all the working directory
+// holds; none is needed for a full one
+tree::PathFilter inCheckout(const sparse::Patterns& patterns) {
+    if (patterns.full()) return nullptr;
+    return [&patterns](const std::string& path) { return patterns.includes(path); };
+}
+
+// Files that differ between two trees within the sparse checkout; subtrees
+// outside it are not read
+std::vector<tree::FileChange> checkoutChanges(const std::string& oldTree, const std::string& newTree) {
+    const sparse::Patterns patterns = sparse::load();
+    return tree::diffTrees(oldTree, newTree, inCheckout(patterns));
+}
+
+// Drops the directories that removing path left empty
+void removeEmptyParents(const std::string& path) {
+    std::error_code ec;
+    for (fs::path dir = fs::path(path).parent_path(); !dir.empty() && fs::is_empty(dir, ec) && !ec;
+         dir = dir.parent_path()) {
+        fs::remove(dir, ec);
+    }
+}
+
+// Brings the working directory from one snapshot to another: writes the files
+// whose new hash is set and removes the rest. Returns the number written.
+std::size_t applyChanges(const std::vector<tree::FileChange>& changes) {
+    TRACE_SCOPE("vcs::applyChanges");
+    std::vector<char> removed(changes.size(), 0);
+    utils::sharedPool().parallelFor(changes.size(), [&](std::size_t i) {
+        const tree::FileChange& change = changes[i];
+        if (change.newHash.empty()) {
+            std::error_code ec;
+            removed[i] = fs::remove(change.path, ec);
+            return;
+        }
+        fs::path parent = fs::path(change.path).parent_path();
+        if (!parent.empty()) IOManager::createDir(parent.string());
+        IOManager::readBlobToFile(change.newHash, change.path);
+    });
+
+    std::size_t written = 0;
+    for (std::size_t i = 0; i < changes.size(); ++i) {
+        if (!changes[i].newHash.empty()) {
+            ++written;
+            continue;
+        }
+        if (!removed[i]) continue;
+        std::cout << "Removed file: " << changes[i].path << "\n";
+        removeEmptyParents(changes[i].path);
+    }
+    return written;
+}
+
+// Moves the checked-out branch (or a detached HEAD) from expected to commit.
+// Another process may have moved the branch since expected was read.
+bool advanceHead(const std::string& expected, const std::string& commitHash) {
+    std::string branchName = currentBranch();
+    if (branchName.empty()) return IOManager::writeFile(IOManager::HEAD_FILE, commitHash); // detached HEAD
+    if (IOManager::updateReference(branchName, expected, commitHash)) return true;
+    utils::displayError("Commit " + commitHash.substr(0, 7) + " was not recorded on '" + branchName + "'.");
+    return false;
+}
+
+// The index as the snapshot the next commit records. An index written before
+// snapshots only lists what was staged since the last commit, so HEAD's files
+// fill in the rest.
+std::vector<IndexEntry> readSnapshot() {
+    auto entries = IOManager::readIndexEntries();
+    if (IOManager::indexIsSnapshot()) return entries;
+
+    std::map<std::string, IndexEntry> merged;
+    for (const auto& [path, hash] : readCommitFiles(IOManager::resolveHEAD())) {
+        IndexEntry entry;
+        entry.path = path;
+        entry.hash = hash;
+        merged.emplace(path, std::move(entry));
     }
+    for (auto& entry : entries) merged[entry.path] = std::move(entry);
+    std::vector<IndexEntry> snapshot;
+    snapshot.reserve(merged.size());
+    for (auto& [path, entry] : merged) snapshot.push_back(std::move(entry));
+    return snapshot;
+}
 
-    std::string content = IOManager::readFile(filename);
-    std::string hash = IOManager::writeBlob(content); // also computes SHA1
+// Resets the index to the snapshot in treeHash once changes (sorted by path)
+// brought the working directory there. Files just written get fresh stat
+// data; the others keep theirs if the index already had the same content.
+void resetIndex(const std::string& treeHash, const std::vector<tree::FileChange>& changes) {
+    TRACE_SCOPE("vcs::resetIndex");
+    tree::DirHashes trees;
+    auto files = tree::readTreeFiles(treeHash, &trees);
+    auto old = IOManager::readIndexEntries();
 
-    auto staged = IOManager::readIndex();
-    bool updated = false;
-    for (auto& pair : staged) {
-        if (pair.first == filename) {
-            pair.second = hash;
-            updated = true;
+    std::vector<IndexEntry> entries;
+    entries.reserve(files.size());
+    auto o = old.begin();
+    auto c = changes.begin();
+    for (const auto& [path, hash] : files) {
+        IndexEntry entry;
+        entry.path = path;
+        entry.hash = hash;
+        while (c != changes.end() && c->path < path) ++c;
+        while (o != old.end() && o->path < path) ++o;
+        if (c != changes.end() && c->path == path) {
+            IOManager::statFile(path, entry);
+        } else if (o != old.end() && o->path == path && o->hash == hash) {
+            entry.mtimeNs = o->mtimeNs;
+            entry.size = o->size;
+            entry.inode = o->inode;
         }
+        entries.push_back(std::move(entry));
     }
-    if (!updated) {
-        staged.emplace_back(filename, hash);
+    IOManager::writeIndexEntries(std::move(entries), trees);
+}
+
+// True if the working file of entry may differ from it: always, unless the
+// filesystem monitor saw nothing happen to it since it was last found clean
+bool mayHaveChanged(const IndexEntry& entry, const fsmonitor::Changes* changes) {
+    return !changes || !changes->complete || entry.mtimeNs == 0 || changes->touches(entry.path);
+}
+
+// The paths among changes whose local state applying them would lose: a
+// staged version or a working file that is neither the old nor the new one.
+// Working files the filesystem monitor saw untouched are not even stat-ed.
+std::vector<std::string> localChangesIn(const std::vector<tree::FileChange>& changes) {
+    TRACE_SCOPE("vcs::localChangesIn");
+    const auto index = readSnapshot();
+    const fsmonitor::Changes monitored = fsmonitor::query();
+    auto byPath = [](const IndexEntry& entry, const std::string& path) { return entry.path < path; };
+
+    std::vector<char> lost(changes.size(), 0);
+    utils::sharedPool().parallelFor(changes.size(), [&](std::size_t i) {
+        const tree::FileChange& change = changes[i];
+        auto it = std::lower_bound(index.begin(), index.end(), change.path, byPath);
+        const IndexEntry* entry = it != index.end() && it->path == change.path ? &*it : nullptr;
+        const std::string staged = entry ? entry->hash : "";
+        if (staged != change.oldHash && staged != change.newHash) {
+            lost[i] = 1;
+            return;
+        }
+        if (entry && !mayHaveChanged(*entry, &monitored)) return;
+
+        IndexEntry current;
+        if (!IOManager::statFile(change.path, current)) return; // nothing on disk to lose
+        if (entry && IOManager::statMatches(*entry, current)) return;
+        const std::string actual = IOManager::hashFile(change.path);
+        lost[i] = actual != change.oldHash && actual != change.newHash;
+    });
+
+    std::vector<std::string> paths;
+    for (std::size_t i = 0; i < changes.size(); ++i) {
+        if (lost[i]) paths.push_back(changes[i].path);
     }
-    IOManager::updateIndex(staged);
+    return paths;
+}
 
-    std::cout << "Staged file: " << filename << " (" << hash.substr(0, 7) << ")\n";
+// False, after listing them, if applying changes would lose local changes;
+// command names what would overwrite them
+bool keepsLocalChanges(const std::vector<tree::FileChange>& changes, const std::string& command) {
+    auto lost = localChangesIn(changes);
+    if (lost.empty()) return true;
+    std::string message = "Your local changes to these files would be overwritten by " + command + ":\n";
+    for (const auto& path : lost) message += "  " + path + "\n";
+    utils::displayError(message + "Commit or discard them first.");
+    return false;
 }
 
-void commit(const std::string& message) {
-    auto staged = IOManager::readIndex();
-    if (staged.empty()) {
-        std::cout << "Nothing to commit.\n";
-        return;
+// False, with an error, if the index holds staged changes: command rebuilds
+// it from the tree it writes, which would drop them
+bool nothingStaged(const std::string& headCommit, const std::string& command) {
+    auto entries = readSnapshot();
+    if (headCommit.empty() && entries.empty()) return true;
+    std::map<std::string, std::string> files;
+    for (const auto& entry : entries) files.emplace_hint(files.end(), entry.path, entry.hash);
+    CacheTree trees = IOManager::readCacheTree();
+    if (tree::writeTree(files, trees) == treemerge::treeOf(headCommit)) return true;
+    utils::displayError("You have staged changes that " + command + " would drop.\nCommit them first.");
+    return false;
+}
+
+// False, with an error, while a merge or cherry-pick that stopped on
+// conflicts waits for its commit: command would start over the half-done one
+bool nothingInProgress(const std::string& command) {
+    const char* pending = IOManager::fileExists(IOManager::MERGE_HEAD_FILE) ? "merge"
+                        : IOManager::fileExists(IOManager::CHERRY_PICK_HEAD_FILE) ? "cherry-pick" : nullptr;
+    if (!pending) return true;
+    utils::displayError(std::string("A ") + pending + " stopped on conflicts is in progress.\n"
+                        "Resolve the conflicts, add the files and commit before running " + command + ".");
+    return false;
+}
+
+// Writes a merge that stopped on conflicts into the working directory: the
+// clean part of the result, then each conflicting file with its markers. The
+// index gets the merged snapshot, with our side at the conflicting paths, so
+// the user only adds what they fix. A conflict outside the sparse checkout is
+// written all the same, as there is no other place to resolve it. False if
+// that would overwrite local changes, in which case nothing is written.
+bool writeConflictedMerge(const std::string& headCommit, const treemerge::Result& result,
+                          const std::string& command) {
+    const sparse::Patterns patterns = sparse::load();
+    auto changes = tree::diffTrees(treemerge::treeOf(headCommit), result.tree, inCheckout(patterns));
+
+    // Files rewritten with markers but otherwise unchanged must be clean too.
+    auto guarded = changes;
+    const auto index = IOManager::readIndexEntries();
+    auto byPath = [](const IndexEntry& entry, const std::string& path) { return entry.path < path; };
+    for (const auto& conflict : result.conflicts) {
+        if (std::string(conflict.kind) == "file/directory") continue;
+        auto changed = std::lower_bound(changes.begin(), changes.end(), conflict.path,
+                                        [](const tree::FileChange& c, const std::string& path) { return c.path < path; });
+        if (changed != changes.end() && changed->path == conflict.path) continue;
+        auto it = std::lower_bound(index.begin(), index.end(), conflict.path, byPath);
+        const std::string staged = it != index.end() && it->path == conflict.path ? it->hash : "";
+        guarded.push_back({conflict.path, staged, staged});
+    }
+    if (!keepsLocalChanges(guarded, command)) return false;
+    applyChanges(changes);
+
+    for (const auto& conflict : result.conflicts) {
+        if (std::string(conflict.kind) == "file/directory") continue; // ours stays in place
+        fs::path parent = fs::path(conflict.path).parent_path();
+        if (!parent.empty()) IOManager::createDir(parent.string());
+        IOManager::writeFile(conflict.path, conflict.content);
+    }
+    // Files rewritten with markers no longer match their stat data, so status
+    // reports them as modified until they are added.
+    resetIndex(result.tree, changes);
+
+    std::cout << "Conflicts in the following files:\n";
+    for (const auto& conflict : result.conflicts) {
+        std::cout << " - " << conflict.path << " (" << conflict.kind << ")"
+                  << (patterns.includes(conflict.path) ? "" : ", outside the sparse checkout") << "\n";
+    }
+    std::cout << "Resolve conflicts, add the files and commit the result.\n";
+    return true;
+}
+
+bool isUnder(const std::string& path, const std::string& dir) {
+    return dir == "." || path == dir || (path.size() > dir.size() && path[dir.size()] == '/' &&
+                                         path.compare(0, dir.size(), dir) == 0);
+}
+
+// Appends the tracked paths (sorted) that are spec itself or lie under it,
+// leaving out those the monitor knows to be unchanged if changes is given and
+// those outside the sparse checkout if checkout is
+void addTrackedUnder(const std::vector<IndexEntry>& tracked, const std::string& spec,
+                     std::vector<std::string>& paths, const fsmonitor::Changes* changes = nullptr,
+                     const sparse::Patterns* checkout = nullptr) {
+    auto byPath = [](const IndexEntry& entry, const std::string& path) { return entry.path < path; };
+    auto first = spec == "." ? tracked.begin() : std::lower_bound(tracked.begin(), tracked.end(), spec, byPath);
+    for (auto it = first; it != tracked.end(); ++it) {
+        if (!isUnder(it->path, spec)) {
+            // spec's own entry sorts before "spec/..." but "spec-x" may come between.
+            if (it->path.compare(0, spec.size(), spec) == 0 && it->path < spec + "/") continue;
+            break;
+        }
+        if (checkout && !checkout->includes(it->path)) continue;
+        if (mayHaveChanged(*it, changes)) paths.push_back(it->path);
+    }
+}
+
+// Expands add arguments (files, directories, globs) into a sorted, de-duplicated
+// list of paths. Directories are walked in parallel, unless the filesystem
+// monitor can tell which paths under them changed. Tracked paths that match
+// are included even once deleted, so adding them stages the deletion, except
+// outside the sparse checkout, where they are missing on purpose.
+std::vector<std::string> expandPathspecs(const std::vector<std::string>& specs,
+                                         const std::vector<IndexEntry>& tracked,
+                                         const fsmonitor::Changes& changes) {
+    const sparse::Patterns patterns = sparse::load();
+    std::vector<std::string> paths;
+    for (const auto& spec : specs) {
+        if (!utils::isGlob(spec)) {
+            const std::string path = IOManager::normalizePath(spec);
+            size_t before = paths.size();
+            std::error_code ec;
+            if (changes.complete && fs::is_directory(spec, ec)) {
+                addTrackedUnder(tracked, path, paths, &changes, &patterns);
+                for (auto& file : changes.existingFiles()) {
+                    if (isUnder(file, path)) paths.push_back(std::move(file));
+                }
+                continue;
+            }
+            addTrackedUnder(tracked, path, paths, nullptr, &patterns);
+            if (!IOManager::fileExists(spec)) {
+                if (paths.size() == before) utils::displayError("Error: File does not exist: " + spec + "\n");
+                continue;
+            }
+            auto files = IOManager::listFiles(spec);
+            paths.insert(paths.end(), files.begin(), files.end());
+            continue;
+        }
+
+        // Walk only the directory above the first wildcard.
+        const std::string pattern = IOManager::normalizePath(spec);
+        size_t slash = pattern.find_last_of('/', pattern.find_first_of("*?["));
+        const std::string base = slash == std::string::npos ? "." : pattern.substr(0, slash);
+        size_t before = paths.size();
+        for (auto& file : IOManager::listFiles(base)) {
+            if (utils::globMatch(pattern, file)) paths.push_back(std::move(file));
+        }
+        for (const auto& entry : tracked) {
+            if (patterns.includes(entry.path) && utils::globMatch(pattern, entry.path)) paths.push_back(entry.path);
+        }
+        if (paths.size() == before) utils::displayError("No files match: " + spec + "\n");
+    }
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+    return paths;
+}
+
+// Stages a batch of paths against the index snapshot entries with a single
+// atomic index write. Files are hashed and written to objects/ on the shared
+// pool; paths whose stat data still matches the index are not re-hashed, and
+// tracked paths that no longer exist are dropped from the index.
+void stagePaths(const std::vector<std::string>& paths, std::vector<IndexEntry> entries) {
+    TRACE_SCOPE("vcs::stagePaths");
+    auto byPath = [](const IndexEntry& a, const IndexEntry& b) { return a.path < b.path; };
+
+    enum Outcome : char { Missing, Unchanged, Staged };
+    std::vector<IndexEntry> results(paths.size());
+    std::vector<Outcome> outcomes(paths.size(), Missing);
+
+    utils::sharedPool().parallelFor(paths.size(), [&](size_t i) {
+        IndexEntry& current = results[i];
+        current.path = paths[i];
+        if (!IOManager::statFile(current.path, current)) return;
+
+        auto it = std::lower_bound(entries.begin(), entries.end(), current, byPath);
+        if (it != entries.end() && it->path == current.path && IOManager::statMatches(*it, current)) {
+            current.hash = it->hash;
+            outcomes[i] = Unchanged;
+            return;
+        }
+
+        current.hash = IOManager::writeBlobFromFile(current.path);
+        if (!current.hash.empty()) outcomes[i] = Staged;
+    });
+
+    // A missing path is a deletion to stage if it is tracked (an update
+    // with no hash), and an error otherwise.
+    std::vector<IndexEntry> updates;
+    size_t unchanged = 0, removed = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (outcomes[i] == Missing) {
+            auto it = std::lower_bound(entries.begin(), entries.end(), results[i], byPath);
+            if (it == entries.end() || it->path != paths[i]) {
+                utils::displayError("Error: File does not exist.\n");
+                continue;
+            }
+            results[i].hash.clear();
+            updates.push_back(std::move(results[i]));
+            ++removed;
+        } else if (outcomes[i] == Unchanged) {
+            ++unchanged;
+        } else {
+            updates.push_back(std::move(results[i]));
+        }
+    }
+
+    if (paths.size() == 1 && removed == 1) {
+        std::cout << "Staged removal: " << paths[0] << "\n";
+    } else if (paths.size() == 1 && outcomes[0] != Missing) {
+        const IndexEntry& e = outcomes[0] == Staged ? updates.front() : results[0];
+        std::cout << "Staged file: " << e.path << " (" << e.hash.substr(0, 7)
+                  << (outcomes[0] == Unchanged ? ", unchanged" : "") << ")\n";
+    } else if (paths.size() > 1) {
+        std::cout << "Staged " << updates.size() - removed << " files (" << unchanged << " unchanged";
+        if (removed > 0) std::cout << ", " << removed << " removed";
+        std::cout << ")\n";
+    }
+    if (updates.empty()) return;
+
+    // Both sides are sorted by path, so folding the updates in is one linear merge.
+    std::vector<IndexEntry> merged;
+    merged.reserve(entries.size() + updates.size());
+    auto e = entries.begin();
+    for (auto& update : updates) {
+        while (e != entries.end() && e->path < update.path) merged.push_back(std::move(*e++));
+        if (e != entries.end() && e->path == update.path) ++e;
+        if (!update.hash.empty()) merged.push_back(std::move(update));
+    }
+    while (e != entries.end()) merged.push_back(std::move(*e++));
+
+    IOManager::writeIndexEntries(std::move(merged));
+}
+}
+
+void add(const std::vector<std::string>& pathspecs) {
+    TRACE_SCOPE("vcs::add");
+    auto entries = readSnapshot();
+    auto paths = expandPathspecs(pathspecs, entries, fsmonitor::query());
+    if (paths.empty()) return;
+    stagePaths(paths, std::move(entries));
+}
+
+void add(const std::string& filename) {
+    add(std::vector<std::string>{filename});
+}
+
+void remove(const std::vector<std::string>& pathspecs, bool cached) {
+    TRACE_SCOPE("vcs::remove");
+    auto entries = readSnapshot();
+    std::vector<std::string> paths;
+    for (const auto& spec : pathspecs) {
+        size_t before = paths.size();
+        addTrackedUnder(entries, IOManager::normalizePath(spec), paths);
+        if (paths.size() == before) utils::displayError("Path is not tracked: " + spec + "\n");
     }
+    if (paths.empty()) return;
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
 
-    std::stringstream data;
-    auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-    std::string timestamp = std::ctime(&now);
-    timestamp.pop_back();
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const IndexEntry& entry) {
+        return std::binary_search(paths.begin(), paths.end(), entry.path);
+    }), entries.end());
+    if (!IOManager::writeIndexEntries(std::move(entries))) return;
+    // A file kept on disk is untracked now, which the monitor cannot see.
+    fsmonitor::markPending(paths);
 
-    data << "timestamp: " << timestamp << "\n";
-    data << "message: " << message << "\n";
+    for (const auto& path : paths) {
+        std::error_code ec;
+        if (!cached && fs::remove(path, ec)) removeEmptyParents(path);
+        std::cout << "Removed " << (cached ? "from the index: " : "file: ") << path << "\n";
+    }
+}
 
-    std::string parent = IOManager::resolveHEAD();
-    if (!parent.empty()) data << "parent: " << parent << "\n";
+void commit(const std::string& message) {
+    TRACE_SCOPE("vcs::commit");
+    auto entries = readSnapshot();
 
-    for (const auto& [filename, hash] : staged) {
-        data << "file: " << filename << " " << hash << "\n";
+    std::vector<std::string> parents;
+    std::string head = IOManager::resolveHEAD();
+    if (!head.empty()) parents.push_back(head);
+    // A merge that stopped on conflicts left the other side in MERGE_HEAD.
+    const bool merging = IOManager::fileExists(IOManager::MERGE_HEAD_FILE);
+    if (merging) {
+        std::string other = utils::trim(IOManager::readFile(IOManager::MERGE_HEAD_FILE));
+        if (!other.empty()) parents.push_back(other);
     }
+    // A cherry-pick that stopped on conflicts left the picked commit in
+    // CHERRY_PICK_HEAD; its message is kept unless another one is given.
+    std::string picked;
+    if (IOManager::fileExists(IOManager::CHERRY_PICK_HEAD_FILE)) {
+        picked = utils::trim(IOManager::readFile(IOManager::CHERRY_PICK_HEAD_FILE));
+    }
+    std::string text = message;
+    if (text.empty() && !picked.empty()) {
+        auto original = Commit::load(picked);
+        if (!original) return;
+        text = std::string(original->message);
+    }
+    auto donePicking = [] {
+        std::error_code ec;
+        fs::remove(IOManager::CHERRY_PICK_HEAD_FILE, ec);
+    };
 
-    std::string commitHash = dsa::computeSHA1(data.str());
-    dsa::addCommit(commitHash, parent.empty() ? std::vector<std::string>{} : std::vector<std::string>{parent});
-    IOManager::writeCommit(commitHash, data.str());
+    // Directories whose cached tree survived since it was last written are
+    // taken as they are, so only the trees above changed paths are written.
+    std::map<std::string, std::string> files;
+    for (const auto& entry : entries) files.emplace_hint(files.end(), entry.path, entry.hash);
+    CacheTree trees = IOManager::readCacheTree();
+    const std::string treeHash = tree::writeTree(files, trees);
+    if (!merging && (head.empty() ? files.empty() : treeHash == treemerge::treeOf(head))) {
+        if (!picked.empty()) {
+            donePicking();
+            std::cout << "Nothing to commit: the cherry-pick of " << picked.substr(0, 7)
+                      << " was resolved to no changes.\n";
+            return;
+        }
+        std::cout << "Nothing to commit.\n";
+        return;
+    }
 
     // Update HEAD reference
     if (!IOManager::fileExists(IOManager::HEAD_FILE)) {
@@ -86,331 +591,583 @@ void commit(const std::string& message) {
         return;
     }
 
-    std::string head = IOManager::readFile(IOManager::HEAD_FILE);
-    if (head.rfind("ref:", 0) == 0) {
-        // head is "ref: refs/heads/main\n"
-        std::string ref = head.substr(5); // yields "refs/heads/main\n"
-        // Remove the prefix "refs/heads/" (which is 11 characters) and trim the result.
-        std::string branchName = utils::trim(ref.substr(11)); // yields "main"
-        IOManager::writeReference(branchName, commitHash);
-    } else {
-        IOManager::writeFile(IOManager::HEAD_FILE, commitHash); // detached HEAD
+    std::string commitHash = Commit::create(treeHash, parents, text);
+    if (commitHash.empty() || !advanceHead(head, commitHash)) return;
+    if (merging) {
+        std::error_code ec;
+        fs::remove(IOManager::MERGE_HEAD_FILE, ec);
     }
+    if (!picked.empty()) donePicking();
 
-    IOManager::updateIndex({});
-    std::cout << "Committed as " << commitHash.substr(0, 7) << ": " << message << "\n";
+    // The index stays the snapshot just committed, now with every tree cached.
+    IOManager::writeIndexEntries(std::move(entries), trees);
+    std::cout << "Committed as " << commitHash.substr(0, 7) << ": " << text << "\n";
 }
 
 void log() {
+    TRACE_SCOPE("vcs::log");
     std::string current = IOManager::resolveHEAD();
     if (current.empty()) { // No commit found in HEAD
         std::cout << "No commits yet.\n";
         return;
     }
 
-    std::string headContent = IOManager::readFile(IOManager::HEAD_FILE);
-    if(headContent.rfind("ref:", 0)==0) {
-        std::string branch = utils::trim(headContent.substr(11)); // Assuming "refs/heads/<branch>"
-        std::cout << "On branch: " << branch << "\n\n";
+    std::string branchName = currentBranch();
+    if (!branchName.empty()) {
+        std::cout << "On branch: " << branchName << "\n\n";
     }
 
     while (!current.empty()) {
-        std::string commitData = IOManager::readCommit(current);
-        if (commitData.empty()) {
+        auto commit = Commit::load(current);
+        if (!commit) {
             utils::displayError("Commit data is missing or corrupted for commit: " + current + "\n");
             break;
         }
 
         std::cout << "Commit " << current << "\n";
+        if (commit->parents.size() > 1) {
+            std::cout << "   merge:";
+            for (auto parent : commit->parents) std::cout << " " << parent.substr(0, 7);
+            std::cout << "\n";
+        }
+        std::cout << "   timestamp: " << commit->timestamp << "\n";
+        std::cout << "   message: " << commit->message << "\n";
+
+        // Follow first parents through the commit graph rather than the commit file.
+        auto parents = dsa::getParents(current);
+        if (parents.empty()) break;
+        current = parents.front();
+    }
+}
 
-        std::istringstream iss(commitData);
-        std::string line;
-        std::string nextParent;
 
+void status() {
+    TRACE_SCOPE("vcs::status");
+    std::string branchName = currentBranch();
+    if (!branchName.empty()) std::cout << "On branch " << branchName << "\n";
+    else std::cout << "HEAD detached at " << IOManager::resolveHEAD().substr(0, 7) << "\n";
 
-        while (std::getline(iss, line)) {
-            if (line.rfind("message:", 0) == 0 || line.rfind("timestamp:", 0) == 0)
-                std::cout << "   " << line << "\n";
-            if (line.rfind("parent:", 0) == 0)
-                nextParent = line.substr(8);
+    auto index = readSnapshot();
+    auto headFiles = readCommitFiles(IOManager::resolveHEAD());
+    // With a filesystem monitor only the paths changed since the last status,
+    // and those it left pending, need a look; otherwise the whole checkout
+    // does. Paths outside a sparse checkout are never looked at.
+    const sparse::Patterns patterns = sparse::load();
+    const fsmonitor::Changes changes = fsmonitor::query();
+    std::vector<std::string> workingFiles;
+    if (!changes.complete) {
+        workingFiles = patterns.listFiles();
+    } else {
+        for (auto& path : changes.existingFiles()) {
+            if (patterns.includes(path)) workingFiles.push_back(std::move(path));
         }
+    }
 
-        if (nextParent.empty()) break;
-        current = nextParent;
+    std::vector<std::pair<std::string, std::string>> staged;     // (kind, path)
+    std::vector<std::pair<std::string, std::string>> unstaged;
+    std::vector<std::string> untracked;
+
+    // Staged changes: the index snapshot against HEAD, both sorted by path.
+    auto h = headFiles.begin();
+    for (const auto& entry : index) {
+        for (; h != headFiles.end() && h->first < entry.path; ++h) staged.emplace_back("deleted", h->first);
+        if (h == headFiles.end() || h->first != entry.path) staged.emplace_back("new file", entry.path);
+        else if ((h++)->second != entry.hash) staged.emplace_back("modified", entry.path);
     }
-}
+    for (; h != headFiles.end(); ++h) staged.emplace_back("deleted", h->first);
+
+    // Unstaged changes: the working tree against the index. Entries whose
+    // cached stat data no longer matches (or has none) are suspects and get
+    // rehashed.
+    struct Suspect { IndexEntry* entry; IndexEntry stat; bool modified; };
+    std::vector<Suspect> suspects;
+    std::set<std::string> tracked;
+    std::size_t checkedOut = 0;
+    auto inWorkingTree = [&](const std::string& path) {
+        return std::binary_search(workingFiles.begin(), workingFiles.end(), path);
+    };
+
+    for (auto& entry : index) {
+        tracked.insert(entry.path);
+        if (!patterns.includes(entry.path)) continue;
+        ++checkedOut;
+        if (changes.complete && !changes.touches(entry.path)) {
+            // Found present last time and untouched since; only its content
+            // is unknown if it has no stat data.
+            if (entry.mtimeNs != 0) continue;
+        } else if (!inWorkingTree(entry.path)) {
+            unstaged.emplace_back("deleted", entry.path);
+            continue;
+        }
+        IndexEntry current;
+        if (!IOManager::statFile(entry.path, current)) {
+            unstaged.emplace_back("deleted", entry.path);
+        } else if (!IOManager::statMatches(entry, current)) {
+            suspects.push_back({&entry, current, false});
+        }
+    }
+
+    utils::sharedPool().parallelFor(suspects.size(), [&](size_t i) {
+        Suspect& s = suspects[i];
+        s.modified = IOManager::hashFile(s.entry->path) != s.entry->hash;
+    });
 
+    // Unchanged suspects get fresh stat data so the next status can skip them.
+    bool refreshed = false;
+    for (auto& s : suspects) {
+        if (s.modified) {
+            unstaged.emplace_back("modified", s.entry->path);
+        } else {
+            s.entry->mtimeNs = s.stat.mtimeNs;
+            s.entry->size = s.stat.size;
+            s.entry->inode = s.stat.inode;
+            refreshed = true;
+        }
+    }
+    if (refreshed) IOManager::writeIndexEntries(index);
+
+    for (const auto& path : workingFiles) {
+        if (!tracked.count(path)) untracked.push_back(path);
+    }
+
+    auto byPath = [](const auto& a, const auto& b) { return a.second < b.second; };
+    std::sort(unstaged.begin(), unstaged.end(), byPath);
+
+    // Whatever still differs from the index is looked at again next time.
+    std::vector<std::string> pending(untracked);
+    for (const auto& change : unstaged) pending.push_back(change.second);
+    std::sort(pending.begin(), pending.end());
+    fsmonitor::saveState(changes.token, pending);
+
+    if (!patterns.full()) {
+        std::cout << "Sparse checkout: " << checkedOut << " of " << index.size() << " tracked files present.\n";
+    }
+    if (!staged.empty()) {
+        std::cout << "\nChanges staged for commit:\n";
+        for (const auto& [kind, path] : staged) std::cout << "  " << std::left << std::setw(12) << kind + ":" << path << "\n";
+    }
+    if (!unstaged.empty()) {
+        std::cout << "\nChanges not staged for commit:\n";
+        for (const auto& [kind, path] : unstaged) std::cout << "  " << std::left << std::setw(12) << kind + ":" << path << "\n";
+    }
+    if (!untracked.empty()) {
+        std::cout << "\nUntracked files:\n";
+        for (const auto& path : untracked) std::cout << "  " << path << "\n";
+    }
+    if (staged.empty() && unstaged.empty() && untracked.empty()) {
+        std::cout << "Nothing to commit, working tree clean.\n";
+    }
+}
 
 void branch(const std::string& branchName) {
+    TRACE_SCOPE("vcs::branch");
+    if (!validBranchName(branchName)) {
+        utils::displayError("Invalid branch name '" + branchName + "'.");
+        return;
+    }
     std::string headCommit = IOManager::resolveHEAD();
     if (headCommit.empty()) {
         std::cerr << "No commit to branch from.\n";
         return;
     }
-    IOManager::writeReference(branchName, headCommit);
+    if (IOManager::hasReference(branchName)) {
+        utils::displayError("A branch named '" + branchName + "' already exists.");
+        return;
+    }
+    if (!IOManager::updateReference(branchName, "", headCommit)) return;
     std::cout << "Created branch '" << branchName << "' at " << headCommit.substr(0, 7) << "\n";
 }
 
+void listBranches(const std::string& prefix) {
+    TRACE_SCOPE("vcs::listBranches");
+    const std::string current = currentBranch();
+    std::string out;
+    for (const auto& [name, hash] : IOManager::listReferences(prefix)) {
+        out += (name == current ? "* " : "  ") + name + "\n";
+    }
+    std::cout << out;
+}
+
+void packRefs() {
+    TRACE_SCOPE("vcs::packRefs");
+    if (!IOManager::fileExists(IOManager::MINIGIT_DIR)) {
+        utils::displayError("Not a MiniGit repository.\n");
+        return;
+    }
+    int packed = IOManager::packReferences();
+    if (packed >= 0) std::cout << "Packed " << packed << " branch" << (packed == 1 ? "" : "es") << " into packed-refs\n";
+}
+
 
-void checkout(const std::string& target) {
-    // Get current HEAD commit (old commit) before switching
+bool checkout(const std::string& target) {
+    TRACE_SCOPE("vcs::checkout");
     std::string oldCommit = IOManager::resolveHEAD();
-    std::set<std::string> oldFiles;
-    if (!oldCommit.empty()) {
-        std::string oldCommitData = IOManager::readCommit(oldCommit);
-        std::istringstream oldIss(oldCommitData);
-        std::string line;
-        while (std::getline(oldIss, line)) {
-            if (line.rfind("file: ", 0) == 0) {
-                size_t pos = line.find(' ', 6);
-                if (pos != std::string::npos) {
-                    std::string filename = line.substr(6, pos - 6);
-                    oldFiles.insert(filename);
-                }
-            }
-        }
+
+    // A branch name switches HEAD to the branch; anything else must be a
+    // commit hash and leaves HEAD detached.
+    const bool isBranch = IOManager::hasReference(target);
+    std::string commitHash = isBranch ? IOManager::readReference(target) : target;
+    if (commitHash.empty() || !IOManager::hasCommit(commitHash)) {
+        utils::displayError("Invalid branch or commit.\n");
+        return false;
     }
+    // The index is rebuilt from the target's tree.
+    if (!nothingStaged(oldCommit, "checkout")) return false;
 
-    // Try to read target as a branch reference.
-    std::string commitHash = IOManager::readReference(target);
-    if (!commitHash.empty()) {
-        // Update HEAD file to point to this branch.
+    // Only files that differ between HEAD and the target are touched, so the
+    // rest keep their mtimes (and their stat data in the index). Outside a
+    // sparse checkout nothing is touched at all.
+    const sparse::Patterns patterns = sparse::load();
+    auto changes = changedFiles(oldCommit, commitHash, inCheckout(patterns));
+    if (!keepsLocalChanges(changes, "checkout")) return false;
+    std::size_t written = applyChanges(changes);
+    resetIndex(treemerge::treeOf(commitHash), changes);
+
+    if (isBranch) {
         IOManager::writeFile(IOManager::HEAD_FILE, "ref: refs/heads/" + target);
         std::cout << "Switched to branch '" << target << "'\n";
+    } else {
+        IOManager::writeFile(IOManager::HEAD_FILE, commitHash); // detached HEAD
+        std::cout << "Checked out commit " << commitHash.substr(0, 7) << " (detached HEAD)\n";
+    }
+    if (written > 0) std::cout << "Updated " << written << " file" << (written == 1 ? "" : "s") << ".\n";
+    return true;
+}
 
-        // Retrieve commit data for the new branch.
-        std::string commitData = IOManager::readCommit(commitHash);
-        std::set<std::string> newFiles;
-        if (!commitData.empty()) {
-            std::istringstream iss(commitData);
-            std::string line;
-            while (std::getline(iss, line)) {
-                if (line.rfind("file: ", 0) == 0) {
-                    size_t pos = line.find(' ', 6);
-                    if (pos != std::string::npos) {
-                        std::string filename = line.substr(6, pos - 6);
-                        newFiles.insert(filename);
-                        std::string blobHash = line.substr(pos + 1);
-                        std::string content = IOManager::readBlob(blobHash);
-                        if (!content.empty()) {
-                            IOManager::writeFile(filename, content);
-                        }
-                    }
-                }
-            }
-        }
-        // Remove any file that was tracked in the previous commit but is not present in the new commit.
+bool sparseCheckout(const std::vector<std::string>& cones) {
+    TRACE_SCOPE("vcs::sparseCheckout");
+    if (!IOManager::fileExists(IOManager::MINIGIT_DIR)) {
+        utils::displayError("Not a MiniGit repository.\n");
+        return false;
+    }
+    const sparse::Patterns before = sparse::load();
+    const sparse::Patterns after = cones.empty() ? sparse::Patterns() : sparse::Patterns(cones);
 
-        for (const auto &file : oldFiles) {
-            if (newFiles.find(file) == newFiles.end() && IOManager::fileExists(file)) {
-                fs::remove(file);
-                std::cout << "Removed file: " << file << "\n";
-            }
-        }
-        return;
+    // Tracked files leaving the checkout are removed, those joining it are
+    // written from the index; nothing else on disk is touched.
+    auto index = readSnapshot();
+    std::vector<tree::FileChange> changes;
+    for (const auto& entry : index) {
+        const bool was = before.includes(entry.path), now = after.includes(entry.path);
+        if (was && !now) changes.push_back({entry.path, entry.hash, ""});
+        else if (!was && now) changes.push_back({entry.path, "", entry.hash});
+    }
+    auto lost = localChangesIn(changes);
+    if (!lost.empty()) {
+        std::string message = "Your local changes to these files would be lost by the sparse checkout:\n";
+        for (const auto& path : lost) message += "  " + path + "\n";
+        utils::displayError(message + "Commit or discard them first.");
+        return false;
     }
+    std::size_t written = applyChanges(changes);
 
-    // If no branch reference is found, try treating target as a commit hash (detached HEAD).
-    std::string commitData = IOManager::readCommit(target);
-    if (commitData.empty()) {
-        utils::displayError("Invalid branch or commit.\n");
-        return;
+    // Files just written get fresh stat data; removed ones lose theirs.
+    auto c = changes.begin();
+    for (auto& entry : index) {
+        if (c == changes.end() || c->path != entry.path) continue;
+        entry.mtimeNs = 0;
+        if (!(c++)->newHash.empty()) IOManager::statFile(entry.path, entry);
     }
-    IOManager::writeFile(IOManager::HEAD_FILE, target); // detached HEAD
-    std::cout << "Checked out commit " << target.substr(0, 7) << " (detached HEAD)\n";
+    if (!changes.empty()) IOManager::writeIndexEntries(std::move(index));
+    if (!sparse::save(after)) {
+        utils::displayError("Failed to write the sparse checkout patterns.");
+        return false;
+    }
+
+    if (after.full()) {
+        std::cout << "Sparse checkout disabled.\n";
+    } else {
+        std::cout << "Sparse checkout:";
+        for (const auto& cone : after.cones()) std::cout << " " << cone;
+        std::cout << "\n";
+    }
+    if (written > 0) std::cout << "Updated " << written << " file" << (written == 1 ? "" : "s") << ".\n";
+    return true;
 }
 
+void listSparseCheckout() {
+    const sparse::Patterns patterns = sparse::load();
+    if (patterns.full()) {
+        std::cout << "No sparse checkout: the whole tree is checked out.\n";
+        return;
+    }
+    for (const auto& cone : patterns.cones()) std::cout << cone << "\n";
+}
 
-void merge(const std::string& branchName) {
+bool merge(const std::string& branchName) {
+    TRACE_SCOPE("vcs::merge");
     std::string headCommit = IOManager::resolveHEAD();
     std::string otherCommit = IOManager::readReference(branchName);
     if (otherCommit.empty()) {
         utils::displayError("Branch not found.\n");
-        return;
+        return false;
     }
     
-    std::string lca = dsa::findLCA(headCommit, otherCommit);
     std::cout << "Merging branch '" << branchName << "'\n";
-    std::cout << "LCA: " << (lca.empty() ? "none" : lca.substr(0, 7)) << "\n";
-
 
-
-    if (lca == otherCommit) {
+    if (dsa::isAncestor(otherCommit, headCommit)) {
         std::cout << "Branch '" << branchName << "' is already merged.\n";
-        return;
+        return true;
     }
-    if (lca == headCommit) {
+    if (!nothingInProgress("merge") || !nothingStaged(headCommit, "merge")) return false;
+    if (headCommit.empty() || dsa::isAncestor(headCommit, otherCommit)) {
         std::cout << "Fast-forwarding to branch '" << branchName << "'.\n";
-        checkout(branchName);
-        std::cout << "Working directory updated to match branch '" << branchName << "'.\n";
-        return;
+        const sparse::Patterns patterns = sparse::load();
+        auto changes = changedFiles(headCommit, otherCommit, inCheckout(patterns));
+        if (!keepsLocalChanges(changes, "merge") || !advanceHead(headCommit, otherCommit)) return false;
+        std::size_t written = applyChanges(changes);
+        resetIndex(treemerge::treeOf(otherCommit), changes);
+        std::cout << "Updated " << written << " file" << (written == 1 ? "" : "s") << ".\n";
+        return true;
     }
 
-    // Parse commit files from each commit using a lambda.
-    auto getCommitFiles = [](const std::string& commitHash) -> std::unordered_map<std::string, std::string> {
-        std::unordered_map<std::string, std::string> files;
-        std::string commitData = IOManager::readCommit(commitHash);
-        std::istringstream iss(commitData);
-        std::string line;
-        while (std::getline(iss, line)) {
-            if (line.compare(0, 6, "file: ") == 0) {
-                size_t pos = line.find(' ', 6);
-                if (pos != std::string::npos) {
-                    std::string filename = line.substr(6, pos - 6);
-                    std::string hash = line.substr(pos + 1);
-                    files[filename] = hash;
-                }
-            }
-        }
-        return files;
-    };
+    std::string lca = dsa::findLCA(headCommit, otherCommit);
+    std::cout << "LCA: " << (lca.empty() ? "none" : lca.substr(0, 7)) << "\n";
 
-    auto baseFiles  = getCommitFiles(lca);
-    auto headFiles  = getCommitFiles(headCommit);
-    auto otherFiles = getCommitFiles(otherCommit);
-
-    // Create a set of all filenames present in either the HEAD or other branch.
-    std::set<std::string> allFiles;
-    for (const auto& [filename, _] : headFiles)
-        allFiles.insert(filename);
-    for (const auto& [filename, _] : otherFiles)
-        allFiles.insert(filename);
-
-    std::unordered_map<std::string, std::string> mergedFiles;
-    bool conflict = false;
-    std::vector<std::string> conflictFiles;
-
-    for (const auto& filename : allFiles) {
-        // Get versions from each commit; if missing, use empty string.
-        std::string baseHash  = (baseFiles.find(filename)  != baseFiles.end()) ? baseFiles[filename]  : "";
-        std::string headHash  = (headFiles.find(filename)  != headFiles.end()) ? headFiles[filename]  : "";
-        std::string otherHash = (otherFiles.find(filename) != otherFiles.end()) ? otherFiles[filename] : "";
-        
-        // If both branches did not change (or they match), use either version.
-        if (headHash == otherHash) {
-            mergedFiles[filename] = headHash; // No conflict
-        }
-        // If current branch didn't change relative to base, then adopt the other branch change.
-        else if (!baseHash.empty() && headHash == baseHash && !otherHash.empty()) {
-            mergedFiles[filename] = otherHash;
-        }
-        // If other branch didn't change relative to base, adopt the current branch change.
-        else if (!baseHash.empty() && otherHash == baseHash && !headHash.empty()) {
-            mergedFiles[filename] = headHash;
-        }
-        // Otherwise, if modifications exist in both that differ from base, mark a conflict.
-        else {
-            conflict = true;
-            conflictFiles.push_back(filename);
-            std::string headContent  = headHash.empty()  ? "" : IOManager::readBlob(headHash);
-            std::string otherContent = otherHash.empty() ? "" : IOManager::readBlob(otherHash);
-            mergedFiles[filename] = "<<<<<<< HEAD\n" + headContent +
-                                    "=======\n" + otherContent +
-                                    ">>>>>>>\n";
-        }
+    // The merge is computed entirely from objects; the working directory is
+    // only brought up to date afterwards.
+    textdiff::MergeOptions mergeOptions;
+    mergeOptions.baseLabel = lca.empty() ? "base" : lca.substr(0, 7);
+    mergeOptions.theirsLabel = branchName;
+    auto result = treemerge::mergeTrees(treemerge::treeOf(lca), treemerge::treeOf(headCommit),
+                                        treemerge::treeOf(otherCommit), mergeOptions);
+
+    if (!result.clean()) {
+        if (!writeConflictedMerge(headCommit, result, "merge")) return false;
+        // The next commit records the other branch as its second parent.
+        IOManager::writeFile(IOManager::MERGE_HEAD_FILE, otherCommit);
+        return false;
     }
 
-    if (conflict) {
-        std::cout << "Merge completed with conflicts in the following files:\n";
-        for (const auto& file : conflictFiles) {
-            std::cout << " - " << file << "\n";
-        }
-        std::cout << "Resolve conflicts and commit the result.\n";
-    } else {
-        std::cout << "Merge completed successfully.\n";
+    auto changes = checkoutChanges(treemerge::treeOf(headCommit), result.tree);
+    if (!keepsLocalChanges(changes, "merge")) return false;
+    std::string mergeMessage = "Merge branch '" + branchName + "' into current branch";
+    std::string commitHash = Commit::create(result.tree, {headCommit, otherCommit}, mergeMessage);
+    if (commitHash.empty() || !advanceHead(headCommit, commitHash)) return false;
+    applyChanges(changes);
+    resetIndex(result.tree, changes);
+    std::cout << "Merge completed successfully.\n";
+    std::cout << "Committed as " << commitHash.substr(0, 7) << ": " << mergeMessage << "\n";
+    return true;
+}
+
+bool cherryPick(const std::string& commitHash) {
+    TRACE_SCOPE("vcs::cherryPick");
+    std::string headCommit = IOManager::resolveHEAD();
+    auto picked = Commit::load(commitHash);
+    if (!picked) return false;
+    if (headCommit.empty()) {
+        utils::displayError("No commit to cherry-pick onto.");
+        return false;
     }
+    if (!nothingInProgress("cherry-pick") || !nothingStaged(headCommit, "cherry-pick")) return false;
 
+    // The picked commit's changes against its (first) parent, applied to HEAD.
+    const std::string parent = picked->parents.empty() ? "" : std::string(picked->parents.front());
+    const std::string headTree = treemerge::treeOf(headCommit);
+    textdiff::MergeOptions options;
+    options.baseLabel = parent.empty() ? "base" : parent.substr(0, 7);
+    options.theirsLabel = commitHash.substr(0, 7);
+    auto result = treemerge::mergeTrees(treemerge::treeOf(parent), headTree,
+                                        treemerge::treeOf(commitHash), options);
 
+    if (!result.clean()) {
+        if (!writeConflictedMerge(headCommit, result, "cherry-pick")) return false;
+        // The next commit takes over the picked commit's message.
+        IOManager::writeFile(IOManager::CHERRY_PICK_HEAD_FILE, commitHash);
+        std::cout << "Run 'commit' without -m to keep the message of " << commitHash.substr(0, 7) << ".\n";
+        return false;
+    }
+    if (result.tree == headTree) {
+        std::cout << "Nothing to cherry-pick: the changes of " << commitHash.substr(0, 7) << " are already here.\n";
+        return true;
+    }
 
-    // Write merged content to working directory.
-    for (const auto& [filename, blobHashOrContent] : mergedFiles) {
-        // If the merge produced conflict markers, blobHashOrContent is the final content.
-        // Otherwise, we fetch the blob content.
-        std::string finalContent;
-        if (conflict && std::find(conflictFiles.begin(), conflictFiles.end(), filename) != conflictFiles.end()) {
-            finalContent = blobHashOrContent;
-        } else {
-            finalContent = IOManager::readBlob(blobHashOrContent);
-            if (finalContent.empty()) { // In case we already stored a blob hash.
-                finalContent = blobHashOrContent; 
-            }
+    auto changes = checkoutChanges(headTree, result.tree);
+    if (!keepsLocalChanges(changes, "cherry-pick")) return false;
+    const std::string message(picked->message);
+    std::string newHash = Commit::create(result.tree, {headCommit}, message);
+    if (newHash.empty() || !advanceHead(headCommit, newHash)) return false;
+    applyChanges(changes);
+    resetIndex(result.tree, changes);
+    std::cout << "Committed as " << newHash.substr(0, 7) << ": " << message << "\n";
+    return true;
+}
+
+bool rebase(const std::string& upstream, const std::string& branchName) {
+    TRACE_SCOPE("vcs::rebase");
+    const std::string current = currentBranch();
+    const std::string target = branchName.empty() ? current : branchName;
+    if (target.empty()) {
+        utils::displayError("HEAD is detached; name the branch to rebase.");
+        return false;
+    }
+    const std::string tip = IOManager::readReference(target);
+    if (tip.empty()) {
+        utils::displayError("Branch '" + target + "' not found or has no commits.");
+        return false;
+    }
+    const std::string onto = IOManager::hasReference(upstream) ? IOManager::readReference(upstream) : upstream;
+    if (!IOManager::hasCommit(onto)) {
+        utils::displayError("Invalid upstream '" + upstream + "'.");
+        return false;
+    }
+    if (dsa::isAncestor(onto, tip) || onto == tip) {
+        std::cout << "Branch '" << target << "' is already up to date with " << upstream << ".\n";
+        return true;
+    }
+    if (!nothingInProgress("rebase") || (target == current && !nothingStaged(tip, "rebase"))) return false;
+
+    // The commits to replay: every one reachable from the tip that upstream
+    // lacks, parents before children. Merge commits are left out; the
+    // commits they brought in are replayed in their place, as git does.
+    struct Visit {
+        std::string hash;
+        std::vector<std::string> parents;
+        std::size_t next = 0;
+    };
+    std::vector<std::string> pending;
+    std::size_t merges = 0;
+    std::set<std::string> visited{tip};
+    std::vector<Visit> stack;
+    auto enter = [&](const std::string& hash) {
+        auto commit = Commit::load(hash);
+        if (!commit) return false;
+        Visit visit{hash, {}, 0};
+        for (const auto& parent : commit->parents) visit.parents.emplace_back(parent);
+        stack.push_back(std::move(visit));
+        return true;
+    };
+    if (!enter(tip)) return false;
+    while (!stack.empty()) {
+        Visit& top = stack.back();
+        if (top.next < top.parents.size()) {
+            std::string parent = top.parents[top.next++];
+            if (visited.insert(parent).second && !dsa::isAncestor(parent, onto) && !enter(parent)) return false;
+            continue;
         }
-        if (IOManager::fileExists(filename)) {
-            std::cout << "Overwriting file: " << filename << "\n";
+        if (top.parents.size() > 1) ++merges;
+        else pending.push_back(top.hash);
+        stack.pop_back();
+    }
+
+    // Each commit is replayed in memory onto the previous one; the branch
+    // only moves once all of them applied.
+    std::string newTip = onto;
+    std::string newTree = treemerge::treeOf(onto);
+    std::size_t replayed = 0, skipped = 0;
+    for (auto it = pending.begin(); it != pending.end(); ++it) {
+        auto commit = Commit::load(*it);
+        if (!commit) return false;
+        const std::string parent = commit->parents.empty() ? "" : std::string(commit->parents.front());
+        textdiff::MergeOptions options;
+        options.oursLabel = upstream;
+        options.theirsLabel = it->substr(0, 7);
+        auto result = treemerge::mergeTrees(treemerge::treeOf(parent), newTree, treemerge::treeOf(*it), options);
+        if (!result.clean()) {
+            utils::displayError("Could not replay " + it->substr(0, 7) + " (" + std::string(commit->message) +
+                                "): conflicts in " + result.conflicts.front().path +
+                                (result.conflicts.size() > 1 ? " and others" : "") + ". Branch '" + target +
+                                "' was left unchanged.");
+            return false;
         }
-        IOManager::writeFile(filename, finalContent);
+        if (result.tree == newTree) {
+            ++skipped; // already upstream
+            continue;
+        }
+        newTip = Commit::create(result.tree, {newTip}, std::string(commit->message));
+        if (newTip.empty()) return false;
+        newTree = result.tree;
+        ++replayed;
     }
 
-    std::cout << "Merged changes into the working directory.\n";
+    // Only a checked-out branch has a working directory and index to update.
+    std::vector<tree::FileChange> changes;
+    if (target == current) {
+        changes = checkoutChanges(treemerge::treeOf(tip), newTree);
+        if (!keepsLocalChanges(changes, "rebase")) return false;
+    }
+    if (!IOManager::updateReference(target, tip, newTip)) return false;
+    if (target == current) {
+        applyChanges(changes);
+        resetIndex(newTree, changes);
+    }
 
-    // Optionally, create a merge commit with a merge message.
-    std::string mergeMessage = "Merge branch '" + branchName + "' into current branch";
-    commit(mergeMessage);
+    std::cout << "Rebased '" << target << "' onto " << upstream << ": " << replayed << " commit"
+              << (replayed == 1 ? "" : "s") << " replayed";
+    if (skipped > 0) std::cout << ", " << skipped << " already applied";
+    if (merges > 0) std::cout << ", " << merges << " merge commit" << (merges == 1 ? "" : "s") << " flattened";
+    std::cout << ".\n";
+    return true;
 }
 
-void diff(const std::string& hash1, const std::string& hash2) {
-    // Read commit data for each commit hash.
-    std::string data1 = IOManager::readCommit(hash1);
-    std::string data2 = IOManager::readCommit(hash2);
-
-    if (data1.empty()) {
+void diff(const std::string& hash1, const std::string& hash2, textdiff::Algorithm algorithm) {
+    TRACE_SCOPE("vcs::diff");
+    if (!IOManager::hasCommit(hash1)) {
         utils::displayError("Commit " + hash1 + " not found or empty.\n");
         return;
     }
-    if (data2.empty()) {
+    if (!IOManager::hasCommit(hash2)) {
         utils::displayError("Commit " + hash2 + " not found or empty.\n");
         return;
     }
 
-    // Helper lambda to parse commit file entries.
-    auto parseCommitFiles = [](const std::string &commitData) -> std::unordered_map<std::string, std::string> {
-        std::unordered_map<std::string, std::string> files;
-        std::istringstream iss(commitData);
-        std::string line;
-        while (std::getline(iss, line)) {
-            // We expect lines like: "file: <filename> <blobHash>"
-            if (line.rfind("file: ", 0) == 0) {
-                size_t pos = line.find(' ', 6);
-                if (pos != std::string::npos) {
-                    std::string filename = line.substr(6, pos - 6);
-                    std::string blobHash = line.substr(pos + 1);
-                    files[filename] = blobHash;
-                }
-            }
-        }
-        return files;
-    };
+    // Unchanged directories are skipped by tree hash.
+    auto changes = changedFiles(hash1, hash2);
 
-    auto commitFiles1 = parseCommitFiles(data1);
-    auto commitFiles2 = parseCommitFiles(data2);
+    for (const auto& change : changes) {
+        std::string content1 = change.oldHash.empty() ? "" : IOManager::readBlob(change.oldHash);
+        std::string content2 = change.newHash.empty() ? "" : IOManager::readBlob(change.newHash);
 
-    // Compute union of filenames.
-    std::set<std::string> allFiles;
-    for (const auto& [filename, _] : commitFiles1) {
-        allFiles.insert(filename);
+        std::cout << "\nDiff for file: " << change.path << "\n";
+        utils::showDiff(content1, content2, hash1 + ":" + change.path, hash2 + ":" + change.path, algorithm);
     }
-    for (const auto& [filename, _] : commitFiles2) {
-        allFiles.insert(filename);
+}
+
+void pack() {
+    TRACE_SCOPE("vcs::pack");
+    if (!IOManager::fileExists(IOManager::MINIGIT_DIR)) {
+        utils::displayError("Not a MiniGit repository.\n");
+        return;
     }
 
-    // For each file in union, compare contents.
-    for (const auto& filename : allFiles) {
-        std::string blobHash1 = "";
-        std::string blobHash2 = "";
-        if (commitFiles1.find(filename) != commitFiles1.end())
-            blobHash1 = commitFiles1[filename];
-        if (commitFiles2.find(filename) != commitFiles2.end())
-            blobHash2 = commitFiles2[filename];
+    packfile::PackStats stats = packfile::packObjects();
+    if (stats.name.empty()) {
+        std::cout << "Nothing to pack.\n";
+        return;
+    }
 
-        std::string content1 = blobHash1.empty() ? "" : IOManager::readBlob(blobHash1);
-        std::string content2 = blobHash2.empty() ? "" : IOManager::readBlob(blobHash2);
+    std::cout << "Packed " << stats.objects << " objects (" << stats.deltas << " deltas) into "
+              << stats.name << "\n";
+    std::cout << "Removed " << stats.looseRemoved << " loose objects: " << stats.looseBytes
+              << " bytes loose -> " << stats.packBytes << " bytes packed\n";
+}
 
-        // Only show diff if contents differ.
-        if (content1 != content2) {
-            std::cout << "\nDiff for file: " << filename << "\n";
-            utils::showDiff(content1, content2, hash1 + ":" + filename, hash2 + ":" + filename);
-        }
+void gc(std::int64_t graceSeconds, bool pack) {
+    TRACE_SCOPE("vcs::gc");
+    if (!IOManager::fileExists(IOManager::MINIGIT_DIR)) {
+        utils::displayError("Not a MiniGit repository.\n");
+        return;
+    }
+
+    gc::Options options;
+    options.graceSeconds = graceSeconds;
+    options.pack = pack;
+    gc::Stats stats;
+    if (!gc::collect(options, stats)) return;
+
+    std::cout << "Marked " << stats.reachable << " reachable objects\n";
+    std::cout << "Pruned " << stats.pruned << " unreachable objects, reclaiming " << stats.prunedBytes
+              << " bytes";
+    if (stats.recent > 0) std::cout << " (" << stats.recent << " kept within the grace period)";
+    std::cout << "\n";
+    if (stats.tempRemoved > 0) {
+        std::cout << "Removed " << stats.tempRemoved << " abandoned temporary files (" << stats.tempBytes
+                  << " bytes)\n";
+    }
+    if (!stats.pack.name.empty()) {
+        std::cout << "Packed " << stats.pack.objects << " objects (" << stats.pack.deltas << " deltas) into "
+                  << stats.pack.name << ": " << stats.pack.packBytes << " bytes\n";
     }
 }
 }
-
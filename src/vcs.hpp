@@ -3,17 +3,39 @@
 #ifndef VCS_HPP
 #define VCS_HPP
 
+#include <cstdint>
 #include <string>
+#include <vector>
+#include "textdiff.hpp"
 
 namespace vcs {
-    void init(); 
+    void init(const std::string& hashAlgorithm = "blake3"); 
     void add(const std::string& filename);
+    void add(const std::vector<std::string>& pathspecs); // files, directories or globs
+    // stops tracking paths (files or directories), deleting them unless cached
+    void remove(const std::vector<std::string>& pathspecs, bool cached);
     void commit(const std::string& message);
     void log();
+    void status(); // staged, modified, deleted and untracked paths
     void branch(const std::string& branchName);
-    void checkout(const std::string& target); // can be branch or commit
-    void merge(const std::string& branchName);
-    void diff(const std::string& hash1, const std::string& hash2);
+    void listBranches(const std::string& prefix = ""); // branches starting with prefix, current one starred
+    void packRefs(); // moves loose branches into .minigit/packed-refs
+    bool checkout(const std::string& target); // can be branch or commit; false if it refused
+    // limits the working directory to the given directories and the files in
+    // the root (none: the whole tree again); the index keeps every path
+    bool sparseCheckout(const std::vector<std::string>& cones);
+    void listSparseCheckout();
+    bool merge(const std::string& branchName); // false if it failed or stopped on conflicts
+    bool cherryPick(const std::string& commitHash); // applies one commit's changes onto HEAD
+    // replays branch (default: the current one) onto upstream in memory; the
+    // working directory is only updated if that branch is checked out
+    bool rebase(const std::string& upstream, const std::string& branchName = "");
+    void diff(const std::string& hash1, const std::string& hash2,
+              textdiff::Algorithm algorithm = textdiff::Algorithm::Histogram);
+    void pack(); // consolidates loose objects into a delta-compressed packfile
+    // deletes objects unreachable from refs, HEAD and the index once older than
+    // the grace period, then repacks the rest unless pack is false
+    void gc(std::int64_t graceSeconds, bool pack);
 };
 
 #endif
\ No newline at end of file